@@ -0,0 +1,196 @@
+#include "llai_batch.h"
+#include "llai_parallel.h"
+#include "llai_log.h"
+#include "llai_metrics.h"
+
+#include <algorithm>
+#include <bit>
+
+using std::bad_alloc;
+using std::span, std::string_view, std::vector;
+using std::size, std::min, std::sort;
+
+#define log_batch_debug(fmt, ...)	do {} while(0) // log_debug("|batch|" fmt, __VA_ARGS__) //
+
+static  constexpr uint32_t  QUERY_GROUP_SIZE    = 32;
+static  constexpr uint32_t  PRUNED_TERM_LIMIT   = 24;  // Longer queries are scored by the blocked product.
+static  constexpr uint32_t  DOC_BLOCK_SIZE      = 1024;
+static  constexpr uint32_t  BLOCK_WORDS         = DOC_BLOCK_SIZE / 64;
+static  constexpr uint32_t  WEIGHT_CHUNK_SIZE   = 64;
+
+namespace
+{
+    struct GroupEntry {
+        llai::TermId    Term;
+        uint32_t        Query;      // Within the group
+        double          Weight;
+        double          Norm;       // Of the query
+    };
+    struct GroupTerm {
+        uint32_t        Position;   // Next posting
+        uint32_t        End;
+        uint32_t        FirstEntry;
+        uint32_t        EndEntry;
+    };
+    struct BatchScratch {
+        vector<GroupEntry>          Entries;
+        vector<GroupTerm>           Terms;
+        vector<double>              Scores;     // [query in group][document in block]
+        vector<uint64_t>            Candidates; // [query in group][document in block / 64], one bit per touched score
+    };
+    struct WeightScratch {
+        vector<llai::TokenRange>    TokenRanges;
+        llai::SparseVector          Frequencies;
+    };
+} // namespace
+
+int32_t llai::weight_queries
+    ( const span<const string_view> & queries
+    , const TermDictionary & dictionary
+    , const span<const double> & idf_scores
+    , SparseMatrix & weighted
+    , uint32_t threadCount
+    ) {
+    threadCount = thread_count(threadCount);
+    const uint32_t          queryCount  = (uint32_t)size(queries);
+    vector<SparseVector>    rows        (queryCount);
+    vector<WeightScratch>   scratch     (threadCount);
+    if(0 > parallel_for(queryCount, threadCount, WEIGHT_CHUNK_SIZE, [&](uint32_t begin, uint32_t end, uint32_t iThread) {
+        WeightScratch & local = scratch[iThread];
+        for(uint32_t iQuery = begin; iQuery < end; ++iQuery) {
+            local.TokenRanges.clear();
+            if(0 > tokenize(queries[iQuery], local.TokenRanges)
+             || 0 > term_frequency(queries[iQuery], local.TokenRanges, dictionary, local.Frequencies)
+             || 0 > weight_terms(sparse_row(local.Frequencies), idf_scores, rows[iQuery])
+            )
+                return -1;
+        }
+        return 0;
+    }))
+        return -1;
+    weighted = {};
+    for(const auto & row : rows)
+        if(0 > append_row(weighted, sparse_row(row)))
+            return -1;
+    return (int32_t)queryCount;
+}
+
+// Queries with few terms go through query_top_k, where MaxScore skips most of the postings. The product would read every posting of
+// their frequent terms instead, which on Zipf corpora is several times slower even when the whole group shares those terms. Longer
+// queries rarely let MaxScore prune, so the group scores them together as a sparse matrix product: term at a time, one block of
+// documents at a time, with every posting added to the accumulators of all the queries holding its term. Each posting list is then read
+// once per group, and the accumulators stay in cache. Terms are visited in ascending id, the order query_top_k sums a row in, so the
+// scores match it bit for bit.
+static  int32_t score_group
+    ( const llai::InvertedIndexView & index
+    , const llai::SparseMatrix & queries
+    , uint32_t begin
+    , uint32_t end
+    , uint32_t k
+    , vector<vector<llai::ScoredDoc>> & results
+    , double epsilon
+    , BatchScratch & local
+    ) {
+    const uint32_t  termCount   = (uint32_t)index.MaxScores.size();
+    const uint32_t  docCount    = (uint32_t)index.DocNorms.size();
+    local.Entries   .clear();
+    local.Terms     .clear();
+    for(uint32_t iQuery = begin; iQuery < end; ++iQuery) {
+        const llai::SparseRow   query       = llai::sparse_row(queries, iQuery);
+        if(query.Terms.size() <= PRUNED_TERM_LIMIT) {
+            if(0 > llai::query_top_k(index, query, k, results[iQuery], epsilon))
+                return -1;
+            continue;
+        }
+        const double            queryNorm   = llai::sparse_norm(query);
+        results[iQuery].clear();
+        metrics_count(llai::METRIC_COUNTER_QUERIES, 1);   // Scored together with the group, so there is no time of its own to record.
+        for(uint32_t iTerm = 0; k && queryNorm && iTerm < query.Terms.size(); ++iTerm) {
+            const llai::TermId  term        = query.Terms[iTerm];
+            if(term < termCount && 0 != query.Weights[iTerm] && index.Offsets[term] != index.Offsets[term + 1])
+                local.Entries.push_back({term, iQuery - begin, query.Weights[iTerm], queryNorm});
+        }
+    }
+    sort(local.Entries.begin(), local.Entries.end(), [](const GroupEntry & a, const GroupEntry & b) { return a.Term < b.Term || (a.Term == b.Term && a.Query < b.Query); });
+    for(uint32_t iEntry = 0; iEntry < local.Entries.size(); ) {
+        const llai::TermId  term    = local.Entries[iEntry].Term;
+        const uint32_t      first   = iEntry;
+        while(iEntry < local.Entries.size() && local.Entries[iEntry].Term == term)
+            ++iEntry;
+        local.Terms.push_back({index.Offsets[term], index.Offsets[term + 1], first, iEntry});
+    }
+    local.Scores    .resize(QUERY_GROUP_SIZE * DOC_BLOCK_SIZE, 0.0);    // Every touched score is cleared again once it is read.
+    local.Candidates.resize(QUERY_GROUP_SIZE * BLOCK_WORDS, 0);
+    for(uint32_t blockBegin = 0; blockBegin < docCount && local.Terms.size(); blockBegin += DOC_BLOCK_SIZE) {
+        const uint32_t blockEnd = min(docCount, blockBegin + DOC_BLOCK_SIZE);
+        for(GroupTerm & groupTerm : local.Terms) {
+            for(; groupTerm.Position < groupTerm.End && index.Docs[groupTerm.Position] < blockEnd; ++groupTerm.Position) {
+                const uint32_t  offset  = index.Docs[groupTerm.Position] - blockBegin;
+                const double    weight  = index.Weights[groupTerm.Position];
+                const double    docNorm = index.DocNorms[blockBegin + offset];
+                for(uint32_t iEntry = groupTerm.FirstEntry; iEntry < groupTerm.EndEntry; ++iEntry) {
+                    const GroupEntry & entry = local.Entries[iEntry];
+                    local.Scores    [entry.Query * DOC_BLOCK_SIZE + offset]     += entry.Weight * weight / (entry.Norm * docNorm + epsilon);
+                    local.Candidates[entry.Query * BLOCK_WORDS + offset / 64]   |= 1ULL << (offset % 64);
+                }
+            }
+        }
+        for(uint32_t iQuery = 0; iQuery < end - begin; ++iQuery) {
+            for(uint32_t iWord = 0; iWord < BLOCK_WORDS; ++iWord) {
+                for(uint64_t & word = local.Candidates[iQuery * BLOCK_WORDS + iWord]; word; word &= word - 1) {
+                    const uint32_t  offset  = iWord * 64 + (uint32_t)std::countr_zero(word);
+                    double &        score   = local.Scores[iQuery * DOC_BLOCK_SIZE + offset];
+                    if(score > 0)
+                        llai::push_top_k(results[begin + iQuery], k, {blockBegin + offset, score});
+                    score = 0;
+                }
+            }
+        }
+    }
+    for(uint32_t iQuery = begin; iQuery < end; ++iQuery)
+        if(queries.Offsets[iQuery + 1] - queries.Offsets[iQuery] > PRUNED_TERM_LIMIT)
+            llai::sort_top_k(results[iQuery]);
+    return 0;
+}
+
+int32_t llai::query_top_k
+    ( const InvertedIndexView & index
+    , const SparseMatrix & queries
+    , uint32_t k
+    , vector<vector<ScoredDoc>> & results
+    , uint32_t threadCount
+    , double epsilon
+    ) {
+    threadCount = thread_count(threadCount);
+    const uint32_t          queryCount  = sparse_rows(queries);
+    vector<BatchScratch>    scratch;
+    try {
+        results.resize(queryCount);
+        scratch.resize(threadCount);
+    }
+    catch (const bad_alloc & e) {
+        log_error("exception message:'%s'", e.what());
+        return -1;
+    }
+    if(0 > parallel_for(queryCount, threadCount, QUERY_GROUP_SIZE, [&](uint32_t begin, uint32_t end, uint32_t iThread) {
+        return score_group(index, queries, begin, end, k, results, epsilon, scratch[iThread]);
+    }))
+        return -1;
+    log_batch_debug("Scored %u queries against %u documents.", queryCount, (uint32_t)index.DocNorms.size());
+    return (int32_t)queryCount;
+}
+int32_t llai::query_top_k
+    ( const InvertedIndexView & index
+    , const span<const string_view> & queries
+    , const TermDictionary & dictionary
+    , const span<const double> & idf_scores
+    , uint32_t k
+    , vector<vector<ScoredDoc>> & results
+    , uint32_t threadCount
+    , double epsilon
+    ) {
+    SparseMatrix            weighted;
+    if(0 > weight_queries(queries, dictionary, idf_scores, weighted, threadCount))
+        return -1;
+    return query_top_k(index, weighted, k, results, threadCount, epsilon);
+}
@@ -0,0 +1,41 @@
+#include "llai_index.h"
+
+#ifndef LLAI_BATCH_H
+#define LLAI_BATCH_H
+
+namespace llai
+{
+    // Tokenizes and weights every query against a fixed dictionary. Row i of weighted is query i, with unknown terms dropped as in the
+    // lookup-only term_frequency.
+    int32_t     weight_queries
+        ( const std::span<const std::string_view> & queries
+        , const TermDictionary & dictionary
+        , const std::span<const double> & idf_scores
+        , SparseMatrix & weighted
+        , uint32_t threadCount
+        );
+    // Scores every row of queries against the index. Queries are taken in groups spread over threadCount threads. Within a group, queries
+    // of up to 24 terms run one at a time through the MaxScore query_top_k and share nothing, so on one thread they are no faster than a
+    // loop over it. Longer queries, which MaxScore rarely prunes, are scored together as a sparse matrix product that reads each posting
+    // list once per group, one block of documents at a time. results[i] holds the same list query_top_k returns for row i.
+    int32_t     query_top_k
+        ( const InvertedIndexView & index
+        , const SparseMatrix & queries
+        , uint32_t k
+        , std::vector<std::vector<ScoredDoc>> & results
+        , uint32_t threadCount
+        , double epsilon = 1e-6
+        );
+    int32_t     query_top_k
+        ( const InvertedIndexView & index
+        , const std::span<const std::string_view> & queries
+        , const TermDictionary & dictionary
+        , const std::span<const double> & idf_scores
+        , uint32_t k
+        , std::vector<std::vector<ScoredDoc>> & results
+        , uint32_t threadCount
+        , double epsilon = 1e-6
+        );
+} // namespace
+
+#endif // LLAI_BATCH_H
@@ -0,0 +1,36 @@
+#include "llai_cpu.h"
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#   define LLAI_CPU_X86
+#   ifdef _MSC_VER
+#       include <intrin.h>
+#       include <immintrin.h>
+#   endif
+#endif
+
+#ifdef LLAI_CPU_X86
+static bool detect_avx2         () {
+#   ifdef _MSC_VER
+    int info[4] = {};
+    __cpuid(info, 0);
+    if(info[0] < 7)
+        return false;
+    __cpuid(info, 1);
+    const bool osxsave = (info[2] >> 27) & 1;
+    __cpuidex(info, 7, 0);
+    return osxsave && ((info[1] >> 5) & 1) && (_xgetbv(0) & 6) == 6;     // AVX2 and OS-saved YMM state
+#   else
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2");
+#   endif
+}
+#endif // LLAI_CPU_X86
+
+bool    llai::cpu_has_avx2      () {
+#ifdef LLAI_CPU_X86
+    static const bool avx2 = detect_avx2();
+    return avx2;
+#else
+    return false;
+#endif
+}
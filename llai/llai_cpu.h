@@ -0,0 +1,12 @@
+#include <cstdint>
+
+#ifndef LLAI_CPU_H
+#define LLAI_CPU_H
+
+namespace llai
+{
+    // Instruction sets of the running CPU, probed once. Each also requires the OS to save the registers it uses.
+    bool    cpu_has_avx2    ();
+} // namespace
+
+#endif // LLAI_CPU_H
@@ -0,0 +1,258 @@
+#include "llai_incremental.h"
+#include "llai_log.h"
+
+#include <algorithm>
+#include <cmath>
+
+using std::bad_alloc;
+using std::span, std::string_view, std::vector;
+using std::size, std::stable_sort, std::sqrt;
+
+#define log_incremental_debug(fmt, ...)	do {} while(0) // log_debug("|incremental|" fmt, __VA_ARGS__) //
+
+namespace
+{
+    struct IngestScratch {
+        vector<llai::TokenRange>    TokenRanges;
+        llai::SparseVector          Frequencies;
+    };
+    struct Contribution {
+        uint32_t    Doc;
+        double      Value;
+    };
+} // namespace
+
+// Room for one more element, growing geometrically, so that the push_back that follows can't throw.
+template<typename T>
+static  void    reserve_next    (vector<T> & items) { if(items.size() == items.capacity()) items.reserve(items.size() * 2 + 1); }
+
+// Forgets the terms a document that failed to go in added to the dictionary, so that every term has its postings and document frequency.
+static  void    drop_terms_from (llai::IncrementalIndex & index, uint32_t termCount) {
+    for(uint32_t term = termCount; term < index.Dictionary.Terms.size(); ++term)
+        index.Dictionary.Ids.erase(index.Dictionary.Terms[term]);
+    index.Dictionary.Terms.resize(termCount);
+    if(index.Postings.size() > termCount) {
+        index.Postings      .resize(termCount);
+        index.DocFrequencies.resize(termCount);
+    }
+}
+
+// Everything that allocates happens before the index is changed, so a failure leaves the index as it was.
+static  int32_t ingest_document (llai::IncrementalIndex & index, const string_view & text, IngestScratch & scratch) {
+    const uint32_t doc          = llai::sparse_rows(index.Frequencies);
+    const uint32_t oldTermCount = (uint32_t)index.Dictionary.Terms.size();
+    scratch.TokenRanges.clear();
+    if(0 > llai::tokenize(text, scratch.TokenRanges) || 0 > llai::term_frequency(text, scratch.TokenRanges, index.Dictionary, scratch.Frequencies)) {
+        drop_terms_from(index, oldTermCount);
+        return -1;
+    }
+    try {
+        const uint32_t termCount = (uint32_t)index.Dictionary.Terms.size();
+        if(index.Postings.size() < termCount) {
+            index.Postings      .resize(termCount);
+            index.DocFrequencies.resize(termCount);
+        }
+        for(const llai::TermId term : scratch.Frequencies.Terms)
+            reserve_next(index.Postings[term]);
+        reserve_next(index.Live);
+        reserve_next(index.CachedNorms);
+    }
+    catch (const bad_alloc & e) {
+        log_error("exception message:'%s'", e.what());
+        drop_terms_from(index, oldTermCount);
+        return -1;
+    }
+    if(0 > llai::append_row(index.Frequencies, llai::sparse_row(scratch.Frequencies))) {
+        drop_terms_from(index, oldTermCount);
+        return -1;
+    }
+    index.Live          .push_back(1);
+    index.CachedNorms   .push_back(0);
+    for(uint32_t iTerm = 0; iTerm < scratch.Frequencies.Terms.size(); ++iTerm) {
+        const llai::TermId term = scratch.Frequencies.Terms[iTerm];
+        index.Postings[term].push_back({doc, scratch.Frequencies.Weights[iTerm]});
+        ++index.DocFrequencies[term];
+    }
+    ++index.LiveCount;
+    return (int32_t)doc;
+}
+int32_t llai::add_document      (IncrementalIndex & index, const string_view & text) {
+    IngestScratch   scratch;
+    const int32_t   doc     = ingest_document(index, text, scratch);
+    if(doc >= 0)
+        ++index.Epoch;
+    return doc;
+}
+int32_t llai::add_documents     (IncrementalIndex & index, const span<const string_view> & texts) {
+    const uint32_t  first   = sparse_rows(index.Frequencies);
+    IngestScratch   scratch;    // Shared by the whole batch
+    try {
+        index.Frequencies.Offsets.reserve(index.Frequencies.Offsets.size() + size(texts));
+        index.Live       .reserve(index.Live.size() + size(texts));
+        index.CachedNorms.reserve(index.CachedNorms.size() + size(texts));
+    }
+    catch (const bad_alloc & e) {
+        log_error("exception message:'%s'", e.what());
+        return -1;
+    }
+    for(uint32_t iText = 0; iText < size(texts); ++iText) {
+        if(0 > ingest_document(index, texts[iText], scratch)) {
+            log_error("Failed to add document %u of the batch.", iText);
+            ++index.Epoch;
+            return -1;
+        }
+    }
+    ++index.Epoch;
+    log_incremental_debug("Added %u documents, %u live.", (uint32_t)size(texts), index.LiveCount);
+    return (int32_t)first;
+}
+int32_t llai::remove_document   (IncrementalIndex & index, uint32_t doc) {
+    if(doc >= index.Live.size() || not index.Live[doc]) {
+        log_error("Document %u is not in the index.", doc);
+        return -1;
+    }
+    const SparseRow row = sparse_row(index.Frequencies, doc);
+    for(const TermId term : row.Terms)
+        --index.DocFrequencies[term];
+    index.Live[doc]         = 0;
+    index.RemovedPostings   += (uint32_t)row.Terms.size();
+    --index.LiveCount;
+    ++index.Epoch;
+    return 0;
+}
+double  llai::term_idf          (const IncrementalIndex & index, TermId term) {
+    return idf_score(index.LiveCount, index.DocFrequencies[term]);
+}
+double  llai::document_norm     (const IncrementalIndex & index, uint32_t doc) {
+    if(index.CachedEpoch == index.Epoch)
+        return index.CachedNorms[doc];
+    const SparseRow row     = sparse_row(index.Frequencies, doc);
+    double          norm    = 0;
+    for(uint32_t iTerm = 0; iTerm < row.Terms.size(); ++iTerm) {
+        const double weight = row.Weights[iTerm] * term_idf(index, row.Terms[iTerm]);
+        norm += weight * weight;
+    }
+    return sqrt(norm);
+}
+int32_t llai::snapshot_compaction (const IncrementalIndex & index, IndexCompaction & compaction) {
+    const uint32_t docCount = sparse_rows(index.Frequencies);
+    compaction = {};
+    try {
+        compaction.Frequencies.Offsets.reserve(docCount + 1);
+        compaction.Frequencies.Terms  .reserve(index.Frequencies.Terms.size() - index.RemovedPostings);
+        compaction.Frequencies.Weights.reserve(index.Frequencies.Terms.size() - index.RemovedPostings);
+        compaction.DocFrequencies = index.DocFrequencies;
+    }
+    catch (const bad_alloc & e) {
+        log_error("exception message:'%s'", e.what());
+        return -1;
+    }
+    for(uint32_t iDoc = 0; iDoc < docCount; ++iDoc)     // Removed documents keep an empty row so ids stay stable.
+        append_row(compaction.Frequencies, index.Live[iDoc] ? sparse_row(index.Frequencies, iDoc) : SparseRow{});
+    compaction.LiveCount        = index.LiveCount;
+    compaction.RemovedPostings  = index.RemovedPostings;
+    compaction.Epoch            = index.Epoch;
+    return 0;
+}
+int32_t llai::build_compaction    (IndexCompaction & compaction) {
+    const uint32_t docCount = sparse_rows(compaction.Frequencies);
+    try {
+        compaction.Postings.assign(compaction.DocFrequencies.size(), {});
+        for(TermId term = 0; term < compaction.DocFrequencies.size(); ++term)
+            compaction.Postings[term].reserve(compaction.DocFrequencies[term]);
+        compaction.Norms.resize(docCount);
+    }
+    catch (const bad_alloc & e) {
+        log_error("exception message:'%s'", e.what());
+        return -1;
+    }
+    for(uint32_t iDoc = 0; iDoc < docCount; ++iDoc) {   // Documents in order, so every posting list comes out ascending.
+        const SparseRow row     = sparse_row(compaction.Frequencies, iDoc);
+        double          norm    = 0;
+        for(uint32_t iTerm = 0; iTerm < row.Terms.size(); ++iTerm) {
+            const TermId term   = row.Terms[iTerm];
+            const double weight = row.Weights[iTerm] * idf_score(compaction.LiveCount, compaction.DocFrequencies[term]);
+            compaction.Postings[term].push_back({iDoc, row.Weights[iTerm]});
+            norm += weight * weight;
+        }
+        compaction.Norms[iDoc] = sqrt(norm);
+    }
+    return 0;
+}
+int32_t llai::apply_compaction    (IncrementalIndex & index, IndexCompaction & compaction) {
+    const uint32_t docCount         = sparse_rows(index.Frequencies);
+    const uint32_t snapshotDocCount = sparse_rows(compaction.Frequencies);
+    if(snapshotDocCount > docCount || compaction.Postings.size() > index.Postings.size() || compaction.RemovedPostings > index.RemovedPostings || compaction.Epoch > index.Epoch) {
+        log_error("Compaction of %u documents at epoch %llu doesn't belong to this index.", snapshotDocCount, (unsigned long long)compaction.Epoch);
+        return -1;
+    }
+    try {   // Rows and postings of the documents added since the snapshot are the tails of the index's own.
+        for(uint32_t iDoc = snapshotDocCount; iDoc < docCount; ++iDoc)
+            if(0 > append_row(compaction.Frequencies, sparse_row(index.Frequencies, iDoc)))
+                return -1;
+        compaction.Postings.resize(index.Postings.size());
+        for(TermId term = 0; term < index.Postings.size(); ++term) {
+            const vector<TermPosting> & postings    = index.Postings[term];
+            const auto                  added       = std::lower_bound(postings.begin(), postings.end(), snapshotDocCount, [](const TermPosting & posting, uint32_t doc) { return posting.Doc < doc; });
+            compaction.Postings[term].insert(compaction.Postings[term].end(), added, postings.end());
+        }
+    }
+    catch (const bad_alloc & e) {
+        log_error("exception message:'%s'", e.what());
+        return -1;
+    }
+    index.Frequencies       = std::move(compaction.Frequencies);
+    index.Postings          = std::move(compaction.Postings);
+    index.RemovedPostings   -= compaction.RemovedPostings;     // Documents removed since the snapshot are still in the postings.
+    if(compaction.Epoch == index.Epoch) {
+        index.CachedNorms   = std::move(compaction.Norms);
+        index.CachedEpoch   = index.Epoch;
+    }
+    log_incremental_debug("Compacted %u documents at epoch %llu, %u added since.", snapshotDocCount, (unsigned long long)compaction.Epoch, docCount - snapshotDocCount);
+    compaction = {};
+    return 0;
+}
+int32_t llai::compact_index     (IncrementalIndex & index) {
+    IndexCompaction compaction;
+    return (0 > snapshot_compaction(index, compaction) || 0 > build_compaction(compaction)) ? -1 : apply_compaction(index, compaction);
+}
+int32_t llai::query_top_k
+    ( const IncrementalIndex & index
+    , const string_view & query
+    , uint32_t k
+    , vector<ScoredDoc> & results
+    , double epsilon
+    ) {
+    results.clear();
+    vector<TokenRange>      query_token_ranges;
+    SparseVector            query_term_frequencies;
+    if(0 > tokenize(query, query_token_ranges) || 0 > term_frequency(query, query_token_ranges, index.Dictionary, query_term_frequencies))
+        return -1;
+    vector<Contribution>    contributions;
+    double                  queryNorm   = 0;
+    for(uint32_t iTerm = 0; iTerm < query_term_frequencies.Terms.size(); ++iTerm) {     // Term at a time, in query order.
+        const TermId term = query_term_frequencies.Terms[iTerm];
+        if(0 == index.DocFrequencies[term])
+            continue;   // Only in removed documents: the corpus no longer knows it.
+        const double idf    = term_idf(index, term);
+        const double weight = query_term_frequencies.Weights[iTerm] * idf;
+        queryNorm += weight * weight;
+        for(const TermPosting & posting : index.Postings[term])
+            if(index.Live[posting.Doc])
+                contributions.push_back({posting.Doc, weight * (posting.Frequency * idf)});
+    }
+    queryNorm = sqrt(queryNorm);
+    if(0 == queryNorm)
+        return 0;
+    stable_sort(contributions.begin(), contributions.end(), [](const Contribution & a, const Contribution & b) { return a.Doc < b.Doc; });
+    for(uint32_t iContribution = 0; iContribution < contributions.size(); ) {
+        const uint32_t  doc = contributions[iContribution].Doc;
+        double          dot = 0;
+        for(; iContribution < contributions.size() && contributions[iContribution].Doc == doc; ++iContribution)
+            dot += contributions[iContribution].Value;
+        const double    score = dot / (queryNorm * document_norm(index, doc) + epsilon);
+        if(score > 0)
+            push_top_k(results, k, {doc, score});
+    }
+    return sort_top_k(results);
+}
@@ -0,0 +1,64 @@
+#include "llai_index.h"
+
+#ifndef LLAI_INCREMENTAL_H
+#define LLAI_INCREMENTAL_H
+
+namespace llai
+{
+    struct TermPosting { uint32_t Doc; double Frequency; };
+
+    // Index that accepts documents one at a time. Only raw term frequencies and document frequencies are stored; IDF is applied at
+    // scoring time, so adding or removing a document touches just that document's terms. Document ids are never reused.
+    // The dictionary views point into the added text, which must outlive the index.
+    struct IncrementalIndex {
+        TermDictionary                      Dictionary;
+        SparseMatrix                        Frequencies;        // One term frequency row per document id. Removed rows are emptied by compaction.
+        std::vector<std::vector<TermPosting>>   Postings;       // Per term, ascending by document. May hold removed documents until compaction.
+        std::vector<uint32_t>               DocFrequencies;     // Per term, live documents only.
+        std::vector<uint8_t>                Live;
+        std::vector<double>                 CachedNorms;        // tf-idf norm of each document, valid while CachedEpoch == Epoch.
+        uint32_t                            LiveCount           = 0;
+        uint32_t                            RemovedPostings     = 0;
+        uint64_t                            Epoch               = 0;    // Incremented by every change to the document frequencies.
+        uint64_t                            CachedEpoch         = ~0ULL;
+    };
+
+    // Compacted copy of an index, built away from it so that queries and updates only wait while the index is copied and while
+    // the result is swapped in:
+    //   snapshot_compaction   copies the live rows and document frequencies. Reads the index, like a query.
+    //   build_compaction      rebuilds the postings and document norms from the copy. Doesn't touch the index, any thread.
+    //   apply_compaction      swaps them in, keeping the documents added or removed since the snapshot. Changes the index, like an update.
+    // The index has no lock of its own: whatever keeps updates from running alongside queries has to cover the first and last steps.
+    struct IndexCompaction {
+        SparseMatrix                        Frequencies;        // Rows of the snapshot, empty for removed documents.
+        std::vector<std::vector<TermPosting>>   Postings;
+        std::vector<uint32_t>               DocFrequencies;
+        std::vector<double>                 Norms;
+        uint32_t                            LiveCount           = 0;
+        uint32_t                            RemovedPostings     = 0;    // Dropped by this compaction.
+        uint64_t                            Epoch               = 0;    // Of the snapshot.
+    };
+
+    int32_t     add_document    (IncrementalIndex & index, const std::string_view & text);  // Returns the new document id.
+    int32_t     add_documents   (IncrementalIndex & index, const std::span<const std::string_view> & texts);    // Returns the id of the first document added.
+    int32_t     remove_document (IncrementalIndex & index, uint32_t doc);
+    int32_t     snapshot_compaction (const IncrementalIndex & index, IndexCompaction & compaction);
+    int32_t     build_compaction    (IndexCompaction & compaction);
+    // The cached norms are only refreshed when the index hasn't changed since the snapshot; otherwise they are computed per query
+    // until the next compaction. Fails, leaving the index as it was, if the compaction wasn't taken from this index.
+    int32_t     apply_compaction    (IncrementalIndex & index, IndexCompaction & compaction);
+    // Drops postings of removed documents and refreshes the cached document norms for the current IDF. Optional: queries are exact without it.
+    // The three steps above in a row.
+    int32_t     compact_index   (IncrementalIndex & index);
+    double      term_idf        (const IncrementalIndex & index, TermId term);
+    double      document_norm   (const IncrementalIndex & index, uint32_t doc);
+    int32_t     query_top_k
+        ( const IncrementalIndex & index
+        , const std::string_view & query
+        , uint32_t k
+        , std::vector<ScoredDoc> & results
+        , double epsilon = 1e-6
+        );
+} // namespace
+
+#endif // LLAI_INCREMENTAL_H
@@ -0,0 +1,172 @@
+#include "llai_index.h"
+#include "llai_log.h"
+#include "llai_metrics.h"
+
+#include <algorithm>
+#include <cmath>
+
+using std::bad_alloc;
+using std::span, std::string_view, std::vector;
+using std::size, std::sort, std::fabs, std::max, std::lower_bound, std::push_heap, std::pop_heap, std::sort_heap;
+
+#define log_index_debug(fmt, ...)	do {} while(0) // log_debug("|index|" fmt, __VA_ARGS__) //
+
+static  bool    is_better   (const llai::ScoredDoc & a, const llai::ScoredDoc & b) { return a.Score > b.Score || (a.Score == b.Score && a.Doc < b.Doc); }
+
+int32_t llai::build_index   (const SparseMatrix & weighted, uint32_t termCount, InvertedIndex & index) {
+    const uint32_t docCount = sparse_rows(weighted);
+    try {
+        index.Offsets   .assign(termCount + 1, 0);
+        index.Docs      .resize(weighted.Terms.size());
+        index.Weights   .resize(weighted.Terms.size());
+        index.MaxScores .assign(termCount, 0);
+        index.DocNorms  .resize(docCount);
+    }
+    catch (const bad_alloc & e) {
+        log_error("exception message:'%s'", e.what());
+        return -1;
+    }
+    for(const TermId term : weighted.Terms)     // Counting sort by term keeps each posting list sorted by document.
+        ++index.Offsets[term + 1];
+    for(uint32_t term = 0; term < termCount; ++term)
+        index.Offsets[term + 1] += index.Offsets[term];
+    vector<uint32_t>    cursors     (index.Offsets.begin(), index.Offsets.end() - 1);
+    for(uint32_t iDoc = 0; iDoc < docCount; ++iDoc) {
+        const SparseRow row     = sparse_row(weighted, iDoc);
+        const double    norm    = index.DocNorms[iDoc] = sparse_norm(row);
+        for(uint32_t iTerm = 0; iTerm < row.Terms.size(); ++iTerm) {
+            const TermId    term    = row.Terms[iTerm];
+            const uint32_t  posting = cursors[term]++;
+            index.Docs   [posting]  = iDoc;
+            index.Weights[posting]  = row.Weights[iTerm];
+            if(norm > 0)
+                index.MaxScores[term] = max(index.MaxScores[term], fabs(row.Weights[iTerm]) / norm);
+        }
+    }
+    log_index_debug("Indexed %u documents, %u terms, %u postings.", docCount, termCount, (uint32_t)index.Docs.size());
+    return (int32_t)index.Docs.size();
+}
+llai::InvertedIndexView llai::index_view(const InvertedIndex & index) { return {index.Offsets, index.Docs, index.Weights, index.MaxScores, index.DocNorms}; }
+int32_t llai::push_top_k    (vector<ScoredDoc> & heap, uint32_t k, const ScoredDoc & scored) {
+    if(0 == k)
+        return 0;
+    if(heap.size() < k) {
+        heap.push_back(scored);
+        push_heap(heap.begin(), heap.end(), is_better);
+    }
+    else if(is_better(scored, heap.front())) {
+        pop_heap(heap.begin(), heap.end(), is_better);
+        heap.back() = scored;
+        push_heap(heap.begin(), heap.end(), is_better);
+    }
+    return (int32_t)heap.size();
+}
+int32_t llai::sort_top_k    (vector<ScoredDoc> & heap) {
+    sort_heap(heap.begin(), heap.end(), is_better);
+    return (int32_t)heap.size();
+}
+
+namespace
+{
+    struct PostingCursor {
+        const uint32_t  * Docs;
+        const double    * Weights;
+        uint32_t        Count;
+        uint32_t        Position;
+        uint32_t        Order;          // Position of the term in the query. Contributions are summed in this order.
+        double          QueryWeight;
+        double          Bound;
+    };
+} // namespace
+
+// MaxScore: cursors are sorted by ascending bound, and the leading ones whose bounds add up to no more than the current threshold are
+// non-essential. Only documents found in the essential lists are candidates; non-essential lists are probed with a binary search.
+int32_t llai::query_top_k
+    ( const InvertedIndexView & index
+    , const SparseRow & query
+    , uint32_t k
+    , vector<ScoredDoc> & results
+    , double epsilon
+    ) {
+    metrics_time(queryTimer, METRIC_STAGE_QUERY);
+    metrics_count(METRIC_COUNTER_QUERIES, 1);
+    results.clear();
+    const double            queryNorm   = sparse_norm(query);
+    if(0 == k || 0 == queryNorm)
+        return 0;
+    const uint32_t          termCount   = (uint32_t)index.MaxScores.size();
+    vector<PostingCursor>   cursors;
+    for(uint32_t iTerm = 0; iTerm < query.Terms.size(); ++iTerm) {
+        const TermId    term    = query.Terms[iTerm];
+        const double    weight  = query.Weights[iTerm];
+        if(term >= termCount || 0 == weight || index.Offsets[term] == index.Offsets[term + 1])
+            continue;
+        const uint32_t  offset  = index.Offsets[term];
+        cursors.push_back({&index.Docs[offset], &index.Weights[offset], index.Offsets[term + 1] - offset, 0, iTerm, weight, fabs(weight) * index.MaxScores[term] / queryNorm});
+    }
+    sort(cursors.begin(), cursors.end(), [](const PostingCursor & a, const PostingCursor & b) { return a.Bound < b.Bound; });
+    vector<double>          upperBounds (cursors.size());
+    for(uint32_t iCursor = 0; iCursor < cursors.size(); ++iCursor)
+        upperBounds[iCursor] = cursors[iCursor].Bound + (iCursor ? upperBounds[iCursor - 1] : 0);
+
+    vector<double>          contributions(query.Terms.size(), 0.0);
+    double                  threshold       = 0;
+    uint32_t                firstEssential  = 0;
+    while(firstEssential < cursors.size()) {
+        uint32_t doc = UINT32_MAX;
+        for(uint32_t iCursor = firstEssential; iCursor < cursors.size(); ++iCursor) {
+            const PostingCursor & cursor = cursors[iCursor];
+            if(cursor.Position < cursor.Count)
+                doc = std::min(doc, cursor.Docs[cursor.Position]);
+        }
+        if(UINT32_MAX == doc)
+            break;
+        const double    denominator = queryNorm * index.DocNorms[doc] + epsilon;
+        double          partial     = 0;
+        for(uint32_t iCursor = firstEssential; iCursor < cursors.size(); ++iCursor) {
+            PostingCursor & cursor = cursors[iCursor];
+            if(cursor.Position < cursor.Count && cursor.Docs[cursor.Position] == doc) {
+                partial += contributions[cursor.Order] = cursor.QueryWeight * cursor.Weights[cursor.Position] / denominator;
+                ++cursor.Position;
+            }
+        }
+        bool            pruned      = false;
+        for(uint32_t iCursor = firstEssential; iCursor-- > 0; ) {
+            if(partial + upperBounds[iCursor] <= threshold) {
+                pruned = true;
+                break;
+            }
+            PostingCursor & cursor = cursors[iCursor];
+            cursor.Position = uint32_t(lower_bound(cursor.Docs + cursor.Position, cursor.Docs + cursor.Count, doc) - cursor.Docs);
+            if(cursor.Position < cursor.Count && cursor.Docs[cursor.Position] == doc)
+                partial += contributions[cursor.Order] = cursor.QueryWeight * cursor.Weights[cursor.Position] / denominator;
+        }
+        if(not pruned) {
+            double score = 0;
+            for(const double contribution : contributions)
+                score += contribution;
+            if(score > threshold && k == (uint32_t)push_top_k(results, k, {doc, score})) {
+                threshold = results.front().Score;
+                while(firstEssential < cursors.size() && upperBounds[firstEssential] <= threshold)
+                    ++firstEssential;
+            }
+        }
+        std::fill(contributions.begin(), contributions.end(), 0.0);
+    }
+    return sort_top_k(results);
+}
+int32_t llai::query_top_k
+    ( const InvertedIndex & index
+    , const SparseRow & query
+    , uint32_t k
+    , vector<ScoredDoc> & results
+    , double epsilon
+    ) {
+    return query_top_k(index_view(index), query, k, results, epsilon);
+}
+int32_t llai::load_docs     (const span<const string_view> & docs, TermDictionary & dictionary, vector<double> & idf_scores, SparseMatrix & weighted, InvertedIndex & index) {
+    const int32_t result = load_docs(docs, dictionary, idf_scores, weighted);
+    if(0 > result)
+        return result;
+    return (0 > build_index(weighted, (uint32_t)dictionary.Terms.size(), index)) ? -1 : 0;
+}
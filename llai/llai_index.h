@@ -0,0 +1,51 @@
+#include "llai_sparse.h"
+
+#ifndef LLAI_INDEX_H
+#define LLAI_INDEX_H
+
+namespace llai
+{
+    struct ScoredDoc { uint32_t Doc; double Score; };
+
+    // Term-major transpose of the weighted document matrix. The postings of term t span [Offsets[t], Offsets[t + 1]) and are sorted by document.
+    struct InvertedIndex {
+        std::vector<uint32_t>       Offsets     = {0};
+        std::vector<uint32_t>       Docs;
+        std::vector<double>         Weights;
+        std::vector<double>         MaxScores;  // Per term: max(|weight| / document norm) over its postings. Upper bound used for early termination.
+        std::vector<double>         DocNorms;
+    };
+
+    struct InvertedIndexView {
+        std::span<const uint32_t>   Offsets;
+        std::span<const uint32_t>   Docs;
+        std::span<const double>     Weights;
+        std::span<const double>     MaxScores;
+        std::span<const double>     DocNorms;
+    };
+
+    int32_t     build_index     (const SparseMatrix & weighted, uint32_t termCount, InvertedIndex & index);
+    InvertedIndexView   index_view  (const InvertedIndex & index);
+    // Keeps the k best results in a min-heap ordered by score, then by lowest document. Returns the heap size.
+    int32_t     push_top_k      (std::vector<ScoredDoc> & heap, uint32_t k, const ScoredDoc & scored);
+    int32_t     sort_top_k      (std::vector<ScoredDoc> & heap);   // Turns a heap from push_top_k into a best-first list.
+    // Exact top-k cosine similarity between the weighted query and the indexed documents. Only documents scoring above 0 are returned.
+    int32_t     query_top_k
+        ( const InvertedIndexView & index
+        , const SparseRow & query
+        , uint32_t k
+        , std::vector<ScoredDoc> & results
+        , double epsilon = 1e-6
+        );
+    int32_t     query_top_k
+        ( const InvertedIndex & index
+        , const SparseRow & query
+        , uint32_t k
+        , std::vector<ScoredDoc> & results
+        , double epsilon = 1e-6
+        );
+
+    int32_t     load_docs       (const std::span<const std::string_view> & documents, TermDictionary & dictionary, std::vector<double> & idf_scores, SparseMatrix & weighted, InvertedIndex & index);
+} // namespace
+
+#endif // LLAI_INDEX_H
@@ -0,0 +1,197 @@
+#include "llai_join.h"
+#include "llai_parallel.h"
+#include "llai_log.h"
+
+#include <algorithm>
+#include <cmath>
+#include <mutex>
+
+using std::bad_alloc;
+using std::span, std::vector, std::mutex, std::lock_guard;
+using std::min, std::max, std::sort, std::lower_bound, std::fabs, std::sqrt;
+
+#define log_join_debug(fmt, ...)	do {} while(0) // log_debug("|join|" fmt, __VA_ARGS__) //
+
+static  constexpr uint32_t  JOIN_CHUNK_SIZE     = 64;
+static  constexpr double    BOUND_SLACK         = 1e-9;     // Bounds are compared against a slightly lower threshold to absorb rounding.
+
+namespace
+{
+    struct JoinScratch {
+        vector<double>              Scores;     // Per document: dot product of the normalized probe with the indexed part of the document
+        vector<uint8_t>             Touched;
+        vector<uint32_t>            Candidates;
+        vector<llai::SimilarPair>   Pairs;
+    };
+} // namespace
+
+static  int32_t flush_pairs     (vector<llai::SimilarPair> & pairs, const llai::PairCallback & callback, mutex & callbackMutex) {
+    if(pairs.empty())
+        return 0;
+    lock_guard<mutex>   lock    (callbackMutex);
+    const int32_t       result  = callback(pairs);
+    pairs.clear();
+    return result;
+}
+
+// AllPairs over normalized vectors. Terms of each row are visited from the most to the least frequent in the corpus, adding up how much
+// each could contribute to a cosine with any other row: max over the corpus of its normalized |weight|, times its own. The terms seen
+// before that sum reaches the threshold form the prefix, and only the rest is indexed. Two rows scoring at least the threshold must
+// share an indexed term of the earlier one, since its prefix alone stays below it. Each row then probes the index for earlier rows.
+int32_t llai::similarity_join
+    ( const SparseMatrixView & weighted
+    , double threshold
+    , const PairCallback & callback
+    , uint32_t threadCount
+    , uint32_t batchSize
+    , double epsilon
+    ) {
+    if(threshold <= 0) {
+        log_error("Invalid similarity threshold: %f.", threshold);
+        return -1;
+    }
+    threadCount = thread_count(threadCount);
+    const uint32_t          docCount        = sparse_rows(weighted);
+    const double            boundThreshold  = threshold * (1 - BOUND_SLACK);
+    uint32_t                termCount       = 0;
+    for(const TermId term : weighted.Terms)
+        termCount = max(termCount, term + 1);
+    vector<double>          norms;
+    vector<double>          maxWeights;     // Per document: max normalized |weight|
+    vector<double>          sums;           // Per document: sum of normalized |weight|
+    vector<double>          prefixBounds;   // Per document: bound on what its unindexed terms can add to a cosine
+    vector<uint32_t>        firstIndexed;   // Per document: its first indexed term in frequency order, UINT32_MAX if none
+    vector<uint32_t>        frequencies;
+    vector<double>          termMaxWeights; // Per term: max normalized |weight| over the corpus
+    vector<uint32_t>        offsets;
+    vector<uint32_t>        postingDocs;
+    vector<double>          postingWeights;
+    vector<JoinScratch>     scratch;
+    vector<uint32_t>        order;
+    try {
+        norms           .resize(docCount);
+        maxWeights      .assign(docCount, 0);
+        sums            .assign(docCount, 0);
+        prefixBounds    .resize(docCount);
+        firstIndexed    .resize(docCount);
+        frequencies     .assign(termCount, 0);
+        termMaxWeights  .assign(termCount, 0);
+        offsets         .assign(termCount + 1, 0);
+        scratch         .resize(threadCount);
+    }
+    catch (const bad_alloc & e) {
+        log_error("exception message:'%s'", e.what());
+        return -1;
+    }
+    for(uint32_t iDoc = 0; iDoc < docCount; ++iDoc) {
+        const SparseRow row     = sparse_row(weighted, iDoc);
+        const double    norm    = norms[iDoc] = sparse_norm(row);
+        for(uint32_t iTerm = 0; iTerm < row.Terms.size(); ++iTerm) {
+            const double normalized = norm ? fabs(row.Weights[iTerm]) / norm : 0;
+            ++frequencies[row.Terms[iTerm]];
+            termMaxWeights[row.Terms[iTerm]] = max(termMaxWeights[row.Terms[iTerm]], normalized);
+            maxWeights[iDoc] = max(maxWeights[iDoc], normalized);
+            sums[iDoc] += normalized;
+        }
+    }
+    auto                    by_frequency    = [&](uint32_t a, uint32_t b) { return frequencies[a] > frequencies[b] || (frequencies[a] == frequencies[b] && a < b); };
+    auto                    split_prefix    = [&](const SparseRow & row, uint32_t iDoc) {
+        order.assign(row.Terms.begin(), row.Terms.end());
+        sort(order.begin(), order.end(), by_frequency);
+        double bound = 0, prefixNorm = 0;
+        uint32_t iOrdered = 0;
+        for(; iOrdered < order.size(); ++iOrdered) {
+            const uint32_t  iTerm       = uint32_t(lower_bound(row.Terms.begin(), row.Terms.end(), order[iOrdered]) - row.Terms.begin());
+            const double    normalized  = norms[iDoc] ? fabs(row.Weights[iTerm]) / norms[iDoc] : 0;
+            if(bound + termMaxWeights[order[iOrdered]] * normalized >= boundThreshold)
+                break;
+            bound       += termMaxWeights[order[iOrdered]] * normalized;
+            prefixNorm  += normalized * normalized;
+        }
+        prefixBounds[iDoc] = min(bound, sqrt(prefixNorm));  // Cauchy-Schwarz against a unit vector bounds it too.
+        firstIndexed[iDoc] = iOrdered < order.size() ? order[iOrdered] : UINT32_MAX;
+    };
+    // The frequency order is total, so the indexed terms are the first indexed one and those after it.
+    auto                    is_indexed      = [&](TermId term, uint32_t iDoc) { return UINT32_MAX != firstIndexed[iDoc] && not by_frequency(term, firstIndexed[iDoc]); };
+    try {
+        for(uint32_t iDoc = 0; iDoc < docCount; ++iDoc) {   // Split each row once and count the indexed postings of each term
+            const SparseRow row = sparse_row(weighted, iDoc);
+            split_prefix(row, iDoc);
+            for(const TermId term : row.Terms)
+                if(is_indexed(term, iDoc))
+                    ++offsets[term + 1];
+        }
+        for(uint32_t term = 0; term < termCount; ++term)
+            offsets[term + 1] += offsets[term];
+        postingDocs     .resize(offsets[termCount]);
+        postingWeights  .resize(offsets[termCount]);
+    }
+    catch (const bad_alloc & e) {
+        log_error("exception message:'%s'", e.what());
+        return -1;
+    }
+    vector<uint32_t>        cursors         (offsets.begin(), offsets.end() - 1);
+    for(uint32_t iDoc = 0; iDoc < docCount; ++iDoc) {   // Documents are added in order, so each posting list is sorted by document.
+        const SparseRow row = sparse_row(weighted, iDoc);
+        for(uint32_t iTerm = 0; iTerm < row.Terms.size(); ++iTerm) {
+            if(not is_indexed(row.Terms[iTerm], iDoc))
+                continue;
+            const uint32_t  posting = cursors[row.Terms[iTerm]]++;
+            postingDocs     [posting] = iDoc;
+            postingWeights  [posting] = row.Weights[iTerm] / norms[iDoc];
+        }
+    }
+    log_join_debug("Indexed %u of %u entries for %u documents.", offsets[termCount], (uint32_t)weighted.Terms.size(), docCount);
+
+    mutex                   callbackMutex;
+    int32_t result = parallel_for(docCount, threadCount, JOIN_CHUNK_SIZE, [&](uint32_t begin, uint32_t end, uint32_t iThread) {
+        JoinScratch & local = scratch[iThread];     // Dense over the documents: see the memory note in llai_join.h.
+        local.Scores    .resize(docCount, 0.0);
+        local.Touched   .resize(docCount, 0);
+        for(uint32_t iDoc = begin; iDoc < end; ++iDoc) {
+            const SparseRow row = sparse_row(weighted, iDoc);
+            if(0 == norms[iDoc])
+                continue;
+            for(uint32_t iTerm = 0; iTerm < row.Terms.size(); ++iTerm) {
+                const double    normalized  = row.Weights[iTerm] / norms[iDoc];
+                const TermId    term        = row.Terms[iTerm];
+                for(uint32_t posting = offsets[term]; posting < offsets[term + 1] && postingDocs[posting] < iDoc; ++posting) {
+                    const uint32_t other = postingDocs[posting];
+                    local.Scores[other] += normalized * postingWeights[posting];
+                    if(not local.Touched[other]) {
+                        local.Touched[other] = 1;
+                        local.Candidates.push_back(other);
+                    }
+                }
+            }
+            for(const uint32_t other : local.Candidates) {
+                const double upperBound = min(local.Scores[other] + prefixBounds[other], min(maxWeights[iDoc] * sums[other], maxWeights[other] * sums[iDoc]));
+                local.Scores [other] = 0;
+                local.Touched[other] = 0;
+                if(upperBound < boundThreshold)
+                    continue;
+                const double score = cosine_similarity(sparse_row(weighted, other), row, epsilon);
+                if(score >= threshold)
+                    local.Pairs.push_back({other, iDoc, score});
+            }
+            local.Candidates.clear();
+            if(local.Pairs.size() >= batchSize && 0 > flush_pairs(local.Pairs, callback, callbackMutex))
+                return -1;
+        }
+        return 0;
+    });
+    for(JoinScratch & local : scratch)
+        if(0 == result && 0 > flush_pairs(local.Pairs, callback, callbackMutex))
+            result = -1;
+    return result;
+}
+int32_t llai::similarity_join
+    ( const SparseMatrix & weighted
+    , double threshold
+    , const PairCallback & callback
+    , uint32_t threadCount
+    , uint32_t batchSize
+    , double epsilon
+    ) {
+    return similarity_join(matrix_view(weighted), threshold, callback, threadCount, batchSize, epsilon);
+}
@@ -0,0 +1,40 @@
+#include "llai_sparse.h"
+
+#include <functional>
+
+#ifndef LLAI_JOIN_H
+#define LLAI_JOIN_H
+
+namespace llai
+{
+    struct SimilarPair { uint32_t DocA, DocB; double Score; };   // DocA < DocB
+
+    // Receives the pairs found so far, one batch at a time and never from two threads at once. A negative return stops the join.
+    typedef std::function<int32_t(std::span<const SimilarPair> pairs)>  PairCallback;
+
+    // Emits every pair of rows whose cosine_similarity is at least threshold, which must be above 0, with the score cosine_similarity
+    // returns for it. Rows are indexed by their rarest terms only, and only as many as it takes for the rest to be unable to reach the
+    // threshold on their own, so pairs sharing no indexed term are never looked at. Candidates are then bounded again before being
+    // verified exactly. Rows are probed on threadCount threads, each one handing its pairs to the callback once it has collected
+    // batchSize of them, so memory does not grow with the output. Pairs come in no particular order.
+    // Besides the index of the suffixes, each thread accumulates scores in a dense array of 9 bytes per row (a double and a flag),
+    // so the join takes threadCount * rows * 9 bytes of scratch: 720 MB for 10 million rows on 8 threads. Pass fewer threads to bound it.
+    int32_t     similarity_join
+        ( const SparseMatrixView & weighted
+        , double threshold
+        , const PairCallback & callback
+        , uint32_t threadCount
+        , uint32_t batchSize = 4096
+        , double epsilon = 1e-6
+        );
+    int32_t     similarity_join
+        ( const SparseMatrix & weighted
+        , double threshold
+        , const PairCallback & callback
+        , uint32_t threadCount
+        , uint32_t batchSize = 4096
+        , double epsilon = 1e-6
+        );
+} // namespace
+
+#endif // LLAI_JOIN_H
@@ -3,9 +3,41 @@
 #ifndef LLAI_LOG_H
 #define LLAI_LOG_H
 
+#define LLAI_LOG_LEVEL_TRACE    0
+#define LLAI_LOG_LEVEL_DEBUG    1
+#define LLAI_LOG_LEVEL_INFO     2
+#define LLAI_LOG_LEVEL_ERROR    3
+#define LLAI_LOG_LEVEL_NONE     4
+
+// Messages below this level are compiled out, arguments included. Define it before including this header or on the command line.
+#ifndef LLAI_LOG_LEVEL
+#   define LLAI_LOG_LEVEL       LLAI_LOG_LEVEL_DEBUG
+#endif
+
 #define log_func(prefix, fmt, ...)  fprintf(stderr, prefix ":[%s(%u)]:" fmt "\n", __FILE__, __LINE__, __VA_ARGS__)
-#define log_debug(fmt, ...)			log_func("debug", fmt, __VA_ARGS__)
-#define log_error(fmt, ...)			log_func("error", fmt, __VA_ARGS__)
+// Still type-checks the arguments, but sizeof does not evaluate them and no code is emitted.
+#define log_none(fmt, ...)          do { (void)sizeof(fprintf(stderr, fmt, __VA_ARGS__)); } while(0)
+
+#if LLAI_LOG_LEVEL <= LLAI_LOG_LEVEL_TRACE
+#   define log_trace(fmt, ...)		log_func("trace", fmt, __VA_ARGS__)
+#else
+#   define log_trace(fmt, ...)		log_none(fmt, __VA_ARGS__)
+#endif
+#if LLAI_LOG_LEVEL <= LLAI_LOG_LEVEL_DEBUG
+#   define log_debug(fmt, ...)		log_func("debug", fmt, __VA_ARGS__)
+#else
+#   define log_debug(fmt, ...)		log_none(fmt, __VA_ARGS__)
+#endif
+#if LLAI_LOG_LEVEL <= LLAI_LOG_LEVEL_INFO
+#   define log_info(fmt, ...)		log_func("info", fmt, __VA_ARGS__)
+#else
+#   define log_info(fmt, ...)		log_none(fmt, __VA_ARGS__)
+#endif
+#if LLAI_LOG_LEVEL <= LLAI_LOG_LEVEL_ERROR
+#   define log_error(fmt, ...)		log_func("error", fmt, __VA_ARGS__)
+#else
+#   define log_error(fmt, ...)		log_none(fmt, __VA_ARGS__)
+#endif
 
 namespace llai
 {
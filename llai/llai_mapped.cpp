@@ -0,0 +1,320 @@
+#include "llai_mapped.h"
+#include "llai_log.h"
+
+#include <bit>
+#include <cstdio>
+#include <cstring>
+#include <string>
+
+#ifdef _WIN32
+#   define WIN32_LEAN_AND_MEAN
+#   define NOMINMAX
+#   include <windows.h>
+#else
+#   include <fcntl.h>
+#   include <sys/mman.h>
+#   include <sys/stat.h>
+#   include <unistd.h>
+#endif
+
+using std::bad_alloc;
+using std::span, std::string_view, std::vector;
+using std::memcpy, std::bit_ceil, std::remove, std::rename;
+
+#define log_mapped_debug(fmt, ...)	do {} while(0) // log_debug("|mapped|" fmt, __VA_ARGS__) //
+
+static  constexpr uint64_t  FNV_OFFSET  = 0xcbf29ce484222325ULL;
+static  constexpr uint64_t  FNV_PRIME   = 0x100000001b3ULL;
+
+static  uint64_t    hash_term   (const string_view & term) {
+    uint64_t hash = FNV_OFFSET;
+    for(const char c : term)
+        hash = (hash ^ (uint8_t)c) * FNV_PRIME;
+    return hash;
+}
+// FNV-1a over 8-byte words. The last word is zero-padded, matching the padding written after every section.
+static  uint64_t    checksum    (uint64_t hash, const void * data, uint64_t size) {
+    const char * bytes = (const char *)data;
+    uint64_t word;
+    for(; size >= 8; bytes += 8, size -= 8) {
+        memcpy(&word, bytes, 8);
+        hash = (hash ^ word) * FNV_PRIME;
+    }
+    if(size) {
+        word = 0;
+        memcpy(&word, bytes, size);
+        hash = (hash ^ word) * FNV_PRIME;
+    }
+    return hash;
+}
+// Continues the checksum of the sections over the header, with the checksum field taken as 0.
+static  uint64_t    header_checksum (uint64_t hash, llai::IndexFileHeader header) {
+    header.Checksum = 0;
+    return checksum(hash, &header, sizeof(header));
+}
+static  uint64_t    align_section   (uint64_t offset) { return (offset + 7) & ~7ULL; }
+template<typename _t>
+static  span<const _t>  section_view    (const char * base, const llai::IndexSection & section) { return {(const _t *)(base + section.Offset), size_t(section.Size / sizeof(_t))}; }
+template<typename _t>
+static  bool        valid_offsets   (const span<const _t> & offsets, uint64_t total) {   // Starts at 0, never decreases and ends at total.
+    for(size_t i = 1; i < offsets.size(); ++i)
+        if(offsets[i] < offsets[i - 1])
+            return false;
+    return offsets.size() && 0 == offsets.front() && total == offsets.back();
+}
+
+namespace
+{
+    struct SectionData { const void * Data; uint64_t Size; };
+} // namespace
+
+int32_t llai::save_index        (const char * path, const TermDictionary & dictionary, const span<const double> & idf_scores, const SparseMatrix & weighted, const InvertedIndex & index) {
+    const uint32_t      termCount   = (uint32_t)dictionary.Terms.size();
+    vector<uint64_t>    termOffsets (termCount + 1, 0);
+    vector<char>        termBytes;
+    vector<uint32_t>    termHash    (bit_ceil(termCount * 2ULL + 2), UINT32_MAX);
+    for(uint32_t term = 0; term < termCount; ++term) {
+        const string_view & text = dictionary.Terms[term];
+        termBytes.insert(termBytes.end(), text.begin(), text.end());
+        termOffsets[term + 1] = termBytes.size();
+        uint64_t slot = hash_term(text) & (termHash.size() - 1);
+        while(termHash[slot] != UINT32_MAX)
+            slot = (slot + 1) & (termHash.size() - 1);
+        termHash[slot] = term;
+    }
+    const SectionData   sections[INDEX_SECTION_COUNT] =
+        { {termOffsets          .data(), termOffsets          .size() * sizeof(uint64_t)}
+        , {termBytes            .data(), termBytes            .size()}
+        , {termHash             .data(), termHash             .size() * sizeof(uint32_t)}
+        , {idf_scores           .data(), idf_scores           .size() * sizeof(double)}
+        , {weighted.Offsets     .data(), weighted.Offsets     .size() * sizeof(uint32_t)}
+        , {weighted.Terms       .data(), weighted.Terms       .size() * sizeof(TermId)}
+        , {weighted.Weights     .data(), weighted.Weights     .size() * sizeof(double)}
+        , {index.DocNorms       .data(), index.DocNorms       .size() * sizeof(double)}
+        , {index.Offsets        .data(), index.Offsets        .size() * sizeof(uint32_t)}
+        , {index.Docs           .data(), index.Docs           .size() * sizeof(uint32_t)}
+        , {index.Weights        .data(), index.Weights        .size() * sizeof(double)}
+        , {index.MaxScores      .data(), index.MaxScores      .size() * sizeof(double)}
+        };
+    IndexFileHeader     header      = {};
+    uint64_t            offset      = align_section(sizeof(IndexFileHeader));
+    header.Magic        = INDEX_FILE_MAGIC;
+    header.Version      = INDEX_FILE_VERSION;
+    header.TermCount    = termCount;
+    header.DocCount     = sparse_rows(weighted);
+    header.EntryCount   = weighted.Terms.size();
+    uint64_t            hash        = FNV_OFFSET;
+    for(uint32_t iSection = 0; iSection < INDEX_SECTION_COUNT; ++iSection) {
+        header.Sections[iSection]   = {offset, sections[iSection].Size};
+        hash                        = checksum(hash, sections[iSection].Data, sections[iSection].Size);
+        offset                      = align_section(offset + sections[iSection].Size);
+    }
+    header.FileSize = offset;
+    header.Checksum = header_checksum(hash, header);
+
+    // Written next to the file and renamed over it, so that whoever has the old file mapped keeps reading the old contents.
+    const std::string   tempPath    = std::string(path) + ".tmp";
+    FILE * file = 0;
+#ifdef _WIN32
+    fopen_s(&file, tempPath.c_str(), "wb");
+#else
+    file = fopen(tempPath.c_str(), "wb");
+#endif
+    if(0 == file) {
+        log_error("Failed to create index file '%s'.", tempPath.c_str());
+        return -1;
+    }
+    static const char   padding [8] = {};
+    const uint64_t      headerPad   = header.Sections[0].Offset - sizeof(header);
+    bool                written     = 1 == fwrite(&header, sizeof(header), 1, file) && (0 == headerPad || 1 == fwrite(padding, headerPad, 1, file));
+    for(uint32_t iSection = 0; written && iSection < INDEX_SECTION_COUNT; ++iSection) {
+        const uint64_t size = sections[iSection].Size;
+        written = (0 == size || 1 == fwrite(sections[iSection].Data, size, 1, file))
+            && (0 == align_section(size) - size || 1 == fwrite(padding, align_section(size) - size, 1, file));
+    }
+    written = (0 == fclose(file)) && written;
+    if(not written) {
+        log_error("Failed to write index file '%s'.", tempPath.c_str());
+        remove(tempPath.c_str());
+        return -1;
+    }
+#ifdef _WIN32
+    const bool          renamed     = MoveFileExA(tempPath.c_str(), path, MOVEFILE_REPLACE_EXISTING);
+#else
+    const bool          renamed     = 0 == rename(tempPath.c_str(), path);
+#endif
+    if(not renamed) {
+        log_error("Failed to replace index file '%s'.", path);
+        remove(tempPath.c_str());
+        return -1;
+    }
+    log_mapped_debug("Saved index '%s': %u terms, %u documents, %llu bytes.", path, termCount, header.DocCount, (unsigned long long)header.FileSize);
+    return 0;
+}
+int32_t llai::close_index       (MappedIndex & mapped) {
+    if(mapped.Header) {
+#ifdef _WIN32
+        UnmapViewOfFile(mapped.Header);
+#else
+        munmap((void *)mapped.Header, mapped.Size);
+#endif
+    }
+#ifdef _WIN32
+    if(mapped.Mapping)
+        CloseHandle((HANDLE)mapped.Mapping);
+    if(mapped.File != -1)
+        CloseHandle((HANDLE)mapped.File);
+#endif
+    mapped = {};
+    return 0;
+}
+int32_t llai::open_index        (const char * path, MappedIndex & mapped, bool verify) {
+    close_index(mapped);
+#ifdef _WIN32
+    const HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_DELETE, 0, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, 0);
+    LARGE_INTEGER size = {};
+    if(INVALID_HANDLE_VALUE == file || not GetFileSizeEx(file, &size)) {
+        log_error("Failed to open index file '%s'.", path);
+        if(INVALID_HANDLE_VALUE != file)
+            CloseHandle(file);
+        return -1;
+    }
+    mapped.File = (intptr_t)file;
+    mapped.Size = (uint64_t)size.QuadPart;
+    if(mapped.Size < sizeof(IndexFileHeader)) {
+        log_error("Index file '%s' is too small.", path);
+        close_index(mapped);
+        return -1;
+    }
+    const HANDLE mapping = CreateFileMappingA(file, 0, PAGE_READONLY, 0, 0, 0);
+    mapped.Mapping = (intptr_t)mapping;
+    mapped.Header  = mapping ? (const IndexFileHeader *)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0) : 0;
+#else
+    const int file = open(path, O_RDONLY);
+    struct stat status = {};
+    if(0 > file || 0 > fstat(file, &status)) {
+        log_error("Failed to open index file '%s'.", path);
+        if(0 <= file)
+            close(file);
+        return -1;
+    }
+    mapped.Size = (uint64_t)status.st_size;
+    if(mapped.Size < sizeof(IndexFileHeader)) {
+        log_error("Index file '%s' is too small.", path);
+        close(file);
+        return -1;
+    }
+    void * view = mmap(0, mapped.Size, PROT_READ, MAP_SHARED, file, 0);
+    close(file);    // The mapping keeps the file alive.
+    mapped.Header = (MAP_FAILED == view) ? 0 : (const IndexFileHeader *)view;
+#endif
+    if(0 == mapped.Header) {
+        log_error("Failed to map index file '%s'.", path);
+        close_index(mapped);
+        return -1;
+    }
+    const IndexFileHeader & header  = *mapped.Header;
+    const char            * base    = (const char *)mapped.Header;
+    if(header.Magic != INDEX_FILE_MAGIC || header.Version != INDEX_FILE_VERSION || header.FileSize != mapped.Size) {
+        log_error("'%s' is not a version %u index file.", path, INDEX_FILE_VERSION);
+        close_index(mapped);
+        return -1;
+    }
+    const uint64_t  expected[INDEX_SECTION_COUNT]   =   // Element count and size of each section
+        { (header.TermCount + 1ULL) * sizeof(uint64_t), 0, 0, header.TermCount * sizeof(double)
+        , (header.DocCount  + 1ULL) * sizeof(uint32_t), header.EntryCount * sizeof(TermId), header.EntryCount * sizeof(double), header.DocCount * sizeof(double)
+        , (header.TermCount + 1ULL) * sizeof(uint32_t), header.EntryCount * sizeof(uint32_t), header.EntryCount * sizeof(double), header.TermCount * sizeof(double)
+        };
+    for(uint32_t iSection = 0; iSection < INDEX_SECTION_COUNT; ++iSection) {
+        const IndexSection & section = header.Sections[iSection];
+        const bool sized = (INDEX_SECTION_TERM_BYTES == iSection) || (INDEX_SECTION_TERM_HASH == iSection ? std::has_single_bit(section.Size / sizeof(uint32_t)) : section.Size == expected[iSection]);
+        if(section.Offset % 8 || section.Offset < sizeof(IndexFileHeader) || section.Offset > mapped.Size || section.Size > mapped.Size - section.Offset || not sized) {
+            log_error("Index file '%s' has an invalid section %u.", path, iSection);
+            close_index(mapped);
+            return -1;
+        }
+    }
+    if(verify) {
+        const uint64_t start = header.Sections[0].Offset;
+        if(header.Checksum != header_checksum(checksum(FNV_OFFSET, base + start, mapped.Size - start), header)) {
+            log_error("Index file '%s' is corrupt: checksum mismatch.", path);
+            close_index(mapped);
+            return -1;
+        }
+    }
+    mapped.TermOffsets          = section_view<uint64_t >(base, header.Sections[INDEX_SECTION_TERM_OFFSETS   ]);
+    mapped.TermBytes            = section_view<char     >(base, header.Sections[INDEX_SECTION_TERM_BYTES     ]);
+    mapped.TermHash             = section_view<uint32_t >(base, header.Sections[INDEX_SECTION_TERM_HASH      ]);
+    mapped.Idf                  = section_view<double   >(base, header.Sections[INDEX_SECTION_IDF            ]);
+    mapped.Documents.Offsets    = section_view<uint32_t >(base, header.Sections[INDEX_SECTION_DOC_OFFSETS    ]);
+    mapped.Documents.Terms      = section_view<TermId   >(base, header.Sections[INDEX_SECTION_DOC_TERMS      ]);
+    mapped.Documents.Weights    = section_view<double   >(base, header.Sections[INDEX_SECTION_DOC_WEIGHTS    ]);
+    mapped.Index.DocNorms       = section_view<double   >(base, header.Sections[INDEX_SECTION_DOC_NORMS      ]);
+    mapped.Index.Offsets        = section_view<uint32_t >(base, header.Sections[INDEX_SECTION_POSTING_OFFSETS]);
+    mapped.Index.Docs           = section_view<uint32_t >(base, header.Sections[INDEX_SECTION_POSTING_DOCS   ]);
+    mapped.Index.Weights        = section_view<double   >(base, header.Sections[INDEX_SECTION_POSTING_WEIGHTS]);
+    mapped.Index.MaxScores      = section_view<double   >(base, header.Sections[INDEX_SECTION_MAX_SCORES     ]);
+    // Checked on every open because mapped_term, find_term and query_top_k index with them. Linear in terms and documents only.
+    bool            emptySlot   = false;
+    bool            validIds    = true;
+    for(const uint32_t id : mapped.TermHash) {
+        emptySlot   = emptySlot || UINT32_MAX == id;
+        validIds    = validIds && (UINT32_MAX == id || id < header.TermCount);
+    }
+    if(not emptySlot || not validIds
+     || not valid_offsets(mapped.TermOffsets, mapped.TermBytes.size())
+     || not valid_offsets(mapped.Documents.Offsets, header.EntryCount)
+     || not valid_offsets(mapped.Index.Offsets, header.EntryCount)) {
+        log_error("Index file '%s' is corrupt: invalid term table or offsets.", path);
+        close_index(mapped);
+        return -1;
+    }
+    log_mapped_debug("Mapped index '%s': %u terms, %u documents.", path, header.TermCount, header.DocCount);
+    return 0;
+}
+string_view llai::mapped_term   (const MappedIndex & mapped, TermId term) {
+    return {mapped.TermBytes.data() + mapped.TermOffsets[term], size_t(mapped.TermOffsets[term + 1] - mapped.TermOffsets[term])};
+}
+int32_t llai::find_term         (const MappedIndex & mapped, const string_view & term) {
+    const uint64_t  mask    = mapped.TermHash.size() - 1;
+    for(uint64_t slot = hash_term(term) & mask; ; slot = (slot + 1) & mask) {
+        const uint32_t id = mapped.TermHash[slot];
+        if(UINT32_MAX == id)
+            return -1;
+        if(mapped_term(mapped, id) == term)
+            return (int32_t)id;
+    }
+}
+int32_t llai::term_frequency    (const string_view & text, const span<const TokenRange> & tokenRanges, const MappedIndex & mapped, SparseVector & frequencies) {
+    frequencies.Terms.clear();
+    try {
+        for (auto tokenRange : tokenRanges) {
+            const int32_t term = find_term(mapped, text.substr(tokenRange.Offset, tokenRange.Size));
+            if(term >= 0)
+                frequencies.Terms.push_back((TermId)term);
+        }
+        count_terms(frequencies, tokenRanges.size());
+    }
+    catch (const bad_alloc & e) {
+        log_error("exception message:'%s'", e.what());
+        return -1;
+    }
+    return (int32_t)tokenRanges.size();
+}
+int32_t llai::query_top_k
+    ( const MappedIndex & mapped
+    , const string_view & query
+    , uint32_t k
+    , vector<ScoredDoc> & results
+    , double epsilon
+    ) {
+    vector<TokenRange>  query_token_ranges;
+    SparseVector        query_term_frequencies;
+    SparseVector        query_weighted;
+    if(0 > tokenize(query, query_token_ranges))
+        return -1;
+    if(0 > term_frequency(query, query_token_ranges, mapped, query_term_frequencies))
+        return -1;
+    weight_terms(sparse_row(query_term_frequencies), mapped.Idf, query_weighted);
+    return query_top_k(mapped.Index, sparse_row(query_weighted), k, results, epsilon);
+}
@@ -0,0 +1,74 @@
+#include "llai_index.h"
+
+#ifndef LLAI_MAPPED_H
+#define LLAI_MAPPED_H
+
+namespace llai
+{
+    enum INDEX_SECTION : uint32_t
+        { INDEX_SECTION_TERM_OFFSETS        // uint64_t[terms + 1] into the term bytes
+        , INDEX_SECTION_TERM_BYTES          // char[]
+        , INDEX_SECTION_TERM_HASH           // uint32_t[power of two] open-addressing table of term ids, UINT32_MAX when empty
+        , INDEX_SECTION_IDF                 // double[terms]
+        , INDEX_SECTION_DOC_OFFSETS         // uint32_t[docs + 1]
+        , INDEX_SECTION_DOC_TERMS           // uint32_t[entries]
+        , INDEX_SECTION_DOC_WEIGHTS         // double[entries]
+        , INDEX_SECTION_DOC_NORMS           // double[docs]
+        , INDEX_SECTION_POSTING_OFFSETS     // uint32_t[terms + 1]
+        , INDEX_SECTION_POSTING_DOCS        // uint32_t[entries]
+        , INDEX_SECTION_POSTING_WEIGHTS     // double[entries]
+        , INDEX_SECTION_MAX_SCORES          // double[terms]
+        , INDEX_SECTION_COUNT
+        };
+
+    struct IndexSection     { uint64_t Offset, Size; };
+    // Every section starts 8-byte aligned, so a mapped file is used in place.
+    struct IndexFileHeader {
+        uint32_t        Magic;
+        uint32_t        Version;
+        uint32_t        TermCount;
+        uint32_t        DocCount;
+        uint64_t        EntryCount;
+        uint64_t        FileSize;
+        uint64_t        Checksum;   // Over every byte after the header, then over the header with this field as 0.
+        IndexSection    Sections[INDEX_SECTION_COUNT];
+    };
+
+    static constexpr uint32_t   INDEX_FILE_MAGIC    = 0x49414C4C;   // "LLAI" when read on a little-endian machine.
+    static constexpr uint32_t   INDEX_FILE_VERSION  = 2;
+
+    // Read-only index backed by a file mapping. All views point into the mapping and stay valid until close_index.
+    struct MappedIndex {
+        const IndexFileHeader       * Header    = 0;
+        uint64_t                    Size        = 0;
+        intptr_t                    File        = -1;
+        intptr_t                    Mapping     = 0;
+        std::span<const uint64_t>   TermOffsets;
+        std::span<const char>       TermBytes;
+        std::span<const uint32_t>   TermHash;
+        std::span<const double>     Idf;
+        SparseMatrixView            Documents;
+        InvertedIndexView           Index;
+    };
+
+    // Writes path + ".tmp" and renames it over path, so indexes mapped from the old file stay valid until they are closed.
+    int32_t     save_index      (const char * path, const TermDictionary & dictionary, const std::span<const double> & idf_scores, const SparseMatrix & weighted, const InvertedIndex & index);
+    // Maps the file and points the views at it without copying. verify recomputes the checksum, which reads the whole file once.
+    // Without it only the term table and the offsets are checked: the term and document ids of the entries are trusted, so pass
+    // false only for files written by save_index on this machine and not modified since.
+    int32_t     open_index      (const char * path, MappedIndex & mapped, bool verify = true);
+    int32_t     close_index     (MappedIndex & mapped);
+
+    int32_t     find_term       (const MappedIndex & mapped, const std::string_view & term);   // Returns -1 if the term is not in the index.
+    std::string_view    mapped_term (const MappedIndex & mapped, TermId term);
+    int32_t     term_frequency  (const std::string_view & text, const std::span<const TokenRange> & tokenRanges, const MappedIndex & mapped, SparseVector & frequencies);
+    int32_t     query_top_k
+        ( const MappedIndex & mapped
+        , const std::string_view & query
+        , uint32_t k
+        , std::vector<ScoredDoc> & results
+        , double epsilon = 1e-6
+        );
+} // namespace
+
+#endif // LLAI_MAPPED_H
@@ -0,0 +1,106 @@
+#include "llai_metrics.h"
+
+#include <atomic>
+#include <bit>
+
+using std::atomic, std::memory_order_relaxed, std::memory_order_acquire, std::memory_order_release;
+using std::min;
+
+namespace
+{
+    struct ThreadMetrics {
+        atomic<uint64_t>    Counters    [llai::METRIC_COUNTER_COUNT]                                    = {};
+        atomic<uint64_t>    Calls       [llai::METRIC_STAGE_COUNT]                                      = {};
+        atomic<uint64_t>    Nanoseconds [llai::METRIC_STAGE_COUNT]                                      = {};
+        atomic<uint64_t>    Histogram   [llai::METRIC_STAGE_COUNT][llai::METRIC_HISTOGRAM_BUCKETS]      = {};
+        atomic<bool>        InUse       = true;
+        ThreadMetrics       * Next      = 0;
+    };
+
+    atomic<ThreadMetrics *> g_metrics   = 0;    // Blocks are pushed at the front and never removed.
+
+    ThreadMetrics * acquire_metrics () {
+        for(ThreadMetrics * metrics = g_metrics.load(memory_order_acquire); metrics; metrics = metrics->Next) {
+            bool inUse = false;
+            if(not metrics->InUse.load(memory_order_relaxed) && metrics->InUse.compare_exchange_strong(inUse, true, memory_order_acquire))
+                return metrics;
+        }
+        ThreadMetrics * metrics = new ThreadMetrics;
+        metrics->Next = g_metrics.load(memory_order_relaxed);
+        while(not g_metrics.compare_exchange_weak(metrics->Next, metrics, memory_order_release, memory_order_relaxed))
+            ;
+        return metrics;
+    }
+
+    struct ThreadSlot {
+        ThreadMetrics       * Metrics   = acquire_metrics();
+                            ~ThreadSlot () { Metrics->InUse.store(false, memory_order_release); }
+    };
+    thread_local ThreadSlot t_slot;
+
+    // Only the owning thread writes a block, so a plain load and store is enough. Readers may see a value one update behind.
+    inline  void    add     (atomic<uint64_t> & value, uint64_t amount) { value.store(value.load(memory_order_relaxed) + amount, memory_order_relaxed); }
+} // namespace
+
+void    llai::metrics_add       (METRIC_COUNTER counter, uint64_t value) { add(t_slot.Metrics->Counters[counter], value); }
+void    llai::metrics_record    (METRIC_STAGE stage, uint64_t nanoseconds) {
+    ThreadMetrics & metrics = *t_slot.Metrics;
+    add(metrics.Calls      [stage], 1);
+    add(metrics.Nanoseconds[stage], nanoseconds);
+    add(metrics.Histogram  [stage][min<uint32_t>((uint32_t)std::bit_width(nanoseconds), METRIC_HISTOGRAM_BUCKETS - 1)], 1);
+}
+int32_t llai::metrics_snapshot  (MetricsSnapshot & snapshot) {
+    snapshot = {};
+    int32_t blocks = 0;
+    for(const ThreadMetrics * metrics = g_metrics.load(memory_order_acquire); metrics; metrics = metrics->Next, ++blocks) {
+        for(uint32_t counter = 0; counter < METRIC_COUNTER_COUNT; ++counter)
+            snapshot.Counters[counter] += metrics->Counters[counter].load(memory_order_relaxed);
+        for(uint32_t stage = 0; stage < METRIC_STAGE_COUNT; ++stage) {
+            snapshot.Stages[stage].Calls        += metrics->Calls      [stage].load(memory_order_relaxed);
+            snapshot.Stages[stage].Nanoseconds  += metrics->Nanoseconds[stage].load(memory_order_relaxed);
+            for(uint32_t bucket = 0; bucket < METRIC_HISTOGRAM_BUCKETS; ++bucket)
+                snapshot.Stages[stage].Histogram[bucket] += metrics->Histogram[stage][bucket].load(memory_order_relaxed);
+        }
+    }
+    return blocks;
+}
+int32_t llai::metrics_reset     () {
+    int32_t blocks = 0;
+    for(ThreadMetrics * metrics = g_metrics.load(memory_order_acquire); metrics; metrics = metrics->Next, ++blocks) {
+        for(auto & value : metrics->Counters)
+            value.store(0, memory_order_relaxed);
+        for(uint32_t stage = 0; stage < METRIC_STAGE_COUNT; ++stage) {
+            metrics->Calls      [stage].store(0, memory_order_relaxed);
+            metrics->Nanoseconds[stage].store(0, memory_order_relaxed);
+            for(auto & value : metrics->Histogram[stage])
+                value.store(0, memory_order_relaxed);
+        }
+    }
+    return blocks;
+}
+uint64_t llai::metrics_percentile(const StageMetrics & stage, double percentile) {
+    const uint64_t  rank    = (uint64_t)(percentile / 100 * stage.Calls);
+    uint64_t        seen    = 0;
+    for(uint32_t bucket = 0; bucket < METRIC_HISTOGRAM_BUCKETS; ++bucket)
+        if((seen += stage.Histogram[bucket]) > rank || (seen && seen == stage.Calls))
+            return 1ULL << bucket;
+    return 0;
+}
+int32_t llai::metrics_dump      (const MetricsSnapshot & snapshot, FILE * output) {
+    static constexpr const char * stageNames    [METRIC_STAGE_COUNT]    = {"tokenize", "term_frequency", "idf", "weighting", "query"};
+    static constexpr const char * counterNames  [METRIC_COUNTER_COUNT]  = {"documents", "tokens", "terms", "bytes", "queries"};
+    for(uint32_t counter = 0; counter < METRIC_COUNTER_COUNT; ++counter)
+        fprintf(output, "%-16s %llu\n", counterNames[counter], (unsigned long long)snapshot.Counters[counter]);
+    for(uint32_t iStage = 0; iStage < METRIC_STAGE_COUNT; ++iStage) {
+        const StageMetrics & stage = snapshot.Stages[iStage];
+        if(0 == stage.Calls) {
+            fprintf(output, "%-16s calls 0, p50 n/a, p99 n/a\n", stageNames[iStage]);
+            continue;
+        }
+        fprintf(output, "%-16s calls %llu, total %.3f ms, mean %.0f ns, p50 < %llu ns, p99 < %llu ns\n", stageNames[iStage]
+            , (unsigned long long)stage.Calls, stage.Nanoseconds / 1e6, stage.Nanoseconds / (double)stage.Calls
+            , (unsigned long long)metrics_percentile(stage, 50), (unsigned long long)metrics_percentile(stage, 99)
+            );
+    }
+    return 0;
+}
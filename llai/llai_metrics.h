@@ -0,0 +1,73 @@
+#include <cstdint>
+#include <cstdio>
+#include <chrono>
+
+#ifndef LLAI_METRICS_H
+#define LLAI_METRICS_H
+
+// Set to 0 to compile out every metrics_count and metrics_time.
+#ifndef LLAI_METRICS
+#   define LLAI_METRICS 1
+#endif
+
+namespace llai
+{
+    enum METRIC_STAGE : uint8_t
+        { METRIC_STAGE_TOKENIZE
+        , METRIC_STAGE_TERM_FREQUENCY
+        , METRIC_STAGE_IDF
+        , METRIC_STAGE_WEIGHTING
+        , METRIC_STAGE_QUERY        // One pruned top-k query. Queries of a batch scored by the blocked product are only counted.
+        , METRIC_STAGE_COUNT
+        };
+    enum METRIC_COUNTER : uint8_t
+        { METRIC_COUNTER_DOCUMENTS
+        , METRIC_COUNTER_TOKENS
+        , METRIC_COUNTER_TERMS      // Distinct terms, summed per document
+        , METRIC_COUNTER_BYTES      // Document text processed
+        , METRIC_COUNTER_QUERIES
+        , METRIC_COUNTER_COUNT
+        };
+
+    static constexpr uint32_t   METRIC_HISTOGRAM_BUCKETS    = 40;   // Bucket i counts durations in [2^(i-1), 2^i) nanoseconds. The last one takes the rest.
+
+    struct StageMetrics {
+        uint64_t        Calls;
+        uint64_t        Nanoseconds;
+        uint64_t        Histogram[METRIC_HISTOGRAM_BUCKETS];
+    };
+    struct MetricsSnapshot {
+        StageMetrics    Stages      [METRIC_STAGE_COUNT];
+        uint64_t        Counters    [METRIC_COUNTER_COUNT];
+    };
+
+    // Every thread records into its own block, so recording takes no lock and no atomic read-modify-write. Blocks of finished threads
+    // keep their totals and are handed to the next thread that starts recording.
+    void        metrics_add         (METRIC_COUNTER counter, uint64_t value);
+    void        metrics_record      (METRIC_STAGE stage, uint64_t nanoseconds);
+    int32_t     metrics_snapshot    (MetricsSnapshot & snapshot);  // Sums the blocks of every thread. Returns the number of blocks.
+    int32_t     metrics_reset       ();                             // Only exact while no thread is recording.
+    int32_t     metrics_dump        (const MetricsSnapshot & snapshot, FILE * output = stderr);
+    // Exclusive upper bound of the bucket holding it, in nanoseconds. 0 when the stage has no calls, which metrics_dump prints as n/a.
+    uint64_t    metrics_percentile  (const StageMetrics & stage, double percentile);
+
+    // Records the time from construction to destruction.
+    struct StageTimer {
+        METRIC_STAGE                            Stage;
+        std::chrono::steady_clock::time_point   Start       = std::chrono::steady_clock::now();
+
+                                                StageTimer  (METRIC_STAGE stage) : Stage(stage) {}
+                                                ~StageTimer () { metrics_record(Stage, (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - Start).count()); }
+    };
+} // namespace
+
+// metrics_time declares a StageTimer named timer, timing the rest of the scope. stage can be any expression.
+#if LLAI_METRICS
+#   define metrics_count(counter, value)   ::llai::metrics_add(counter, value)
+#   define metrics_time(timer, stage)      const ::llai::StageTimer timer (stage)
+#else
+#   define metrics_count(counter, value)   do {} while(0)
+#   define metrics_time(timer, stage)      do {} while(0)
+#endif
+
+#endif // LLAI_METRICS_H
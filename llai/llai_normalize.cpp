@@ -0,0 +1,328 @@
+#include "llai_normalize.h"
+#include "llai_log.h"
+
+#include <array>
+#include <cstring>
+
+using std::bad_alloc;
+using std::array, std::span, std::string_view, std::vector;
+using std::size, std::max, std::memcpy;
+
+#define log_normalize_debug(fmt, ...)	do {} while(0) // log_debug("|normalize|" fmt, __VA_ARGS__) //
+
+static  constexpr uint8_t   BYTE_TOKEN          = 0x10;     // Low nibble: length of the sequence a byte starts, 0 if it can't start one.
+static  constexpr uint32_t  FOLD_COUNT          = 0x500;    // Latin, Greek and Cyrillic
+
+static  constexpr array<uint8_t, 256>   BYTE_CLASS  = [] {
+    array<uint8_t, 256> table   = {};
+    for(uint32_t byte = 0; byte < 256; ++byte)
+        table[byte]
+            = (byte < 0x80) ? uint8_t(1 | ((byte >= 'A' && byte <= 'z') ? BYTE_TOKEN : 0))    // Same ASCII classes as tokenize()
+            : (byte < 0xC2) ? 0     // Continuation bytes and overlong leads
+            : (byte < 0xE0) ? 2
+            : (byte < 0xF0) ? 3
+            : (byte < 0xF5) ? 4
+            : 0
+            ;
+    return table;
+}();
+
+static  constexpr char32_t  lower_codepoint (char32_t cp) {
+    if(cp >= 'A' && cp <= 'Z')
+        return cp + 0x20;
+    if(cp >= 0xC0 && cp <= 0xDE && cp != 0xD7)
+        return cp + 0x20;
+    if(cp == 0x130)     // İ
+        return 'i';
+    if(cp == 0x178)     // Ÿ
+        return 0xFF;
+    if(cp == 0x17F)     // Long s
+        return 's';
+    if((cp >= 0x100 && cp <= 0x137) || (cp >= 0x14A && cp <= 0x177) || (cp >= 0x460 && cp <= 0x481) || (cp >= 0x48A && cp <= 0x4BF) || (cp >= 0x4D0 && cp <= 0x4FF))
+        return cp | 1;  // Pairs starting on an even codepoint
+    if((cp >= 0x139 && cp <= 0x148) || (cp >= 0x179 && cp <= 0x17E) || (cp >= 0x4C1 && cp <= 0x4CE))
+        return (cp & 1) ? cp + 1 : cp;
+    if(cp == 0x386)
+        return 0x3AC;
+    if(cp >= 0x388 && cp <= 0x38A)
+        return cp + 0x25;
+    if(cp == 0x38C)
+        return 0x3CC;
+    if(cp == 0x38E || cp == 0x38F)
+        return cp + 0x3F;
+    if((cp >= 0x391 && cp <= 0x3AB && cp != 0x3A2) || (cp >= 0x410 && cp <= 0x42F))
+        return cp + 0x20;
+    if(cp == 0x3C2)     // Final sigma
+        return 0x3C3;
+    if(cp >= 0x400 && cp <= 0x40F)
+        return cp + 0x50;
+    if(cp == 0x4C0)
+        return 0x4CF;
+    return cp;
+}
+
+namespace
+{
+    struct CodepointFold {
+        char16_t    Lower;
+        char        Base    [2];    // ASCII letters without the accent, Base[0] == 0 when there are none.
+    };
+} // namespace
+
+static  constexpr array<CodepointFold, FOLD_COUNT>  FOLDS   = [] {
+    // U+00C0..U+017F. Digits stand for two letters and '.' for no base letter.
+    constexpr const char    latin1      [] = "AAAAAA5CEEEEIIIIDNOOOOO.OUUUUY79aaaaaa6ceeeeiiiidnooooo.ouuuuy8y";
+    constexpr const char    extendedA   [] = "AaAaAaCcCcCcCcDdDdEeEeEeEeEeGgGgGgGgHhHhIiIiIiIiIi12JjKkkLlLlLlLlLlNnNnNnnNnOoOoOo34RrRrRrSsSsSsSsTtTtTtUuUuUuUuUuUuWwYyYZzZzZzs";
+    constexpr const char *  digraphs    [] = {"IJ", "ij", "OE", "oe", "AE", "ae", "TH", "th", "ss"};
+    array<CodepointFold, FOLD_COUNT>    table   = {};
+    for(uint32_t cp = 0; cp < FOLD_COUNT; ++cp) {
+        table[cp].Lower = (char16_t)lower_codepoint(cp);
+        const char  base    = (cp >= 0xC0 && cp < 0x100) ? latin1[cp - 0xC0] : (cp >= 0x100 && cp < 0x180) ? extendedA[cp - 0x100] : '.';
+        if(base >= '1' && base <= '9') {
+            table[cp].Base[0] = digraphs[base - '1'][0];
+            table[cp].Base[1] = digraphs[base - '1'][1];
+        }
+        else if(base != '.')
+            table[cp].Base[0] = base;
+    }
+    return table;
+}();
+
+static  inline  char    lower_ascii     (char c) { return (c >= 'A' && c <= 'Z') ? char(c + 0x20) : c; }
+
+// Returns the length of the sequence starting at text[0], or 0 if it is malformed, truncated, overlong or a surrogate.
+static  inline  uint32_t    decode_utf8 (const uint8_t * text, size_t available, char32_t & codepoint) {
+    static constexpr char32_t   minimum     [5] = {0, 0, 0x80, 0x800, 0x10000};
+    const uint32_t              length      = BYTE_CLASS[text[0]] & 0xF;
+    if(0 == length || length > available)
+        return 0;
+    codepoint = text[0] & (1 == length ? 0x7F : 0x7F >> length);
+    for(uint32_t iByte = 1; iByte < length; ++iByte) {
+        if((text[iByte] & 0xC0) != 0x80)
+            return 0;
+        codepoint = (codepoint << 6) | (text[iByte] & 0x3F);
+    }
+    return (codepoint < minimum[length] || codepoint > 0x10FFFF || (codepoint >= 0xD800 && codepoint <= 0xDFFF)) ? 0 : length;
+}
+static  inline  uint32_t    encode_utf8 (char32_t codepoint, char * output) {   // Only for codepoints below FOLD_COUNT.
+    if(codepoint < 0x80) {
+        output[0] = (char)codepoint;
+        return 1;
+    }
+    output[0] = char(0xC0 | (codepoint >> 6));
+    output[1] = char(0x80 | (codepoint & 0x3F));
+    return 2;
+}
+static  inline  bool    is_word_codepoint   (char32_t cp) {
+    return cp >= 0xC0 && cp != 0xD7 && cp != 0xF7  // Latin-1 punctuation and symbols, ×, ÷
+        && not (cp >= 0x2000 && cp <= 0x2BFF)       // Punctuation, symbols, arrows, math operators, box drawing
+        && not (cp >= 0x3000 && cp <= 0x303F)       // CJK punctuation
+        && not (cp >= 0xFF00 && cp <= 0xFF0F)       // Fullwidth punctuation
+        && cp != 0xFEFF                             // Byte order mark
+        && not (cp >= 0x1F000 && cp <= 0x1FAFF)     // Emoji and pictographs
+        ;
+}
+
+// Writes the folded token to output and returns its size, which is never more than token.size().
+static  uint32_t    fold_token      (const string_view & token, uint8_t flags, char * output) {
+    const uint8_t * bytes   = (const uint8_t *)token.data();
+    const bool      lower   = 0 != (flags & llai::NORMALIZE_CASE);
+    const bool      accents = 0 != (flags & llai::NORMALIZE_ACCENTS);
+    uint32_t        written = 0;
+    for(uint32_t pos = 0; pos < token.size(); ) {
+        if(bytes[pos] < 0x80) {
+            output[written++] = lower ? lower_ascii(token[pos]) : token[pos];
+            ++pos;
+            continue;
+        }
+        char32_t        cp      = 0;
+        const uint32_t  length  = decode_utf8(&bytes[pos], token.size() - pos, cp);
+        if(0 == length) {   // Only in tokens that didn't come from tokenize_utf8
+            output[written++] = token[pos++];
+            continue;
+        }
+        if(cp < FOLD_COUNT) {
+            const CodepointFold & fold = FOLDS[cp];
+            if(accents && fold.Base[0]) {
+                output[written++] = lower ? lower_ascii(fold.Base[0]) : fold.Base[0];
+                if(fold.Base[1])
+                    output[written++] = lower ? lower_ascii(fold.Base[1]) : fold.Base[1];
+                pos += length;
+                continue;
+            }
+            if(accents && cp >= 0x300 && cp < 0x370) {  // Combining marks of decomposed text
+                pos += length;
+                continue;
+            }
+            if(lower) {
+                written += encode_utf8(fold.Lower, &output[written]);
+                pos += length;
+                continue;
+            }
+        }
+        memcpy(&output[written], &token[pos], length);
+        written += length;
+        pos     += length;
+    }
+    return written;
+}
+
+// Harman's S-stemmer, as in Lucene's EnglishMinimalStemmer, except that terms of up to 3 bytes are kept whole. Returns the new size.
+static  uint32_t    stem_plural     (char * term, uint32_t size) {
+    if(size <= 3 || term[size - 1] != 's')
+        return size;
+    switch(term[size - 2]) {
+    case 'u':
+    case 's':
+        return size;
+    case 'e':
+        if(term[size - 3] == 'i' && term[size - 4] != 'a' && term[size - 4] != 'e') {   // "ies" -> "y"
+            term[size - 3] = 'y';
+            return size - 2;
+        }
+        if(term[size - 3] == 'i' || term[size - 3] == 'a' || term[size - 3] == 'o' || term[size - 3] == 'e')
+            return size;
+        [[fallthrough]];
+    default:
+        return size - 1;
+    }
+}
+
+int32_t llai::tokenize_utf8     (const string_view & text, vector<TokenRange> & tokenRanges, const string_view & terminator) {
+    const size_t    found   = terminator.empty() ? string_view::npos : text.find(terminator);
+    const uint32_t  limit   = uint32_t((string_view::npos == found) ? text.size() : found);
+    const uint8_t * bytes   = (const uint8_t *)text.data();
+    uint32_t        start   = 0;
+    bool            inToken = false;
+    try {
+        for(uint32_t pos = 0; pos < limit; ) {
+            uint32_t    length  = 1;
+            bool        word    = 0 != (BYTE_CLASS[bytes[pos]] & BYTE_TOKEN);
+            if(bytes[pos] >= 0x80) {
+                char32_t    cp      = 0;
+                length  = decode_utf8(&bytes[pos], limit - pos, cp);
+                word    = length && is_word_codepoint(cp);
+                length  = max(length, 1U);  // Malformed bytes separate tokens one at a time.
+            }
+            if(word != inToken) {
+                if(word)
+                    start = pos;
+                else
+                    tokenRanges.push_back({start, pos - start});
+                inToken = word;
+            }
+            pos += length;
+        }
+        if(inToken)
+            tokenRanges.push_back({start, limit - start});
+    }
+    catch (const bad_alloc & e) {
+        log_error("exception message:'%s'", e.what());
+        return -1;
+    }
+    return limit;
+}
+
+int32_t llai::normalize_tokens  (const string_view & text, const span<const TokenRange> & tokenRanges, uint8_t flags, NormalizedTokens & normalized) {
+    size_t          total   = 0;
+    for(const auto tokenRange : tokenRanges)
+        total += tokenRange.Size;
+    try {
+        normalized.Text     .resize(total);     // Terms are never longer than their tokens.
+        normalized.Ranges   .resize(tokenRanges.size());
+    }
+    catch (const bad_alloc & e) {
+        log_error("exception message:'%s'", e.what());
+        return -1;
+    }
+    char * const    output  = normalized.Text.data();
+    uint32_t        used    = 0;
+    uint32_t        count   = 0;
+    for(const auto tokenRange : tokenRanges) {
+        uint32_t size = fold_token(text.substr(tokenRange.Offset, tokenRange.Size), flags, &output[used]);
+        if(flags & NORMALIZE_STEM)
+            size = stem_plural(&output[used], size);
+        if(0 == size)
+            continue;
+        normalized.Ranges[count++] = {used, size};
+        used += size;
+    }
+    normalized.Text     .resize(used);
+    normalized.Ranges   .resize(count);
+    return (int32_t)count;
+}
+
+int32_t llai::term_frequency
+    ( const string_view & text
+    , const span<const TokenRange> & tokenRanges
+    , uint8_t flags
+    , NormalizedTokens & scratch
+    , TermDictionary & dictionary
+    , StringArena & arena
+    , SparseVector & frequencies
+    ) {
+    frequencies.Terms.clear();
+    if(0 > normalize_tokens(text, tokenRanges, flags, scratch))
+        return -1;
+    const string_view   terms   = scratch.Text;
+    try {
+        for(const auto termRange : scratch.Ranges)
+            frequencies.Terms.push_back((TermId)intern_term(dictionary, arena, terms.substr(termRange.Offset, termRange.Size)));
+        count_terms(frequencies, tokenRanges.size());
+    }
+    catch (const bad_alloc & e) {
+        log_error("exception message:'%s'", e.what());
+        return -1;
+    }
+    return (int32_t)tokenRanges.size();
+}
+int32_t llai::term_frequency
+    ( const string_view & text
+    , const span<const TokenRange> & tokenRanges
+    , uint8_t flags
+    , NormalizedTokens & scratch
+    , const TermDictionary & dictionary
+    , SparseVector & frequencies
+    ) {
+    frequencies.Terms.clear();
+    if(0 > normalize_tokens(text, tokenRanges, flags, scratch))
+        return -1;
+    const string_view   terms   = scratch.Text;
+    try {
+        for(const auto termRange : scratch.Ranges) {
+            const int32_t term = find_term(dictionary, terms.substr(termRange.Offset, termRange.Size));
+            if(term >= 0)
+                frequencies.Terms.push_back((TermId)term);
+        }
+        count_terms(frequencies, tokenRanges.size());
+    }
+    catch (const bad_alloc & e) {
+        log_error("exception message:'%s'", e.what());
+        return -1;
+    }
+    return (int32_t)tokenRanges.size();
+}
+
+llai::DocumentCounter   llai::document_counter  (uint8_t flags, TermDictionary & dictionary, StringArena & arena) {
+    auto                scratch     = std::make_shared<NormalizedTokens>();
+    return
+        { [](const string_view & text, vector<TokenRange> & tokenRanges) { return tokenize_utf8(text, tokenRanges); }
+        , [flags, &dictionary, &arena, scratch](const string_view & text, const span<const TokenRange> & tokenRanges, SparseVector & frequencies) {
+            return term_frequency(text, tokenRanges, flags, *scratch, dictionary, arena, frequencies);
+        }
+        };
+}
+int32_t llai::load_docs
+    ( const span<const string_view> & docs
+    , uint8_t flags
+    , TermDictionary & dictionary
+    , StringArena & arena
+    , vector<double> & idf_scores
+    , SparseMatrix & weighted
+    ) {
+    const int32_t result = count_docs(docs, document_counter(flags, dictionary, arena), weighted);
+    if(0 > result)
+        return result;
+    log_normalize_debug("Loaded %u documents into %u terms.", (uint32_t)size(docs), (uint32_t)dictionary.Terms.size());
+    return weight_docs((uint32_t)dictionary.Terms.size(), idf_scores, weighted);
+}
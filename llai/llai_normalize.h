@@ -0,0 +1,65 @@
+#include "llai_sparse.h"
+
+#include <string>
+
+#ifndef LLAI_NORMALIZE_H
+#define LLAI_NORMALIZE_H
+
+namespace llai
+{
+    enum NORMALIZE : uint8_t
+        { NORMALIZE_NONE        = 0
+        , NORMALIZE_CASE        = 1     // Lowercase Latin, Greek and Cyrillic letters.
+        , NORMALIZE_ACCENTS     = 2     // Latin letters to their ASCII base ("cámara" -> "camara", "ß" -> "ss"), combining marks dropped.
+        , NORMALIZE_STEM        = 4     // Harman's S-stemmer on the folded term: "ies" -> "y", "es" -> "e", "s" -> "" on terms over 3 bytes.
+        , NORMALIZE_DEFAULT     = NORMALIZE_CASE | NORMALIZE_ACCENTS
+        };
+
+    // Same as tokenize() on ASCII text, but UTF-8 sequences decoding to letters, marks and other word characters are part of tokens
+    // instead of separators. Punctuation and symbol blocks, emoji and malformed bytes still separate tokens.
+    int32_t     tokenize_utf8       (const std::string_view & text, std::vector<TokenRange> & tokenRanges, const std::string_view & terminator = "");
+
+    // Normalized tokens back to back in Text, with one range into Text per token. Reused across documents so that normalizing
+    // allocates nothing once the buffers have grown to the largest document.
+    struct NormalizedTokens {
+        std::string                 Text;
+        std::vector<TokenRange>     Ranges;
+    };
+
+    // Folds every token of text as the flags ask. A term is never longer than its token. Tokens left empty are dropped.
+    int32_t     normalize_tokens    (const std::string_view & text, const std::span<const TokenRange> & tokenRanges, uint8_t flags, NormalizedTokens & normalized);
+    // Normalizes the tokens and interns the terms, copying each new one into the arena once. Tokens normalized away still count
+    // towards the token total, so the frequencies match those of the raw tokens.
+    int32_t     term_frequency
+        ( const std::string_view & text
+        , const std::span<const TokenRange> & tokenRanges
+        , uint8_t flags
+        , NormalizedTokens & scratch
+        , TermDictionary & dictionary
+        , StringArena & arena
+        , SparseVector & frequencies
+        );
+    // Lookup-only variant for queries, which must be normalized with the flags the documents were loaded with.
+    int32_t     term_frequency
+        ( const std::string_view & text
+        , const std::span<const TokenRange> & tokenRanges
+        , uint8_t flags
+        , NormalizedTokens & scratch
+        , const TermDictionary & dictionary
+        , SparseVector & frequencies
+        );
+    // tokenize_utf8 and the interning normalized term_frequency, for count_docs. The counter keeps its own scratch, so it is not
+    // shared between threads.
+    DocumentCounter     document_counter    (uint8_t flags, TermDictionary & dictionary, StringArena & arena);
+    // load_docs with tokenize_utf8 and normalized terms. The dictionary owns its terms through the arena, not the documents.
+    int32_t     load_docs
+        ( const std::span<const std::string_view> & documents
+        , uint8_t flags
+        , TermDictionary & dictionary
+        , StringArena & arena
+        , std::vector<double> & idf_scores
+        , SparseMatrix & weighted
+        );
+} // namespace
+
+#endif // LLAI_NORMALIZE_H
@@ -0,0 +1,170 @@
+#include "llai_parallel.h"
+#include "llai_log.h"
+#include "llai_metrics.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <thread>
+
+using std::exception;
+using std::span, std::string_view, std::vector, std::unordered_map, std::atomic, std::thread, std::pair;
+using std::size, std::min, std::sort, std::log;
+
+#define log_parallel_debug(fmt, ...)	do {} while(0) // log_debug("|parallel|" fmt, __VA_ARGS__) //
+
+uint32_t llai::thread_count (uint32_t requested) {
+    if(requested)
+        return requested;
+    const uint32_t hardware = thread::hardware_concurrency();
+    return hardware ? hardware : 1;
+}
+int32_t llai::parallel_for  (uint32_t count, uint32_t threadCount, uint32_t chunkSize, const RangeTask & task) {
+    threadCount = min(thread_count(threadCount), chunkSize ? (count + chunkSize - 1) / chunkSize : 1);
+    chunkSize   = chunkSize ? chunkSize : count;
+    atomic<uint32_t>    nextChunk   = 0;
+    atomic<bool>        failed      = false;
+    auto                worker      = [&](uint32_t iThread) {
+        for(uint32_t begin; not failed.load(std::memory_order_relaxed) && (begin = nextChunk.fetch_add(chunkSize)) < count; ) {
+            try {
+                if(0 > task(begin, min(count, begin + chunkSize), iThread))
+                    failed = true;
+            }
+            catch (const exception & e) {
+                log_error("exception message:'%s'", e.what());
+                failed = true;
+            }
+        }
+    };
+    vector<thread>      threads;
+    try {
+        for(uint32_t iThread = 1; iThread < threadCount; ++iThread)
+            threads.emplace_back(worker, iThread);
+    }
+    catch (const exception & e) {
+        log_error("exception message:'%s'", e.what());    // Whatever threads started still drain the chunks.
+    }
+    worker(0);
+    for(auto & worker_thread : threads)
+        worker_thread.join();
+    log_parallel_debug("Ran %u items on %u threads.", count, (uint32_t)threads.size() + 1);
+    return failed ? -1 : 0;
+}
+
+namespace
+{
+    struct DocumentTerms {
+        vector<string_view>     Terms;      // Distinct terms in order of first occurrence, which is the order the serial path interns them in.
+        vector<uint32_t>        Counts;
+        vector<llai::TermId>    Ids;
+        uint32_t                TokenCount;
+    };
+    struct ThreadScratch {
+        vector<llai::TokenRange>                TokenRanges;
+        unordered_map<string_view, uint32_t>    Positions;
+        vector<pair<llai::TermId, uint32_t>>    Row;
+    };
+} // namespace
+
+static  constexpr uint32_t  LOAD_CHUNK_SIZE = 64;
+
+int32_t llai::load_docs     (const span<const string_view> & docs, TermDictionary & dictionary, vector<double> & idf_scores, SparseMatrix & weighted, uint32_t threadCount) {
+    threadCount = thread_count(threadCount);
+    const uint32_t          docCount        = (uint32_t)size(docs);
+    vector<DocumentTerms>   documentTerms   (docCount);
+    vector<ThreadScratch>   scratch         (threadCount);
+    atomic<uint32_t>        firstFailure    = docCount;
+    int32_t result = parallel_for(docCount, threadCount, LOAD_CHUNK_SIZE, [&](uint32_t begin, uint32_t end, uint32_t iThread) {   // Tokenize and count terms
+        ThreadScratch & local = scratch[iThread];
+        for(uint32_t iDoc = begin; iDoc < end; ++iDoc) {
+            const auto & document = docs[iDoc];
+            local.TokenRanges.clear();
+            {
+                metrics_time(tokenizeTimer, METRIC_STAGE_TOKENIZE);
+                if(0 > llai::tokenize(document, local.TokenRanges)) {
+                    log_error("Failed to tokenize document at %u: '%.*s'.", iDoc, (int)document.size(), document.data());
+                    for(uint32_t first = firstFailure; iDoc < first && not firstFailure.compare_exchange_weak(first, iDoc); );
+                    return -1;
+                }
+            }
+            metrics_time(frequencyTimer, METRIC_STAGE_TERM_FREQUENCY);
+            DocumentTerms & terms = documentTerms[iDoc];
+            terms.TokenCount = (uint32_t)local.TokenRanges.size();
+            local.Positions.clear();
+            for(const auto tokenRange : local.TokenRanges) {
+                const auto [it, inserted] = local.Positions.try_emplace(document.substr(tokenRange.Offset, tokenRange.Size), (uint32_t)terms.Terms.size());
+                if(inserted) {
+                    terms.Terms .push_back(it->first);
+                    terms.Counts.push_back(1);
+                }
+                else
+                    ++terms.Counts[it->second];
+            }
+            metrics_count(METRIC_COUNTER_DOCUMENTS, 1);
+            metrics_count(METRIC_COUNTER_TOKENS, terms.TokenCount);
+            metrics_count(METRIC_COUNTER_TERMS, terms.Terms.size());
+            metrics_count(METRIC_COUNTER_BYTES, document.size());
+        }
+        return 0;
+    });
+    if(0 > result)
+        return (firstFailure < docCount) ? -1 - (int32_t)firstFailure.load() : -1;
+
+    weighted = {};
+    weighted.Offsets.resize(docCount + 1);
+    for(uint32_t iDoc = 0; iDoc < docCount; ++iDoc) {   // Intern in document order so ids match the serial path.
+        DocumentTerms & terms = documentTerms[iDoc];
+        terms.Ids.resize(terms.Terms.size());
+        for(uint32_t iTerm = 0; iTerm < terms.Terms.size(); ++iTerm)
+            terms.Ids[iTerm] = (TermId)intern_term(dictionary, terms.Terms[iTerm]);
+        weighted.Offsets[iDoc + 1] = weighted.Offsets[iDoc] + (uint32_t)terms.Ids.size();
+    }
+    const uint32_t          termCount       = (uint32_t)dictionary.Terms.size();
+    weighted.Terms  .resize(weighted.Offsets.back());
+    weighted.Weights.resize(weighted.Offsets.back());
+    vector<vector<uint32_t>>    occurrences (threadCount);  // Thread-local document frequencies, merged below.
+    result = parallel_for(docCount, threadCount, LOAD_CHUNK_SIZE, [&](uint32_t begin, uint32_t end, uint32_t iThread) {   // Build sorted term frequency rows
+        auto & row          = scratch[iThread].Row;
+        auto & local        = occurrences[iThread];
+        if(local.empty())
+            local.resize(termCount);
+        for(uint32_t iDoc = begin; iDoc < end; ++iDoc) {
+            DocumentTerms & terms = documentTerms[iDoc];
+            row.clear();
+            for(uint32_t iTerm = 0; iTerm < terms.Ids.size(); ++iTerm)
+                row.push_back({terms.Ids[iTerm], terms.Counts[iTerm]});
+            sort(row.begin(), row.end());
+            uint32_t offset = weighted.Offsets[iDoc];
+            for(const auto & [term, count] : row) {
+                weighted.Terms  [offset]    = term;
+                weighted.Weights[offset++]  = count / (double)terms.TokenCount;
+                ++local[term];
+            }
+            terms = {};
+        }
+        return 0;
+    });
+    if(0 > result)
+        return -1;
+
+    vector<uint32_t>        doc_occurrences (termCount);
+    idf_scores.resize(termCount);
+    result = parallel_for(termCount, threadCount, 4096, [&](uint32_t begin, uint32_t end, uint32_t) {  // Merge document frequencies and calculate IDF
+        metrics_time(idfTimer, METRIC_STAGE_IDF);
+        for(const auto & local : occurrences)
+            for(uint32_t term = begin; not local.empty() && term < end; ++term)
+                doc_occurrences[term] += local[term];
+        for(uint32_t term = begin; term < end; ++term)
+            idf_scores[term] = idf_score(docCount, doc_occurrences[term]);
+        return 0;
+    });
+    if(0 > result)
+        return -1;
+    result = parallel_for(docCount, threadCount, LOAD_CHUNK_SIZE * 16, [&](uint32_t begin, uint32_t end, uint32_t) {   // Weight terms: TF * IDF
+        metrics_time(weightingTimer, METRIC_STAGE_WEIGHTING);
+        for(uint32_t iEntry = weighted.Offsets[begin]; iEntry < weighted.Offsets[end]; ++iEntry)
+            weighted.Weights[iEntry] *= idf_scores[weighted.Terms[iEntry]];
+        return 0;
+    });
+    return (0 > result) ? -1 : 0;
+}
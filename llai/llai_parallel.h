@@ -0,0 +1,22 @@
+#include "llai_sparse.h"
+
+#include <functional>
+
+#ifndef LLAI_PARALLEL_H
+#define LLAI_PARALLEL_H
+
+namespace llai
+{
+    typedef std::function<int32_t(uint32_t begin, uint32_t end, uint32_t iThread)>  RangeTask;
+
+    uint32_t    thread_count    (uint32_t requested);   // 0 selects one thread per hardware thread.
+    // Runs task over [0, count) in chunks of chunkSize. Threads claim the next chunk from a shared counter when they finish one, so
+    // uneven chunks balance out. iThread is in [0, thread_count(threadCount)). Returns -1 if any task failed or threw.
+    int32_t     parallel_for    (uint32_t count, uint32_t threadCount, uint32_t chunkSize, const RangeTask & task);
+
+    // Same results as the serial load_docs, bit for bit, with tokenization, term frequencies, document frequencies and weighting spread
+    // over threadCount threads. Only term interning runs serially, once per distinct term of each document, to keep ids deterministic.
+    int32_t     load_docs       (const std::span<const std::string_view> & documents, TermDictionary & dictionary, std::vector<double> & idf_scores, SparseMatrix & weighted, uint32_t threadCount);
+} // namespace
+
+#endif // LLAI_PARALLEL_H
@@ -0,0 +1,80 @@
+#include "llai_pmr.h"
+#include "llai_parallel.h"
+#include "llai_log.h"
+
+#include <cmath>
+#include <new>
+
+using std::bad_alloc;
+using std::span, std::string_view, std::vector, std::unique_ptr, std::make_unique;
+using std::size, std::min;
+
+#define log_pmr_debug(fmt, ...)	do {} while(0) // log_debug("|pmr|" fmt, __VA_ARGS__) //
+
+static  constexpr uint32_t  PMR_CHUNK_SIZE      = 64;
+static  constexpr size_t    ARENA_INITIAL_SIZE  = 1 << 16;
+
+void *  llai::AllocationCounter::do_allocate    (size_t bytes, size_t alignment) {
+    void * pointer = Upstream->allocate(bytes, alignment);
+    Allocations.fetch_add(1, std::memory_order_relaxed);
+    Bytes.fetch_add(bytes, std::memory_order_relaxed);
+    return pointer;
+}
+void    llai::AllocationCounter::do_deallocate  (void * pointer, size_t bytes, size_t alignment) {
+    Upstream->deallocate(pointer, bytes, alignment);
+    Deallocations.fetch_add(1, std::memory_order_relaxed);
+}
+
+int32_t llai::load_docs(const span<const string_view> & docs, PmrWeightedCorpus & corpus, span<MapScratch> scratch) {
+    const uint32_t          docCount        = (uint32_t)size(docs);
+    if(scratch.empty() || corpus.Documents.size()) {
+        log_error("Invalid arguments: %u scratch entries, %u documents already loaded.", (uint32_t)scratch.size(), (uint32_t)corpus.Documents.size());
+        return -1;
+    }
+    try {
+        for(uint32_t iDoc = 0; iDoc < docCount; iDoc += PMR_CHUNK_SIZE)
+            corpus.Arenas.push_back(make_unique<std::pmr::monotonic_buffer_resource>(ARENA_INITIAL_SIZE, &corpus.Counter));
+        PmrTokenWeightMap * maps = (PmrTokenWeightMap *)corpus.MapArena.allocate(sizeof(PmrTokenWeightMap) * docCount, alignof(PmrTokenWeightMap));
+        for(uint32_t iDoc = 0; iDoc < docCount; ++iDoc)
+            new (&maps[iDoc]) PmrTokenWeightMap(corpus.Arenas[iDoc / PMR_CHUNK_SIZE].get());
+        corpus.Documents = {maps, docCount};
+    }
+    catch (const bad_alloc & e) {
+        log_error("exception message:'%s'", e.what());
+        return -1;
+    }
+    for(MapScratch & local : scratch)
+        local.Occurrences.clear();
+    // parallel_for hands out chunks starting at multiples of the chunk size, so each arena is only used by the thread loading its chunk.
+    int32_t result = parallel_for(docCount, (uint32_t)scratch.size(), PMR_CHUNK_SIZE, [&](uint32_t begin, uint32_t end, uint32_t iThread) {
+        MapScratch & local = scratch[iThread];
+        TokenWeightLimits limits;
+        for(uint32_t iDoc = begin; iDoc < end; ++iDoc) {
+            local.TokenRanges.clear();
+            if(0 > tokenize(docs[iDoc], local.TokenRanges)) {
+                log_error("Failed to tokenize document at %u: '%.*s'.", iDoc, (int)docs[iDoc].size(), docs[iDoc].data());
+                return -1;
+            }
+            term_frequency(docs[iDoc], local.TokenRanges, corpus.Documents[iDoc], limits);
+            for(const auto & [term, count] : corpus.Documents[iDoc])
+                local.Occurrences[term] += 1;
+        }
+        return 0;
+    });
+    if(0 > result)
+        return -1;
+    for(const MapScratch & local : scratch)
+        for(const auto & [term, count] : local.Occurrences)
+            corpus.IdfScores[term] += count;
+    const double            total_documents = (double)docCount;
+    for(auto & [term, count] : corpus.IdfScores)    // Calculate IDF
+        count = log(total_documents / (1.0 + count));
+    result = parallel_for(docCount, (uint32_t)scratch.size(), PMR_CHUNK_SIZE, [&](uint32_t begin, uint32_t end, uint32_t) {
+        for(uint32_t iDoc = begin; iDoc < end; ++iDoc)
+            for(auto & [term, tf_value] : corpus.Documents[iDoc])  // Weight terms: TF * IDF
+                tf_value *= corpus.IdfScores.find(term)->second;
+        return 0;
+    });
+    log_pmr_debug("Loaded %u documents with %llu arena allocations.", docCount, (unsigned long long)corpus.Counter.Allocations.load());
+    return result;
+}
@@ -0,0 +1,64 @@
+#include "llai_ranking.h"
+
+#include <atomic>
+#include <memory>
+#include <memory_resource>
+
+#ifndef LLAI_PMR_H
+#define LLAI_PMR_H
+
+namespace llai
+{
+    typedef std::pmr::unordered_map<std::string_view, double>   PmrTokenWeightMap;
+
+    // Forwards to Upstream and counts what goes through. Thread safe when Upstream is.
+    struct AllocationCounter : public std::pmr::memory_resource {
+        std::pmr::memory_resource   * Upstream;
+        std::atomic<uint64_t>       Allocations     = 0;
+        std::atomic<uint64_t>       Deallocations   = 0;
+        std::atomic<uint64_t>       Bytes           = 0;    // Total requested, including what was given back since
+
+                                    AllocationCounter   (std::pmr::memory_resource * upstream = std::pmr::get_default_resource()) : Upstream(upstream) {}
+    protected:
+        void *                      do_allocate         (size_t bytes, size_t alignment)                override;
+        void                        do_deallocate       (void * pointer, size_t bytes, size_t alignment) override;
+        bool                        do_is_equal         (const std::pmr::memory_resource & other) const noexcept override { return this == &other; }
+    };
+
+    // Per-thread scratch for the map path. Reused across documents and across calls: once its buffers have grown to fit the largest
+    // document and vocabulary seen, loading allocates nothing from Counter.
+    struct MapScratch {
+        AllocationCounter                       Counter;
+        std::pmr::unsynchronized_pool_resource  Pool            {&Counter};
+        std::vector<TokenRange>                 TokenRanges;
+        PmrTokenWeightMap                       Occurrences     {&Pool};    // Document frequencies of the documents this thread loaded
+    };
+
+    // Weighted maps of a corpus. Every chunk of documents allocates its maps from its own monotonic arena, which only the thread loading
+    // that chunk touches. The maps themselves live in MapArena and are never destroyed: they hold nothing but arena memory, so releasing
+    // the arenas frees the whole corpus without visiting a single node.
+    struct PmrWeightedCorpus {
+        AllocationCounter                                                   Counter;    // Upstream of every arena
+        std::vector<std::unique_ptr<std::pmr::monotonic_buffer_resource>>   Arenas;
+        std::pmr::monotonic_buffer_resource                                 MapArena    {&Counter};
+        PmrTokenWeightMap                                                   IdfScores   {&MapArena};
+        std::span<PmrTokenWeightMap>                                        Documents;
+    };
+
+    // Same maps and values as the TokenWeightMap load_docs, into an empty corpus. Documents are loaded on one thread per scratch entry.
+    int32_t load_docs           (const std::span<const std::string_view> & documents, PmrWeightedCorpus & corpus, std::span<MapScratch> scratch);
+    // The TokenWeightMap functions for the arena maps. Both overloads run the same templates in llai_ranking.cpp.
+    int32_t term_frequency      (const std::string_view & text, const std::span<const TokenRange> & tokenRanges, PmrTokenWeightMap & frequencies, TokenWeightLimits & limits);
+    int32_t weight_terms
+        ( const PmrTokenWeightMap & term_freq_map
+        , const PmrTokenWeightMap & inverse_doc_freq_map
+        , PmrTokenWeightMap & weighted_terms
+        );
+    double  cosine_similarity
+        ( const PmrTokenWeightMap & tf_idf_1
+        , const PmrTokenWeightMap & tf_idf_2
+        , double epsilon = 1e-6
+        );
+} // namespace
+
+#endif // LLAI_PMR_H
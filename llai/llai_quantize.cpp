@@ -0,0 +1,194 @@
+#include "llai_quantize.h"
+#include "llai_parallel.h"
+#include "llai_cpu.h"
+#include "llai_log.h"
+
+#include <algorithm>
+#include <cmath>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#   define LLAI_QUANTIZE_X86
+#   include <immintrin.h>
+#   ifdef _MSC_VER
+#       define LLAI_TARGET_AVX2
+#   else
+#       define LLAI_TARGET_AVX2    __attribute__((target("avx2")))
+#   endif
+#endif
+
+using std::bad_alloc;
+using std::span, std::vector;
+using std::min, std::max, std::fabs, std::lround;
+
+#define log_quantize_debug(fmt, ...)	do {} while(0) // log_debug("|quantize|" fmt, __VA_ARGS__) //
+
+static  constexpr uint32_t  SCAN_CHUNK_SIZE     = 4096;
+
+template<typename TWeight>
+static  float   dot_scalar      (const float * query, const llai::TermId * terms, const TWeight * weights, uint32_t count) {
+    float sum = 0;
+    for(uint32_t iEntry = 0; iEntry < count; ++iEntry)
+        sum += query[terms[iEntry]] * weights[iEntry];
+    return sum;
+}
+
+#ifdef LLAI_QUANTIZE_X86
+LLAI_TARGET_AVX2 static inline __m256i  widen_avx2  (const int8_t * weights)    { return _mm256_cvtepi8_epi32 (_mm_loadl_epi64((const __m128i *)weights)); }
+LLAI_TARGET_AVX2 static inline __m256i  widen_avx2  (const int16_t * weights)   { return _mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i *)weights)); }
+
+// Eight entries at a time: the query weights of their terms are gathered from the dense query and multiplied by the widened weights.
+template<typename TWeight>
+LLAI_TARGET_AVX2 static float   dot_avx2    (const float * query, const llai::TermId * terms, const TWeight * weights, uint32_t count) {
+    __m256      sums    = _mm256_setzero_ps();
+    uint32_t    iEntry  = 0;
+    for(; iEntry + 8 <= count; iEntry += 8) {
+        const __m256    gathered    = _mm256_i32gather_ps(query, _mm256_loadu_si256((const __m256i *)&terms[iEntry]), 4);
+        sums = _mm256_add_ps(sums, _mm256_mul_ps(gathered, _mm256_cvtepi32_ps(widen_avx2(&weights[iEntry]))));
+    }
+    __m128      half    = _mm_add_ps(_mm256_castps256_ps128(sums), _mm256_extractf128_ps(sums, 1));
+    half = _mm_add_ps(half, _mm_movehl_ps(half, half));
+    half = _mm_add_ss(half, _mm_movehdup_ps(half));
+    return _mm_cvtss_f32(half) + dot_scalar(query, &terms[iEntry], &weights[iEntry], count - iEntry);
+}
+#endif // LLAI_QUANTIZE_X86
+
+template<typename TWeight>
+static  int32_t quantize_rows   (const llai::SparseMatrixView & weighted, vector<TWeight> & weights, vector<float> & scales) {
+    static constexpr double limit = (1 << (sizeof(TWeight) * 8 - 1)) - 1;
+    weights.resize(weighted.Weights.size());
+    scales .resize(llai::sparse_rows(weighted));
+    for(uint32_t iRow = 0; iRow < scales.size(); ++iRow) {
+        const llai::SparseRow   row     = llai::sparse_row(weighted, iRow);
+        const double            norm    = llai::sparse_norm(row);
+        double                  maxAbs  = 0;
+        for(const double weight : row.Weights)
+            maxAbs = max(maxAbs, fabs(weight));
+        const double            step    = norm ? maxAbs / norm / limit : 0;
+        scales[iRow] = (float)step;
+        for(uint32_t iEntry = weighted.Offsets[iRow]; iEntry < weighted.Offsets[iRow + 1]; ++iEntry)
+            weights[iEntry] = step ? (TWeight)max(-limit, min(limit, (double)lround(weighted.Weights[iEntry] / norm / step))) : 0;
+    }
+    return 0;
+}
+
+int32_t llai::quantize_matrix   (const SparseMatrixView & weighted, QUANTIZATION format, QuantizedMatrix & quantized) {
+    quantized = {};
+    quantized.Format    = format;
+    quantized.Rows      = weighted;
+    try {
+        for(const TermId term : weighted.Terms)
+            quantized.TermCount = max(quantized.TermCount, term + 1);
+        if(QUANTIZATION_INT16 == format)
+            quantize_rows(weighted, quantized.Weights16, quantized.Scales);
+        else
+            quantize_rows(weighted, quantized.Weights8, quantized.Scales);
+    }
+    catch (const bad_alloc & e) {
+        log_error("exception message:'%s'", e.what());
+        return -1;
+    }
+    log_quantize_debug("Quantized %u rows into %llu bytes.", (uint32_t)quantized.Scales.size(), (unsigned long long)quantized_bytes(quantized));
+    return 0;
+}
+int32_t llai::quantize_matrix   (const SparseMatrix & weighted, QUANTIZATION format, QuantizedMatrix & quantized) {
+    return quantize_matrix(matrix_view(weighted), format, quantized);
+}
+size_t  llai::quantized_bytes   (const QuantizedMatrix & quantized) {
+    return quantized.Weights8.size() * sizeof(int8_t) + quantized.Weights16.size() * sizeof(int16_t) + quantized.Scales.size() * sizeof(float);
+}
+double  llai::quantized_row_bytes   (const QuantizedMatrix & quantized) {
+    const size_t    rows    = quantized.Scales.size();
+    return rows ? (quantized.Rows.Terms.size() * sizeof(TermId) + quantized.Rows.Offsets.size() * sizeof(uint32_t) + quantized_bytes(quantized)) / (double)rows : 0;
+}
+double  llai::row_bytes         (const SparseMatrixView & weighted) {
+    const size_t    rows    = sparse_rows(weighted);
+    return rows ? (weighted.Terms.size() * (sizeof(TermId) + sizeof(double)) + weighted.Offsets.size() * sizeof(uint32_t)) / (double)rows : 0;
+}
+
+int32_t llai::scan_top_k
+    ( const QuantizedMatrix & quantized
+    , const SparseRow & query
+    , uint32_t count
+    , vector<ScoredDoc> & results
+    , uint32_t threadCount
+    ) {
+    results.clear();
+    const double                queryNorm   = sparse_norm(query);
+    if(0 == count || 0 == queryNorm)
+        return 0;
+    threadCount = thread_count(threadCount);
+    const uint32_t              rowCount    = (uint32_t)quantized.Scales.size();
+    // Kept by the calling thread between queries, so that a query allocates nothing once they have grown to the largest term
+    // count. The workers read dense through the reference, not their own copies.
+    thread_local vector<float>              t_dense;
+    thread_local vector<vector<ScoredDoc>>  t_heaps;
+    vector<float>               & dense     = t_dense;  // Normalized query weight of every term. The gathers read it at the ids of the rows.
+    vector<vector<ScoredDoc>>   & heaps     = t_heaps;
+    try {
+        if(dense.size() < quantized.TermCount)
+            dense.resize(quantized.TermCount, 0.0f);
+        heaps.resize(threadCount);
+        for(vector<ScoredDoc> & heap : heaps)
+            heap.clear();
+    }
+    catch (const bad_alloc & e) {
+        log_error("exception message:'%s'", e.what());
+        return -1;
+    }
+    for(uint32_t iTerm = 0; iTerm < query.Terms.size(); ++iTerm)
+        if(query.Terms[iTerm] < quantized.TermCount)
+            dense[query.Terms[iTerm]] = float(query.Weights[iTerm] / queryNorm);
+#ifdef LLAI_QUANTIZE_X86
+    const bool                  avx2        = cpu_has_avx2();
+#endif
+    auto                        scan        = [&](const auto & weights, uint32_t begin, uint32_t end, vector<ScoredDoc> & heap) {
+        for(uint32_t iRow = begin; iRow < end; ++iRow) {
+            const uint32_t  offset  = quantized.Rows.Offsets[iRow];
+            const uint32_t  entries = quantized.Rows.Offsets[iRow + 1] - offset;
+#ifdef LLAI_QUANTIZE_X86
+            const float     dot     = avx2 ? dot_avx2(dense.data(), &quantized.Rows.Terms[offset], &weights[offset], entries) : dot_scalar(dense.data(), &quantized.Rows.Terms[offset], &weights[offset], entries);
+#else
+            const float     dot     = dot_scalar(dense.data(), &quantized.Rows.Terms[offset], &weights[offset], entries);
+#endif
+            const double    score   = (double)dot * quantized.Scales[iRow];
+            if(score > 0)
+                push_top_k(heap, count, {iRow, score});
+        }
+    };
+    const int32_t result = parallel_for(rowCount, threadCount, SCAN_CHUNK_SIZE, [&](uint32_t begin, uint32_t end, uint32_t iThread) {
+        if(QUANTIZATION_INT16 == quantized.Format)
+            scan(quantized.Weights16, begin, end, heaps[iThread]);
+        else
+            scan(quantized.Weights8, begin, end, heaps[iThread]);
+        return 0;
+    });
+    for(const TermId term : query.Terms)   // Back to all zeros for the next query.
+        if(term < quantized.TermCount)
+            dense[term] = 0;
+    if(0 > result)
+        return -1;
+    for(const vector<ScoredDoc> & heap : heaps)
+        for(const ScoredDoc & scored : heap)
+            push_top_k(results, count, scored);
+    return sort_top_k(results);
+}
+int32_t llai::query_top_k
+    ( const QuantizedMatrix & quantized
+    , const SparseRow & query
+    , uint32_t k
+    , uint32_t candidateCount
+    , vector<ScoredDoc> & results
+    , uint32_t threadCount
+    , double epsilon
+    ) {
+    results.clear();
+    vector<ScoredDoc>   candidates;
+    if(0 > scan_top_k(quantized, query, max(k, candidateCount), candidates, threadCount))
+        return -1;
+    for(const ScoredDoc & candidate : candidates) {
+        const double score = cosine_similarity(query, sparse_row(quantized.Rows, candidate.Doc), epsilon);
+        if(score > 0)
+            push_top_k(results, k, {candidate.Doc, score});
+    }
+    return sort_top_k(results);
+}
@@ -0,0 +1,55 @@
+#include "llai_index.h"
+
+#ifndef LLAI_QUANTIZE_H
+#define LLAI_QUANTIZE_H
+
+namespace llai
+{
+    enum QUANTIZATION : uint8_t
+        { QUANTIZATION_INT8
+        , QUANTIZATION_INT16
+        };
+
+    // Rows of a weighted matrix scaled to unit length and stored as signed integers, each row with its own step so that its largest
+    // |weight| uses the full range. Weights take 1 or 2 bytes instead of 8, plus one float per row. The term ids and row offsets are
+    // not copied: Rows views the matrix the weights were quantized from, which must outlive the quantized matrix and is what
+    // query_top_k re-ranks with.
+    struct QuantizedMatrix {
+        QUANTIZATION                Format      = QUANTIZATION_INT8;
+        uint32_t                    TermCount   = 0;        // One past the highest term id
+        SparseMatrixView            Rows;
+        std::vector<int8_t>         Weights8;   // Only the one matching Format is filled.
+        std::vector<int16_t>        Weights16;
+        std::vector<float>          Scales;     // Per row: the weight of one step
+    };
+
+    int32_t     quantize_matrix (const SparseMatrixView & weighted, QUANTIZATION format, QuantizedMatrix & quantized);
+    int32_t     quantize_matrix (const SparseMatrix & weighted, QUANTIZATION format, QuantizedMatrix & quantized);
+    size_t      quantized_bytes (const QuantizedMatrix & quantized);   // Memory the quantized matrix adds to its source: weights and scales
+    // Average bytes per row read by the scan: term ids, quantized weights, offsets and scales. Compare with row_bytes of the source.
+    double      quantized_row_bytes (const QuantizedMatrix & quantized);
+    double      row_bytes       (const SparseMatrixView & weighted);    // Average bytes per row of term ids, double weights and offsets
+    // Approximate cosine of the query with every row, computed from the quantized weights, keeping the count best as a best-first
+    // list. Rows are scanned on threadCount threads with AVX2 gathers where the CPU has them. The scan reads every row, so short
+    // queries are better served by the inverted index; it pays off on long queries, such as whole documents.
+    int32_t     scan_top_k
+        ( const QuantizedMatrix & quantized
+        , const SparseRow & query
+        , uint32_t count
+        , std::vector<ScoredDoc> & results
+        , uint32_t threadCount
+        );
+    // Takes the candidateCount best rows of scan_top_k and scores them again with cosine_similarity against the exact weights of
+    // Rows. Returns the k best of those with their exact scores, or fewer if fewer score above 0.
+    int32_t     query_top_k
+        ( const QuantizedMatrix & quantized
+        , const SparseRow & query
+        , uint32_t k
+        , uint32_t candidateCount
+        , std::vector<ScoredDoc> & results
+        , uint32_t threadCount
+        , double epsilon = 1e-6
+        );
+} // namespace
+
+#endif // LLAI_QUANTIZE_H
@@ -1,23 +1,17 @@
 #include "llai_ranking.h"
+#include "llai_pmr.h"
 #include "llai_log.h"
+#include "llai_metrics.h"
 
 #include <unordered_set>
-#include <cctype>
+#include <cmath>
 
 using std::bad_alloc;
 using std::span, std::string_view, std::vector, std::unordered_map, std::unordered_set;
-using std::min, std::max, std::size, std::isspace;
+using std::min, std::max, std::size;
 
 #define log_rank_debug(fmt, ...)	do {} while(0) // log_debug("|ranking|" fmt, __VA_ARGS__) //
 
-#define log_token_debug(fmt, ...)	log_debug("|token|" fmt, __VA_ARGS__) //
-
-static bool is_terminator       (const string_view & text, const string_view & terminator) {
-	if(text.size() < terminator.size()) 
-        return false;
-    return terminator.size() && terminator == text.substr(0, terminator.size());
-}
-
 int32_t llai::inverse_document_frequency(const span<vector<string_view>>& documents, TokenWeightMap & idf_scores, TokenWeightMap & document_occurrences) {
     for (const auto & doc : documents) {
         unordered_set<string_view> unique_terms;
@@ -33,10 +27,12 @@ int32_t llai::inverse_document_frequency(const span<vector<string_view>>& docume
         idf_scores[term] = log(total_documents / (1.0 + count));
     return (int32_t)idf_scores.size();
 }
-int32_t llai::weight_terms
-    ( const TokenWeightMap & term_freq_map
-    , const TokenWeightMap & inverse_doc_freq_map
-    , TokenWeightMap & weighted_terms
+// The TokenWeightMap and PmrTokenWeightMap overloads share these, so both kinds of maps end up with the same values.
+template<typename TMap>
+static  int32_t map_weight_terms
+    ( const TMap & term_freq_map
+    , const TMap & inverse_doc_freq_map
+    , TMap & weighted_terms
     ) {
     for (const auto & [term, tf_value] : term_freq_map) {
         auto it = inverse_doc_freq_map.find(term);
@@ -49,9 +45,10 @@ int32_t llai::weight_terms
     }
     return (int32_t)weighted_terms.size();
 }
-double llai::cosine_similarity
-    ( const TokenWeightMap & tf_idf_1
-    , const TokenWeightMap & tf_idf_2
+template<typename TMap>
+static  double  map_cosine_similarity
+    ( const TMap & tf_idf_1
+    , const TMap & tf_idf_2
     , double epsilon
     ) {
     double dot = 0, norm1 = 0, norm2 = 0;
@@ -65,19 +62,8 @@ double llai::cosine_similarity
         norm2 += v * v;
     return dot / (sqrt(norm1) * sqrt(norm2) + epsilon);
 }
-int32_t llai::token_views(const string_view & document, const span<const TokenRange> & tokenRanges, span<string_view> views) {
-    for(int iToken = 0; iToken < size(tokenRanges); ++iToken) {
-        const auto & tokenRange = tokenRanges[iToken];
-        views[iToken] = document.substr(tokenRange.Offset, tokenRange.Size);       // Prepare docs as vectors of tokens (string_views)
-    }
-    return 0;
-}
-int32_t llai::term_frequency    (const span<const string_view> & documents, const span<vector<TokenRange>> tokenRanges, span<TokenWeightMap> frequencies, span<TokenWeightLimits> limits) {
-    for(int iDoc = 0; iDoc < size(documents); ++iDoc)
-        llai::term_frequency(documents[iDoc], tokenRanges[iDoc], frequencies[iDoc], limits[iDoc]);    // Get term frequencies
-    return 0;
-}
-int32_t llai::term_frequency    (const string_view & text, const span<const TokenRange> & tokenRanges, TokenWeightMap & frequency_map, TokenWeightLimits & frequency_limits) {
+template<typename TMap>
+static  int32_t map_term_frequency  (const string_view & text, const span<const llai::TokenRange> & tokenRanges, TMap & frequency_map, llai::TokenWeightLimits & frequency_limits) {
     frequency_limits = {};
     for (auto tokenRange : tokenRanges) 
         frequency_map[text.substr(tokenRange.Offset, tokenRange.Size)] += 1.0f;
@@ -95,6 +81,25 @@ int32_t llai::term_frequency    (const string_view & text, const span<const Toke
         );
     return (int32_t)tokenRanges.size();
 }
+
+int32_t llai::weight_terms      (const TokenWeightMap & term_freq_map, const TokenWeightMap & inverse_doc_freq_map, TokenWeightMap & weighted_terms)              { return map_weight_terms(term_freq_map, inverse_doc_freq_map, weighted_terms); }
+int32_t llai::weight_terms      (const PmrTokenWeightMap & term_freq_map, const PmrTokenWeightMap & inverse_doc_freq_map, PmrTokenWeightMap & weighted_terms)   { return map_weight_terms(term_freq_map, inverse_doc_freq_map, weighted_terms); }
+double  llai::cosine_similarity (const TokenWeightMap & tf_idf_1, const TokenWeightMap & tf_idf_2, double epsilon)          { return map_cosine_similarity(tf_idf_1, tf_idf_2, epsilon); }
+double  llai::cosine_similarity (const PmrTokenWeightMap & tf_idf_1, const PmrTokenWeightMap & tf_idf_2, double epsilon)    { return map_cosine_similarity(tf_idf_1, tf_idf_2, epsilon); }
+int32_t llai::term_frequency    (const string_view & text, const span<const TokenRange> & tokenRanges, TokenWeightMap & frequency_map, TokenWeightLimits & frequency_limits)       { return map_term_frequency(text, tokenRanges, frequency_map, frequency_limits); }
+int32_t llai::term_frequency    (const string_view & text, const span<const TokenRange> & tokenRanges, PmrTokenWeightMap & frequency_map, TokenWeightLimits & frequency_limits)    { return map_term_frequency(text, tokenRanges, frequency_map, frequency_limits); }
+int32_t llai::token_views(const string_view & document, const span<const TokenRange> & tokenRanges, span<string_view> views) {
+    for(int iToken = 0; iToken < size(tokenRanges); ++iToken) {
+        const auto & tokenRange = tokenRanges[iToken];
+        views[iToken] = document.substr(tokenRange.Offset, tokenRange.Size);       // Prepare docs as vectors of tokens (string_views)
+    }
+    return 0;
+}
+int32_t llai::term_frequency    (const span<const string_view> & documents, const span<vector<TokenRange>> tokenRanges, span<TokenWeightMap> frequencies, span<TokenWeightLimits> limits) {
+    for(int iDoc = 0; iDoc < size(documents); ++iDoc)
+        llai::term_frequency(documents[iDoc], tokenRanges[iDoc], frequencies[iDoc], limits[iDoc]);    // Get term frequencies
+    return 0;
+}
 int32_t llai::term_frequency    (const span<const string_view> & documents, const span<vector<TokenRange>> tokenRanges, span<vector<string_view>> tokenViews, span<TokenWeightMap> frequencies, span<TokenWeightLimits> limits) {
     for(int iDoc = 0; iDoc < size(documents); ++iDoc) {
         tokenViews[iDoc].resize(tokenRanges[iDoc].size());
@@ -154,43 +159,44 @@ int32_t llai::tokenize          (const span<const string_view> & documents, span
     return (int32_t)documents.size();
 }
 
-static inline bool is_skippable(char c) { return isspace(c) || c < 'A' || c > 'z'; } 
-
-int32_t llai::tokenize          (const string_view & text, vector<TokenRange> & tokenRanges, const string_view & terminator) {
-    uint32_t start = 0;
-    while(start < text.size()) {
-        while(start < text.size() && is_skippable(text[start]) && not is_terminator(text.substr(start), terminator))
-            ++start;
-        uint32_t end = start;
-		while(end < text.size() && not is_skippable(text[end]) && not is_terminator(text.substr(end), terminator))
-            ++end;
-        if (start < end) {
-            try { 
-                tokenRanges.push_back({start, end - start}); 
-				log_token_debug("Token: '%.*s' at [%u, %u]", (int)(end - start), &text[start], start, end);
-            }
-            catch (const bad_alloc & e) {
-				log_error("exception message:'%s'", e.what());
-                return -1;
+// Reuses one token buffer for every document and counts straight into the output maps, which are then weighted in place once the IDF is
+// known. No per-document scratch maps or token views are kept around.
+int32_t llai::load_docs(const span<const string_view> & docs, llai::TokenWeightMap & idf_scores, span<llai::TokenWeightMap> weighted) {
+    vector<llai::TokenRange>                tokenRanges;
+    llai::TokenWeightMap                    doc_occurrences;
+    for(uint32_t iDoc = 0; iDoc < size(docs); ++iDoc) {
+        const auto & document = docs[iDoc];
+        tokenRanges.clear();
+        {
+            metrics_time(tokenizeTimer, METRIC_STAGE_TOKENIZE);
+            if(0 > llai::tokenize(document, tokenRanges)) {   // Tokenize documents
+                log_error("Failed to tokenize document at %u: '%.*s'.", iDoc, (int)document.size(), document.data());
+                return -1 - (int32_t)iDoc;
             }
         }
-        start = end;
+        metrics_time(frequencyTimer, METRIC_STAGE_TERM_FREQUENCY);
+        auto & frequencies = weighted[iDoc];
+        frequencies.clear();
+        for(const auto tokenRange : tokenRanges)    // Get term frequencies
+            frequencies[document.substr(tokenRange.Offset, tokenRange.Size)] += 1.0f;
+        for(auto & [term, count] : frequencies) {
+            count /= tokenRanges.size();
+            doc_occurrences[term] += 1;
+        }
+        metrics_count(METRIC_COUNTER_DOCUMENTS, 1);
+        metrics_count(METRIC_COUNTER_TOKENS, tokenRanges.size());
+        metrics_count(METRIC_COUNTER_TERMS, frequencies.size());
+        metrics_count(METRIC_COUNTER_BYTES, document.size());
     }
-	return start; // Return the position after the last token
-}
-
-int32_t llai::load_docs(const span<const string_view> & docs, llai::TokenWeightMap & idf_scores, span<llai::TokenWeightMap> weighted) {
-    vector<vector<llai::TokenRange>>        tokenRanges;        tokenRanges     .resize(size(docs));
-    llai::tokenize(docs, tokenRanges);    // Tokenize documents
-
-    vector<llai::TokenWeightMap >           term_frequencies;   term_frequencies.resize(tokenRanges.size());
-    vector<llai::TokenWeightLimits>         freq_limits;        freq_limits     .resize(tokenRanges.size());
-    vector<vector<string_view>>             token_views;        token_views     .resize(tokenRanges.size());
-    llai::term_frequency(docs, tokenRanges, token_views, term_frequencies, freq_limits);    // Get term frequencies
-
-    llai::TokenWeightMap                    doc_occurrences;
-    llai::inverse_document_frequency(token_views, idf_scores, doc_occurrences); // Calculate IDF
-    for(int iDoc = 0; iDoc < size(docs); ++iDoc)     
-        llai::weight_terms(term_frequencies[iDoc], idf_scores, weighted[iDoc]); // Weight terms: TF * IDF
+    {
+        metrics_time(idfTimer, METRIC_STAGE_IDF);
+        const double total_documents = (double)size(docs);
+        for(const auto & [term, count] : doc_occurrences)  // Calculate IDF
+            idf_scores[term] = log(total_documents / (1.0 + count));
+    }
+    metrics_time(weightingTimer, METRIC_STAGE_WEIGHTING);
+    for(auto & frequencies : weighted.first(size(docs)))
+        for(auto & [term, tf_value] : frequencies)  // Weight terms: TF * IDF
+            tf_value *= idf_scores[term];
     return 0;
 }
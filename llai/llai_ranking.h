@@ -14,11 +14,15 @@ namespace llai
 
     struct TokenRange { uint32_t Offset, Size; };
     struct TokenWeightLimits { TokenWeightPair Min, Max; };
+
+    enum class TokenizerIsa : uint8_t { Scalar, Sse2, Avx2 };
 	
     int32_t term_frequency              (const std::string_view & text, const std::span<const TokenRange> & tokenRanges, TokenWeightMap & frequencies, TokenWeightLimits & limits);
     int32_t term_frequency              (const std::string_view & text, const std::span<const TokenRange> & tokenRanges, std::span<std::string_view> tokenViews, TokenWeightMap & frequencies, TokenWeightLimits & limits);
     int32_t term_frequency              (const std::span<const std::string_view> & tokenViews, TokenWeightMap & frequencies, TokenWeightLimits & limits);
     int32_t tokenize                    (const std::string_view & text, std::vector<TokenRange> & tokenRanges, const std::string_view & terminator = ""); // Returns the position after the last token
+    int32_t tokenize                    (TokenizerIsa isa, const std::string_view & text, std::vector<TokenRange> & tokenRanges, const std::string_view & terminator = ""); // Forces an implementation. All of them produce the same ranges.
+    TokenizerIsa tokenizer_isa          (); // Widest implementation supported by the running CPU. Used by tokenize().
     int32_t token_views                 (const std::string_view & document, const std::span<const TokenRange> & tokenRanges, std::span<std::string_view> views);
     int32_t inverse_document_frequency  (const std::span<std::vector<std::string_view>> & documents, TokenWeightMap & idfScores, TokenWeightMap & occurrences);
     int32_t weight_terms
@@ -35,6 +39,8 @@ namespace llai
     int32_t tokenize                    (const std::span<const std::string_view> & documents, std::span<std::vector<TokenRange>> tokenRanges, const std::string_view & terminator = "");
     int32_t term_frequency              (const std::span<const std::string_view> & documents, const std::span<std::vector<TokenRange>> tokenRanges, std::span<TokenWeightMap> frequencies, std::span<TokenWeightLimits> limits);
     int32_t term_frequency              (const std::span<const std::string_view> & documents, const std::span<std::vector<TokenRange>> tokenRanges, const std::span<std::vector<std::string_view>> tokenViews, std::span<TokenWeightMap> frequencies, std::span<TokenWeightLimits> limits);
+    // weighted[i] is cleared and then counted into in place, so whatever the maps held before is dropped rather than merged with the
+    // new weights. idf_scores keeps the entries of terms missing from documents.
     int32_t load_docs                   (const std::span<const std::string_view> & documents, TokenWeightMap & idf_scores, std::span<TokenWeightMap> weighted);
 } // namespace 
 
@@ -0,0 +1,847 @@
+#include "llai_server.h"
+#include "llai_batch.h"
+#include "llai_mapped.h"
+#include "llai_normalize.h"
+#include "llai_parallel.h"
+#include "llai_log.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <list>
+#include <mutex>
+#include <thread>
+
+#ifdef _WIN32
+#   define WIN32_LEAN_AND_MEAN
+#   define NOMINMAX
+#   include <winsock2.h>
+#   include <ws2tcpip.h>
+#   pragma comment(lib, "ws2_32.lib")
+#else
+#   include <arpa/inet.h>
+#   include <cerrno>
+#   include <netinet/in.h>
+#   include <netinet/tcp.h>
+#   include <poll.h>
+#   include <sys/socket.h>
+#   include <sys/un.h>
+#   include <unistd.h>
+#endif
+
+using std::bad_alloc;
+using std::span, std::string, std::string_view, std::vector;
+using std::min, std::max, std::memcpy, std::strtoul, std::strtod;
+using std::chrono::steady_clock;
+
+#define log_server_debug(fmt, ...)	do {} while(0) // log_debug("|server|" fmt, __VA_ARGS__) //
+
+static  constexpr uint32_t  MAX_REQUEST_SIZE    = 1 << 16;
+static  constexpr uint32_t  LATENCY_WINDOW      = 1 << 16;
+static  constexpr int       POLL_INTERVAL_MS    = 50;   // How often blocked threads look at the stop flag.
+
+#ifdef _WIN32
+typedef SOCKET  socket_t;
+static  constexpr socket_t  NO_SOCKET           = INVALID_SOCKET;
+static  void    close_socket    (socket_t socket) { closesocket(socket); }
+static  int32_t socket_startup  () {
+    static const int result = [] { WSADATA data; return WSAStartup(MAKEWORD(2, 2), &data); }();
+    if(result)
+        log_error("WSAStartup failed with %i.", result);
+    return result ? -1 : 0;
+}
+#else
+typedef int     socket_t;
+static  constexpr socket_t  NO_SOCKET           = -1;
+static  void    close_socket    (socket_t socket) { close(socket); }
+static  int32_t socket_startup  () { return 0; }
+#endif
+
+// 1 when the socket has data or was closed by the peer, 0 on timeout.
+static  int32_t wait_readable   (socket_t socket, int timeoutMs) {
+#ifdef _WIN32
+    WSAPOLLFD   entry   = {socket, POLLRDNORM, 0};
+    const int   result  = WSAPoll(&entry, 1, timeoutMs);
+#else
+    pollfd      entry   = {socket, POLLIN, 0};
+    int         result;
+    do result = poll(&entry, 1, timeoutMs);
+    while(result < 0 && EINTR == errno);
+#endif
+    return (result < 0) ? -1 : (result > 0) ? 1 : 0;
+}
+static  int64_t recv_some       (socket_t socket, char * buffer, uint32_t size) {
+#ifdef _WIN32
+    return recv(socket, buffer, (int)size, 0);
+#else
+    ssize_t bytes;
+    do bytes = recv(socket, buffer, size, 0);
+    while(bytes < 0 && EINTR == errno);
+    return bytes;
+#endif
+}
+static  int32_t send_all        (socket_t socket, const string_view & data) {
+#if defined(_WIN32)
+    static constexpr int    flags   = 0;
+#elif defined(MSG_NOSIGNAL)
+    static constexpr int    flags   = MSG_NOSIGNAL;  // A client hanging up must not kill the server with SIGPIPE.
+#else
+    static constexpr int    flags   = 0;
+#endif
+    for(size_t sent = 0; sent < data.size(); ) {
+#ifdef _WIN32
+        const int64_t bytes = send(socket, &data[sent], (int)min<size_t>(data.size() - sent, INT32_MAX), flags);
+#else
+        const int64_t bytes = send(socket, &data[sent], data.size() - sent, flags);
+        if(bytes < 0 && EINTR == errno)
+            continue;
+#endif
+        if(bytes <= 0)
+            return -1;
+        sent += (size_t)bytes;
+    }
+    return 0;
+}
+static  void    set_no_delay    (socket_t socket) {     // Requests and answers are single small writes that must not wait for Nagle.
+    const int   enable  = 1;
+    setsockopt(socket, IPPROTO_TCP, TCP_NODELAY, (const char *)&enable, sizeof(enable));
+}
+
+static  socket_t    open_socket (const string & unixPath, uint16_t port, bool listening, uint16_t * boundPort) {
+    if(0 > socket_startup())
+        return NO_SOCKET;
+    sockaddr_storage    address     = {};
+    socklen_t           size        = 0;
+    if(unixPath.size()) {
+#ifdef _WIN32
+        log_error("Unix domain sockets are not supported on this platform: '%s'.", unixPath.c_str());
+        return NO_SOCKET;
+#else
+        sockaddr_un &       local       = (sockaddr_un &)address;
+        if(unixPath.size() >= sizeof(local.sun_path)) {
+            log_error("Socket path too long: '%s'.", unixPath.c_str());
+            return NO_SOCKET;
+        }
+        local.sun_family = AF_UNIX;
+        memcpy(local.sun_path, unixPath.c_str(), unixPath.size() + 1);
+        size = (socklen_t)sizeof(local);
+        if(listening)
+            unlink(unixPath.c_str());   // Left behind by a server that didn't stop cleanly
+#endif
+    }
+    else {
+        sockaddr_in &       inet        = (sockaddr_in &)address;
+        inet.sin_family         = AF_INET;
+        inet.sin_port           = htons(port);
+        inet.sin_addr.s_addr    = htonl(INADDR_LOOPBACK);
+        size = (socklen_t)sizeof(inet);
+    }
+    const socket_t      result      = socket(address.ss_family, SOCK_STREAM, 0);
+    if(NO_SOCKET == result) {
+        log_error("Failed to create a socket for '%s' port %u.", unixPath.c_str(), port);
+        return NO_SOCKET;
+    }
+    if(listening) {
+        const int   reuse   = 1;
+        if(unixPath.empty())
+            setsockopt(result, SOL_SOCKET, SO_REUSEADDR, (const char *)&reuse, sizeof(reuse));
+        if(bind(result, (const sockaddr *)&address, size) || listen(result, SOMAXCONN)) {
+            log_error("Failed to listen on '%s' port %u.", unixPath.c_str(), port);
+            close_socket(result);
+            return NO_SOCKET;
+        }
+        if(boundPort && unixPath.empty()) {
+            sockaddr_in bound       = {};
+            socklen_t   boundSize   = sizeof(bound);
+            getsockname(result, (sockaddr *)&bound, &boundSize);
+            *boundPort = ntohs(bound.sin_port);
+        }
+    }
+    else {
+        if(connect(result, (const sockaddr *)&address, size)) {
+            log_error("Failed to connect to '%s' port %u.", unixPath.c_str(), port);
+            close_socket(result);
+            return NO_SOCKET;
+        }
+        if(unixPath.empty())
+            set_no_delay(result);
+    }
+    return result;
+}
+
+// Takes the next '\n'-terminated line out of buffer, reading from the socket as needed. Returns 1 with a line, 0 when the peer
+// closed the connection or stop was raised, and -1 on errors or lines over MAX_REQUEST_SIZE.
+static  int32_t read_line       (socket_t socket, string & buffer, string & line, const std::atomic<bool> * stop) {
+    for(;;) {
+        const size_t end = buffer.find('\n');
+        if(string::npos != end) {
+            line.assign(buffer, 0, end);
+            buffer.erase(0, end + 1);
+            if(line.size() && '\r' == line.back())
+                line.pop_back();
+            return 1;
+        }
+        if(buffer.size() > MAX_REQUEST_SIZE)
+            return -1;
+        if(stop) {
+            const int32_t readable = wait_readable(socket, POLL_INTERVAL_MS);
+            if(stop->load())
+                return 0;
+            if(0 >= readable) {
+                if(0 > readable)
+                    return -1;
+                continue;
+            }
+        }
+        char            chunk   [4096];
+        const int64_t   bytes   = recv_some(socket, chunk, sizeof(chunk));
+        if(bytes <= 0)
+            return (int32_t)max<int64_t>(bytes, -1);
+        buffer.append(chunk, (size_t)bytes);
+    }
+}
+
+static  string_view next_field  (string_view & text) {  // Splits off the text up to the next space.
+    const size_t    end     = text.find(' ');
+    const string_view field = text.substr(0, end);
+    text = (string_view::npos == end) ? string_view{} : text.substr(end + 1);
+    return field;
+}
+
+static  double      percentile_us   (vector<float> & latencies, double percent) {
+    if(latencies.empty())
+        return 0;
+    const size_t    rank    = min((size_t)(percent / 100 * latencies.size()), latencies.size() - 1);
+    std::nth_element(latencies.begin(), latencies.begin() + rank, latencies.end());
+    return latencies[rank];
+}
+
+llai::QueryWeighter llai::query_weighter    (const TermDictionary & dictionary, const span<const double> & idf_scores, uint8_t normalization) {
+    return [&dictionary, idf_scores, normalization](const string_view & query, SparseVector & weighted) {
+        vector<TokenRange>  tokenRanges;
+        SparseVector        frequencies;
+        if(normalization) {
+            NormalizedTokens    normalized;
+            if(0 > tokenize_utf8(query, tokenRanges) || 0 > term_frequency(query, tokenRanges, normalization, normalized, dictionary, frequencies))
+                return -1;
+        }
+        else if(0 > tokenize(query, tokenRanges) || 0 > term_frequency(query, tokenRanges, dictionary, frequencies))
+            return -1;
+        return weight_terms(sparse_row(frequencies), idf_scores, weighted);
+    };
+}
+llai::QueryWeighter llai::query_weighter    (const MappedIndex & mapped, uint8_t normalization) {
+    return [&mapped, normalization](const string_view & query, SparseVector & weighted) {
+        vector<TokenRange>  tokenRanges;
+        SparseVector        frequencies;
+        if(normalization) {
+            NormalizedTokens    normalized;
+            if(0 > tokenize_utf8(query, tokenRanges) || 0 > normalize_tokens(query, tokenRanges, normalization, normalized))
+                return -1;
+            const string_view   terms       = normalized.Text;
+            try {
+                for(const TokenRange & termRange : normalized.Ranges) {
+                    const int32_t       term        = find_term(mapped, terms.substr(termRange.Offset, termRange.Size));
+                    if(term >= 0)
+                        frequencies.Terms.push_back((TermId)term);
+                }
+                count_terms(frequencies, tokenRanges.size());
+            }
+            catch (const bad_alloc & e) {
+                log_error("exception message:'%s'", e.what());
+                return -1;
+            }
+        }
+        else if(0 > tokenize(query, tokenRanges) || 0 > term_frequency(query, tokenRanges, mapped, frequencies))
+            return -1;
+        return weight_terms(sparse_row(frequencies), mapped.Idf, weighted);
+    };
+}
+
+namespace
+{
+    // A cache miss waiting for a worker. Owned by its connection thread, which waits on its own condition variable so that a batch
+    // only wakes the connections it answered.
+    struct PendingQuery {
+        llai::SparseVector          Weighted;
+        uint64_t                    Hash;
+        uint32_t                    K;
+        int32_t                     Status;
+        vector<llai::ScoredDoc>     Results;
+        std::mutex                  Mutex;      // Guards Done.
+        std::condition_variable     Answered;
+        bool                        Done;
+    };
+
+    struct CacheEntry {
+        uint64_t                    Hash;
+        uint32_t                    K;
+        llai::SparseVector          Query;
+        vector<llai::ScoredDoc>     Results;
+    };
+
+    // Least recently used entries are at the back. Entries are found by hash and compared in full, and a new entry replaces an older
+    // one with the same hash.
+    struct QueryCache {
+        uint32_t                                                Capacity    = 0;
+        std::list<CacheEntry>                                   Entries;
+        std::unordered_map<uint64_t, std::list<CacheEntry>::iterator>  Index;
+        std::mutex                                              Mutex;
+    };
+} // namespace
+
+struct llai::ServerState {
+    ServerConfig                Config;
+    InvertedIndexView           Index;
+    QueryWeighter               Weigh;
+    socket_t                    Listener        = NO_SOCKET;
+    std::atomic<bool>           Stopping        = false;
+    std::thread                 Acceptor;
+    vector<std::thread>         Workers;
+
+    std::mutex                  Mutex;          // Guards everything below.
+    std::condition_variable     QueueReady;
+    std::condition_variable     Closed;         // Raised when a connection ends.
+    std::deque<PendingQuery *>  Queue;
+    uint32_t                    Busy            = 0;    // Requests taken by workers and not answered yet
+    uint32_t                    OpenConnections = 0;
+    uint64_t                    Requests        = 0;
+    uint64_t                    CacheHits       = 0;
+    uint64_t                    Batches         = 0;
+    uint64_t                    Connections     = 0;
+    vector<float>               Latencies;      // Ring of the last LATENCY_WINDOW request latencies, in microseconds.
+
+    QueryCache                  Cache;
+};
+
+static  uint64_t    query_hash      (const llai::SparseVector & query, uint32_t k) {
+    uint64_t        hash    = 0xcbf29ce484222325ULL ^ k;
+    for(uint32_t iTerm = 0; iTerm < query.Terms.size(); ++iTerm) {
+        uint64_t        weight;
+        memcpy(&weight, &query.Weights[iTerm], sizeof(weight));
+        hash = (hash ^ query.Terms[iTerm]) * 0x100000001b3ULL;
+        hash = (hash ^ weight) * 0x100000001b3ULL;
+    }
+    return hash;
+}
+static  bool        cache_find      (QueryCache & cache, uint64_t hash, uint32_t k, const llai::SparseVector & query, vector<llai::ScoredDoc> & results) {
+    std::lock_guard lock    (cache.Mutex);
+    const auto      found   = cache.Index.find(hash);
+    if(found == cache.Index.end())
+        return false;
+    const CacheEntry & entry = *found->second;
+    if(entry.K != k || entry.Query.Terms != query.Terms || entry.Query.Weights != query.Weights)
+        return false;
+    cache.Entries.splice(cache.Entries.begin(), cache.Entries, found->second);
+    results = entry.Results;
+    return true;
+}
+static  void        cache_insert    (QueryCache & cache, uint64_t hash, uint32_t k, const llai::SparseVector & query, const vector<llai::ScoredDoc> & results) {
+    if(0 == cache.Capacity)
+        return;
+    std::lock_guard lock    (cache.Mutex);
+    const auto      found   = cache.Index.find(hash);
+    if(found != cache.Index.end()) {
+        cache.Entries.erase(found->second);
+        cache.Index.erase(found);
+    }
+    else if(cache.Entries.size() >= cache.Capacity) {
+        cache.Index.erase(cache.Entries.back().Hash);
+        cache.Entries.pop_back();
+    }
+    cache.Entries.push_front({hash, k, query, results});
+    cache.Index[hash] = cache.Entries.begin();
+}
+
+namespace
+{
+    struct WorkerScratch {
+        vector<PendingQuery *>              Batch;
+        llai::SparseMatrix                  Queries;
+        vector<vector<llai::ScoredDoc>>     Results;
+    };
+} // namespace
+
+static  void        finish_query    (PendingQuery & query) {
+    std::lock_guard lock    (query.Mutex);
+    query.Done = true;
+    query.Answered.notify_one();    // Under the lock: the connection can't move on and destroy the query before this returns.
+}
+
+// Cache hits never get here: connections answer them before queueing.
+static  int32_t     answer_batch    (llai::ServerState & state, WorkerScratch & scratch) {
+    const uint32_t      count       = (uint32_t)scratch.Batch.size();
+    uint32_t            maxK        = 0;
+    scratch.Queries.Offsets .assign(1, 0);
+    scratch.Queries.Terms   .clear();
+    scratch.Queries.Weights .clear();
+    for(PendingQuery * query : scratch.Batch) {
+        llai::append_row(scratch.Queries, llai::sparse_row(query->Weighted));
+        maxK = max(maxK, query->K);
+    }
+    // The best k of a longer list are the top-k list for k.
+    const int32_t       result      = (scratch.Queries.Offsets.size() == count + 1) ? llai::query_top_k(state.Index, scratch.Queries, maxK, scratch.Results, 1) : -1;
+    for(uint32_t iQuery = 0; iQuery < count; ++iQuery) {
+        PendingQuery &  query   = *scratch.Batch[iQuery];
+        query.Status = result;
+        if(0 <= result) {
+            query.Results.assign(scratch.Results[iQuery].begin(), scratch.Results[iQuery].begin() + min<size_t>(query.K, scratch.Results[iQuery].size()));
+            cache_insert(state.Cache, query.Hash, query.K, query.Weighted, query.Results);
+        }
+    }
+    {
+        std::lock_guard lock    (state.Mutex);
+        state.Busy -= count;
+        ++state.Batches;
+    }
+    for(PendingQuery * query : scratch.Batch)
+        finish_query(*query);
+    log_server_debug("Answered %u queries.", count);
+    return 0;
+}
+
+static  void        worker_loop     (llai::ServerState & state) {
+    WorkerScratch       scratch;
+    for(;;) {
+        scratch.Batch.clear();
+        {
+            std::unique_lock    lock    (state.Mutex);
+            state.QueueReady.wait(lock, [&]() { return state.Stopping.load() || state.Queue.size(); });
+            if(state.Queue.empty())
+                return;     // Stopping, with every request answered.
+            // A connection has one request at a time, so once every open connection is waiting, no more requests can come.
+            auto                full    = [&]() { return state.Stopping.load() || state.Queue.size() >= state.Config.MaxBatch || state.Queue.size() + state.Busy >= state.OpenConnections; };
+            if(state.Config.BatchWindowUs)
+                state.QueueReady.wait_for(lock, std::chrono::microseconds(state.Config.BatchWindowUs), full);
+            while(state.Queue.size() && scratch.Batch.size() < state.Config.MaxBatch) {
+                scratch.Batch.push_back(state.Queue.front());
+                state.Queue.pop_front();
+            }
+            state.Busy += (uint32_t)scratch.Batch.size();
+        }
+        if(scratch.Batch.size()) {  // Another worker may have emptied the queue during the wait.
+            try {
+                answer_batch(state, scratch);
+            }
+            catch (const bad_alloc & e) {
+                log_error("exception message:'%s'", e.what());
+                {
+                    std::lock_guard lock    (state.Mutex);
+                    state.Busy -= (uint32_t)scratch.Batch.size();
+                }
+                for(PendingQuery * query : scratch.Batch) {
+                    query->Status = -1;
+                    finish_query(*query);
+                }
+            }
+        }
+    }
+}
+
+static  int32_t     format_answer   (const PendingQuery & query, string & answer) {
+    char                number      [64];
+    if(0 > query.Status) {
+        answer = "error failed to answer the query\n";
+        return 0;
+    }
+    snprintf(number, sizeof(number), "%u", (uint32_t)query.Results.size());
+    answer = number;
+    for(const llai::ScoredDoc & result : query.Results) {
+        snprintf(number, sizeof(number), " %u %.17g", result.Doc, result.Score);  // Scores read back bit for bit.
+        answer += number;
+    }
+    answer += '\n';
+    return 0;
+}
+static  int32_t     format_stats    (const llai::ServerStats & stats, string & answer) {
+    char                text        [512];
+    snprintf(text, sizeof(text), "requests %llu cache_hits %llu batches %llu connections %llu documents %llu p50_us %.1f p99_us %.1f max_us %.1f\n"
+        , (unsigned long long)stats.Requests, (unsigned long long)stats.CacheHits, (unsigned long long)stats.Batches, (unsigned long long)stats.Connections
+        , (unsigned long long)stats.Documents, stats.P50Us, stats.P99Us, stats.MaxUs);
+    answer = text;
+    return 0;
+}
+
+static  void        connection_loop (llai::ServerState & state, socket_t socket) {
+    string              buffer;
+    string              line;
+    string              answer;
+    PendingQuery        query;
+    try {
+        for(;;) {
+            if(1 != read_line(socket, buffer, line, &state.Stopping))
+                break;
+            const auto      start           = steady_clock::now();
+            if(line == "STATS") {
+                llai::ServerStats   stats       = {};
+                llai::QueryServer   server      = {0, &state};
+                llai::server_stats(server, stats);
+                format_stats(stats, answer);
+                if(0 > send_all(socket, answer))
+                    break;
+                continue;
+            }
+            string_view     text            = line;
+            const string_view kField        = next_field(text);
+            char *          end             = 0;
+            const string    kText           (kField);
+            const uint32_t  k               = (uint32_t)strtoul(kText.c_str(), &end, 10);
+            if(kField.empty() || *end || 0 == k || k > state.Config.MaxK) {
+                if(0 > send_all(socket, "error expected \"<k> <query>\" with k from 1 to the server's limit\n"))
+                    break;
+                continue;
+            }
+            // Weighed and looked up here, so that repeated queries skip the queue and the batch window.
+            bool            hit             = false;
+            query.K         = k;
+            query.Status    = state.Weigh(text, query.Weighted);
+            query.Results.clear();
+            if(0 <= query.Status && query.Weighted.Terms.size()) {     // Without a known term, no document scores above 0.
+                query.Hash  = query_hash(query.Weighted, k);
+                hit         = cache_find(state.Cache, query.Hash, k, query.Weighted, query.Results);
+                if(not hit) {
+                    query.Done = false;
+                    {
+                        std::lock_guard     lock    (state.Mutex);
+                        if(state.Stopping.load())
+                            break;  // The workers may be gone already.
+                        state.Queue.push_back(&query);
+                    }
+                    state.QueueReady.notify_one();
+                    std::unique_lock    lock    (query.Mutex);
+                    query.Answered.wait(lock, [&]() { return query.Done; });
+                }
+            }
+            format_answer(query, answer);
+            const float     latency         = std::chrono::duration<float, std::micro>(steady_clock::now() - start).count();
+            {   // Counted before the answer is sent, so a client that reads its answer and asks for STATS sees its request.
+                std::lock_guard     lock    (state.Mutex);
+                if(state.Latencies.size() < LATENCY_WINDOW)
+                    state.Latencies.push_back(latency);
+                else
+                    state.Latencies[state.Requests % LATENCY_WINDOW] = latency;
+                ++state.Requests;
+                state.CacheHits += hit;
+            }
+            const int32_t   sent            = send_all(socket, answer);
+            if(0 > sent)
+                break;
+        }
+    }
+    catch (const bad_alloc & e) {
+        log_error("exception message:'%s'", e.what());
+    }
+    close_socket(socket);
+    std::lock_guard     lock    (state.Mutex);
+    --state.OpenConnections;
+    state.QueueReady.notify_all();  // A worker waiting for this connection to send a request stops waiting.
+    state.Closed.notify_all();      // Nothing of state is touched once the lock is released.
+}
+
+static  void        accept_loop     (llai::ServerState & state) {
+    while(not state.Stopping.load()) {
+        const int32_t   readable    = wait_readable(state.Listener, POLL_INTERVAL_MS);
+        if(0 > readable) {
+            log_error("%s", "Failed to wait for connections. The server stops accepting.");
+            break;
+        }
+        if(0 == readable)
+            continue;
+        const socket_t  socket      = accept(state.Listener, 0, 0);
+        if(NO_SOCKET == socket)
+            continue;
+        if(state.Config.UnixPath.empty())
+            set_no_delay(socket);
+        try {
+            std::lock_guard     lock    (state.Mutex);
+            std::thread(connection_loop, std::ref(state), socket).detach();
+            ++state.OpenConnections;
+            ++state.Connections;
+        }
+        catch (const std::exception & e) {  // std::system_error when no thread can be created
+            log_error("exception message:'%s'", e.what());
+            close_socket(socket);
+        }
+    }
+}
+
+int32_t llai::server_start      (QueryServer & server, const ServerConfig & config, const InvertedIndexView & index, const QueryWeighter & weigh) {
+    if(server.State) {
+        log_error("%s", "The server is already running.");
+        return -1;
+    }
+    if(0 == config.MaxBatch || 0 == config.MaxK) {
+        log_error("Invalid server configuration: batches of %u, k up to %u.", config.MaxBatch, config.MaxK);
+        return -1;
+    }
+    ServerState     * state     = 0;
+    try {
+        state = new ServerState;
+        state->Config           = config;
+        state->Index            = index;
+        state->Weigh            = weigh;
+        state->Cache.Capacity   = config.CacheEntries;
+        state->Listener         = open_socket(config.UnixPath, config.Port, true, &server.Port);
+        if(NO_SOCKET == state->Listener) {
+            delete state;
+            return -1;
+        }
+        if(config.UnixPath.size())
+            server.Port = 0;
+        server.State = state;
+        for(uint32_t iWorker = 0, count = thread_count(config.Workers); iWorker < count; ++iWorker)
+            state->Workers.emplace_back(worker_loop, std::ref(*state));
+        state->Acceptor = std::thread(accept_loop, std::ref(*state));
+    }
+    catch (const std::exception & e) {
+        log_error("exception message:'%s'", e.what());
+        if(server.State)
+            server_stop(server);
+        else
+            delete state;
+        return -1;
+    }
+    log_server_debug("Listening on '%s' port %u.", config.UnixPath.c_str(), server.Port);
+    return 0;
+}
+int32_t llai::server_stop       (QueryServer & server) {
+    ServerState     * state     = server.State;
+    if(0 == state)
+        return 0;
+    {
+        std::lock_guard     lock    (state->Mutex);
+        state->Stopping = true;
+    }
+    state->QueueReady.notify_all();
+    if(state->Acceptor.joinable())
+        state->Acceptor.join();
+    for(std::thread & worker : state->Workers)
+        worker.join();
+    {
+        std::unique_lock    lock    (state->Mutex);
+        state->Closed.wait(lock, [&]() { return 0 == state->OpenConnections; });
+    }
+    close_socket(state->Listener);
+#ifndef _WIN32
+    if(state->Config.UnixPath.size())
+        unlink(state->Config.UnixPath.c_str());
+#endif
+    delete state;
+    server.State = 0;
+    return 0;
+}
+int32_t llai::server_stats      (const QueryServer & server, ServerStats & stats) {
+    stats = {};
+    if(0 == server.State)
+        return -1;
+    ServerState     & state     = *server.State;
+    vector<float>   latencies;
+    try {
+        std::lock_guard     lock    (state.Mutex);
+        stats.Requests      = state.Requests;
+        stats.CacheHits     = state.CacheHits;
+        stats.Batches       = state.Batches;
+        stats.Connections   = state.Connections;
+        stats.Documents     = state.Index.DocNorms.size();
+        latencies           = state.Latencies;
+    }
+    catch (const bad_alloc & e) {
+        log_error("exception message:'%s'", e.what());
+        return -1;
+    }
+    stats.P50Us = percentile_us(latencies, 50);
+    stats.P99Us = percentile_us(latencies, 99);
+    stats.MaxUs = latencies.empty() ? 0 : *std::max_element(latencies.begin(), latencies.end());
+    return 0;
+}
+
+int32_t llai::client_connect    (QueryClient & client, const string & unixPath, uint16_t port) {
+    client_close(client);
+    const socket_t  socket      = open_socket(unixPath, port, false, 0);
+    if(NO_SOCKET == socket)
+        return -1;
+    client.Socket = (intptr_t)socket;
+    return 0;
+}
+static  int32_t     client_request  (llai::QueryClient & client, const string_view & request, string & answer) {
+    if(-1 == client.Socket) {
+        log_error("%s", "The client is not connected.");
+        return -1;
+    }
+    if(0 > send_all((socket_t)client.Socket, request) || 1 != read_line((socket_t)client.Socket, client.Buffer, answer, 0)) {
+        log_error("%s", "The server closed the connection.");
+        return -1;
+    }
+    return 0;
+}
+static  bool        single_line     (const string_view & query) {
+    if(string_view::npos == query.find_first_of("\r\n"))
+        return true;
+    log_error("%s", "Queries can't span lines.");
+    return false;
+}
+static  int32_t     append_request  (const string_view & query, uint32_t k, string & request) {
+    if(not single_line(query))
+        return -1;
+    request.append(std::to_string(k)).append(" ").append(query).append("\n");
+    return 0;
+}
+static  int32_t     parse_answer    (const string & answer, vector<llai::ScoredDoc> & results) {
+    results.clear();
+    if(0 == answer.compare(0, 6, "error ")) {
+        log_error("Server error: '%s'.", answer.c_str());
+        return -1;
+    }
+    const char *    cursor  = answer.c_str();
+    char *          end     = 0;
+    const uint32_t  count   = (uint32_t)strtoul(cursor, &end, 10);
+    for(uint32_t iResult = 0; iResult < count && end != cursor; ++iResult) {
+        llai::ScoredDoc result  = {};
+        cursor          = end;
+        result.Doc      = (uint32_t)strtoul(cursor, &end, 10);
+        cursor          = end;
+        result.Score    = strtod(cursor, &end);
+        results.push_back(result);
+    }
+    if(results.size() != count || end == cursor) {
+        log_error("Malformed answer: '%s'.", answer.c_str());
+        return -1;
+    }
+    return (int32_t)results.size();
+}
+int32_t llai::client_query      (QueryClient & client, const string_view & query, uint32_t k, vector<ScoredDoc> & results) {
+    results.clear();
+    string          request;
+    string          answer;
+    try {
+        if(0 > append_request(query, k, request) || 0 > client_request(client, request, answer))
+            return -1;
+        return parse_answer(answer, results);
+    }
+    catch (const bad_alloc & e) {
+        log_error("exception message:'%s'", e.what());
+        return -1;
+    }
+}
+int32_t llai::client_query      (QueryClient & client, const span<const string_view> & queries, uint32_t k, vector<vector<ScoredDoc>> & results) {
+    // Requests sent ahead of the answer being read. The answers they wait behind must fit in the socket buffers, or the server would
+    // block sending them while this blocks sending requests.
+    static  constexpr uint32_t  PIPELINE_DEPTH  = 32;
+    if(-1 == client.Socket) {
+        log_error("%s", "The client is not connected.");
+        return -1;
+    }
+    if(not std::all_of(queries.begin(), queries.end(), single_line))
+        return -1;  // Before sending anything, so that no answer is left unread.
+    string          request;
+    string          answer;
+    try {
+        results.resize(size(queries));
+        for(uint32_t iQuery = 0, sent = 0; iQuery < size(queries); ++iQuery) {
+            request.clear();
+            for(; sent < size(queries) && sent < iQuery + PIPELINE_DEPTH; ++sent)
+                if(0 > append_request(queries[sent], k, request))
+                    return -1;
+            if((request.size() && 0 > send_all((socket_t)client.Socket, request)) || 1 != read_line((socket_t)client.Socket, client.Buffer, answer, 0)) {
+                log_error("%s", "The server closed the connection.");
+                return -1;
+            }
+            if(0 > parse_answer(answer, results[iQuery]))
+                return -1;
+        }
+    }
+    catch (const bad_alloc & e) {
+        log_error("exception message:'%s'", e.what());
+        return -1;
+    }
+    return (int32_t)size(queries);
+}
+int32_t llai::client_stats      (QueryClient & client, ServerStats & stats) {
+    stats = {};
+    string          answer;
+    try {
+        if(0 > client_request(client, "STATS\n", answer))
+            return -1;
+    }
+    catch (const bad_alloc & e) {
+        log_error("exception message:'%s'", e.what());
+        return -1;
+    }
+    for(string_view text = answer; text.size(); ) {
+        const string_view   name    = next_field(text);
+        const string        value   (next_field(text));
+        if(name == "requests"   ) stats.Requests    = std::strtoull(value.c_str(), 0, 10);
+        else if(name == "cache_hits" ) stats.CacheHits   = std::strtoull(value.c_str(), 0, 10);
+        else if(name == "batches"    ) stats.Batches     = std::strtoull(value.c_str(), 0, 10);
+        else if(name == "connections") stats.Connections = std::strtoull(value.c_str(), 0, 10);
+        else if(name == "documents"  ) stats.Documents   = std::strtoull(value.c_str(), 0, 10);
+        else if(name == "p50_us"     ) stats.P50Us       = strtod(value.c_str(), 0);
+        else if(name == "p99_us"     ) stats.P99Us       = strtod(value.c_str(), 0);
+        else if(name == "max_us"     ) stats.MaxUs       = strtod(value.c_str(), 0);
+    }
+    return 0;
+}
+int32_t llai::client_close      (QueryClient & client) {
+    if(-1 != client.Socket)
+        close_socket((socket_t)client.Socket);
+    client.Socket = -1;
+    client.Buffer.clear();
+    return 0;
+}
+
+int32_t llai::run_load          (const LoadConfig & config, const span<const string_view> & queries, LoadReport & report) {
+    report = {};
+    if(queries.empty() || 0 == config.Connections) {
+        log_error("Nothing to send: %u queries over %u connections.", (uint32_t)queries.size(), config.Connections);
+        return -1;
+    }
+    vector<vector<float>>   latencies   (config.Connections);
+    vector<uint64_t>        errors      (config.Connections);
+    vector<std::thread>     clients;
+    const auto              start       = steady_clock::now();
+    auto                    client_loop = [&](uint32_t iClient) {
+        QueryClient             client;
+        vector<ScoredDoc>       results;
+        if(0 > client_connect(client, config.UnixPath, config.Port)) {
+            for(uint32_t iRequest = iClient; iRequest < config.Requests; iRequest += config.Connections)
+                ++errors[iClient];
+            return;
+        }
+        for(uint32_t iRequest = iClient; iRequest < config.Requests; iRequest += config.Connections) {
+            const auto  sent    = steady_clock::now();
+            if(0 > client_query(client, queries[iRequest % queries.size()], config.K, results))
+                ++errors[iClient];
+            else
+                latencies[iClient].push_back(std::chrono::duration<float, std::micro>(steady_clock::now() - sent).count());
+        }
+        client_close(client);
+    };
+    try {
+        for(uint32_t iClient = 0; iClient < config.Connections; ++iClient)
+            clients.emplace_back(client_loop, iClient);
+    }
+    catch (const std::exception & e) {
+        log_error("exception message:'%s'", e.what());
+        for(std::thread & client : clients)
+            client.join();
+        return -1;
+    }
+    for(std::thread & client : clients)
+        client.join();
+    report.Seconds = std::chrono::duration<double>(steady_clock::now() - start).count();
+    vector<float>           merged;
+    for(uint32_t iClient = 0; iClient < config.Connections; ++iClient) {
+        merged.insert(merged.end(), latencies[iClient].begin(), latencies[iClient].end());
+        report.Errors += errors[iClient];
+    }
+    report.Requests = merged.size();
+    report.P50Us    = percentile_us(merged, 50);
+    report.P99Us    = percentile_us(merged, 99);
+    report.MaxUs    = merged.empty() ? 0 : *std::max_element(merged.begin(), merged.end());
+    return report.Errors ? -1 : 0;
+}
@@ -0,0 +1,93 @@
+#include "llai_index.h"
+
+#include <functional>
+#include <string>
+
+#ifndef LLAI_SERVER_H
+#define LLAI_SERVER_H
+
+namespace llai
+{
+    struct MappedIndex;
+    struct ServerState;
+
+    // Turns the text of a query into its tf-idf vector. Called from every connection thread at once, so it must not share scratch buffers.
+    typedef std::function<int32_t(const std::string_view & query, SparseVector & weighted)>    QueryWeighter;
+
+    QueryWeighter   query_weighter  (const TermDictionary & dictionary, const std::span<const double> & idf_scores, uint8_t normalization = 0); // NORMALIZE flags the documents were loaded with
+    QueryWeighter   query_weighter  (const MappedIndex & mapped, uint8_t normalization = 0);
+
+    struct ServerConfig {
+        std::string     UnixPath;               // Listens on this Unix domain socket when set, else on TCP Port of 127.0.0.1.
+        uint16_t        Port            = 0;    // 0 takes a free port, which server_start writes to QueryServer::Port.
+        uint32_t        Workers         = 0;    // 0 for one per hardware thread
+        uint32_t        MaxBatch        = 32;
+        uint32_t        BatchWindowUs   = 200;  // How long a worker holding fewer than MaxBatch requests waits for more.
+        uint32_t        CacheEntries    = 4096; // 0 disables the cache.
+        uint32_t        MaxK            = 1000;
+    };
+
+    // Counters since server_start. Percentiles are of the time from reading a request to having its answer ready to send, over the last
+    // 64k requests.
+    struct ServerStats {
+        uint64_t        Requests;
+        uint64_t        CacheHits;
+        uint64_t        Batches;        // Of cache misses. Hits are answered without a batch.
+        uint64_t        Connections;
+        uint64_t        Documents;      // Size of the served index
+        double          P50Us;
+        double          P99Us;
+        double          MaxUs;
+    };
+
+    // Serves top-k queries over a line protocol. A request is "<k> <query text>\n" and its answer "<count>[ <doc> <score>]...\n", or
+    // "error <message>\n". "STATS\n" answers with the ServerStats as "<name> <value>" pairs. Each connection gets a thread that reads,
+    // writes and weighs its requests, and answers repeated ones from an LRU cache keyed by k and the weighted query. A fixed pool of workers takes
+    // the other requests in batches of up to MaxBatch and scores them together with the batch query_top_k.
+    struct QueryServer {
+        uint16_t        Port            = 0;
+        ServerState     * State         = 0;
+    };
+
+    // index and weigh must stay valid until server_stop.
+    int32_t     server_start    (QueryServer & server, const ServerConfig & config, const InvertedIndexView & index, const QueryWeighter & weigh);
+    // Stops accepting, answers the requests already queued and closes every connection.
+    int32_t     server_stop     (QueryServer & server);
+    int32_t     server_stats    (const QueryServer & server, ServerStats & stats);
+
+    struct QueryClient {
+        intptr_t        Socket          = -1;
+        std::string     Buffer;
+    };
+
+    int32_t     client_connect  (QueryClient & client, const std::string & unixPath, uint16_t port);
+    int32_t     client_query    (QueryClient & client, const std::string_view & query, uint32_t k, std::vector<ScoredDoc> & results);
+    // Pipelined: sends requests ahead of their answers, which the server returns in order, so a batch costs about one round trip
+    // instead of one per query. results[i] is the answer to queries[i]. After a failure, answers may be left unread: reconnect.
+    int32_t     client_query    (QueryClient & client, const std::span<const std::string_view> & queries, uint32_t k, std::vector<std::vector<ScoredDoc>> & results);
+    int32_t     client_stats    (QueryClient & client, ServerStats & stats);
+    int32_t     client_close    (QueryClient & client);
+
+    struct LoadConfig {
+        std::string     UnixPath;
+        uint16_t        Port            = 0;
+        uint32_t        Connections     = 4;
+        uint32_t        Requests        = 10000;
+        uint32_t        K               = 10;
+    };
+
+    struct LoadReport {
+        uint64_t        Requests;
+        uint64_t        Errors;
+        double          Seconds;
+        double          P50Us;
+        double          P99Us;
+        double          MaxUs;
+    };
+
+    // Load generator: Connections clients send Requests queries between them, each waiting for an answer before sending the next.
+    // Request i is queries[i % queries.size()], so repeated queries exercise the cache. Latencies are measured by the clients.
+    int32_t     run_load        (const LoadConfig & config, const std::span<const std::string_view> & queries, LoadReport & report);
+} // namespace
+
+#endif // LLAI_SERVER_H
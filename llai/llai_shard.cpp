@@ -0,0 +1,396 @@
+#include "llai_shard.h"
+#include "llai_parallel.h"
+#include "llai_log.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+
+using std::bad_alloc;
+using std::span, std::string_view, std::string, std::vector, std::pair;
+using std::size, std::sort, std::max, std::memcpy;
+
+#define log_shard_debug(fmt, ...)	do {} while(0) // log_debug("|shard|" fmt, __VA_ARGS__) //
+
+// Statistics file: the header, then uint32_t[TermCount] document frequencies, uint32_t[TermCount] term lengths and the term bytes.
+struct StatisticsFileHeader {
+    uint32_t        Magic;
+    uint32_t        Version;
+    uint32_t        DocCount;
+    uint32_t        TermCount;
+    uint64_t        TermBytes;
+};
+
+static  constexpr uint32_t  STATISTICS_FILE_MAGIC   = 0x54534C4C;   // "LLST" when read on a little-endian machine.
+static  constexpr uint32_t  STATISTICS_FILE_VERSION = 1;
+
+int32_t llai::load_shard        (const span<const string_view> & docs, uint32_t firstDoc, IndexShard & shard, uint8_t flags) {
+    shard           = {};
+    shard.FirstDoc  = firstDoc;
+    const int32_t       result      = count_docs(docs, flags ? document_counter(flags, shard.Dictionary, shard.Arena) : document_counter(shard.Dictionary), shard.Frequencies);
+    if(0 > result) {
+        log_error("Failed to load document at %u.", firstDoc + uint32_t(-1 - result));
+        return result;
+    }
+    log_shard_debug("Loaded shard at %u: %u documents, %u terms.", firstDoc, (uint32_t)size(docs), (uint32_t)shard.Dictionary.Terms.size());
+    return (int32_t)sparse_rows(shard.Frequencies);
+}
+int32_t llai::shard_statistics  (const IndexShard & shard, ShardStatistics & statistics) {
+    vector<double>      idf_scores;     // Of the shard alone. Only the document frequencies are merged.
+    try {
+        statistics.DocCount = sparse_rows(shard.Frequencies);
+        statistics.Terms    = shard.Dictionary.Terms;
+        inverse_document_frequency(shard.Frequencies, (uint32_t)statistics.Terms.size(), idf_scores, statistics.DocFrequencies);
+    }
+    catch (const bad_alloc & e) {
+        log_error("exception message:'%s'", e.what());
+        return -1;
+    }
+    return (int32_t)statistics.Terms.size();
+}
+int32_t llai::merge_statistics  (const span<const ShardStatistics> & shards, GlobalStatistics & global) {
+    global = {};
+    uint64_t            docCount    = 0;
+    for(const ShardStatistics & shard : shards) {
+        if(shard.Terms.size() != shard.DocFrequencies.size()) {
+            log_error("Shard statistics with %u terms and %u document frequencies.", (uint32_t)shard.Terms.size(), (uint32_t)shard.DocFrequencies.size());
+            return -1;
+        }
+        docCount += shard.DocCount;
+        for(uint32_t iTerm = 0; iTerm < shard.Terms.size(); ++iTerm) {
+            const int32_t       id          = intern_term(global.Dictionary, global.Arena, shard.Terms[iTerm]);
+            if(0 > id)
+                return -1;
+            try {
+                if((uint32_t)id == global.DocFrequencies.size())
+                    global.DocFrequencies.push_back(0);
+            }
+            catch (const bad_alloc & e) {
+                log_error("exception message:'%s'", e.what());
+                return -1;
+            }
+            global.DocFrequencies[id] += shard.DocFrequencies[iTerm];
+        }
+    }
+    if(docCount > UINT32_MAX) {
+        log_error("Too many documents: %llu.", (unsigned long long)docCount);
+        return -1;
+    }
+    global.DocCount = (uint32_t)docCount;
+    try {
+        idf_from_document_frequencies(global.DocFrequencies, global.DocCount, global.IdfScores);
+    }
+    catch (const bad_alloc & e) {
+        log_error("exception message:'%s'", e.what());
+        return -1;
+    }
+    log_shard_debug("Merged %u shards: %u documents, %u terms.", (uint32_t)size(shards), global.DocCount, (uint32_t)global.IdfScores.size());
+    return (int32_t)global.IdfScores.size();
+}
+int32_t llai::finish_shard      (IndexShard & shard, const GlobalStatistics & global) {
+    vector<TermId>              globalIds;
+    vector<pair<TermId, double>>    row;
+    try {
+        globalIds.resize(shard.Dictionary.Terms.size());
+        shard.Weighted = {};
+        shard.Weighted.Offsets.reserve(shard.Frequencies.Offsets.size());
+        shard.Weighted.Terms  .reserve(shard.Frequencies.Terms.size());
+        shard.Weighted.Weights.reserve(shard.Frequencies.Weights.size());
+    }
+    catch (const bad_alloc & e) {
+        log_error("exception message:'%s'", e.what());
+        return -1;
+    }
+    for(uint32_t term = 0; term < globalIds.size(); ++term) {
+        const int32_t       id          = find_term(global.Dictionary, shard.Dictionary.Terms[term]);
+        if(0 > id || (uint32_t)id >= global.IdfScores.size()) {
+            log_error("Term '%.*s' is missing from the global statistics.", (int)shard.Dictionary.Terms[term].size(), shard.Dictionary.Terms[term].data());
+            return -1;
+        }
+        globalIds[term] = (TermId)id;
+    }
+    const uint32_t      docCount    = sparse_rows(shard.Frequencies);
+    try {
+        for(uint32_t iDoc = 0; iDoc < docCount; ++iDoc) {
+            const SparseRow     frequencies = sparse_row(shard.Frequencies, iDoc);
+            row.clear();
+            for(uint32_t iTerm = 0; iTerm < frequencies.Terms.size(); ++iTerm) {
+                const TermId        term        = globalIds[frequencies.Terms[iTerm]];
+                row.push_back({term, frequencies.Weights[iTerm] * global.IdfScores[term]});    // Weight terms: TF * IDF
+            }
+            sort(row.begin(), row.end());   // Global ids come in another order than local ones.
+            for(const auto & [term, weight] : row) {
+                shard.Weighted.Terms  .push_back(term);
+                shard.Weighted.Weights.push_back(weight);
+            }
+            shard.Weighted.Offsets.push_back((uint32_t)shard.Weighted.Terms.size());
+        }
+    }
+    catch (const bad_alloc & e) {
+        log_error("exception message:'%s'", e.what());
+        return -1;
+    }
+    shard.Frequencies   = {};
+    shard.Dictionary    = {};
+    shard.Arena         = {};
+    return (0 > build_index(shard.Weighted, (uint32_t)global.IdfScores.size(), shard.Index)) ? -1 : (int32_t)docCount;
+}
+int32_t llai::build_shards      (const span<const string_view> & docs, uint32_t shardCount, GlobalStatistics & global, vector<IndexShard> & shards, uint8_t flags) {
+    if(0 == shardCount) {
+        log_error("%s", "No shards to build.");
+        return -1;
+    }
+    vector<ShardStatistics> statistics;
+    try {
+        shards.clear();
+        shards.resize(shardCount);
+        statistics.resize(shardCount);
+    }
+    catch (const bad_alloc & e) {
+        log_error("exception message:'%s'", e.what());
+        return -1;
+    }
+    const uint64_t      docCount    = size(docs);
+    if(0 > parallel_for(shardCount, shardCount, 1, [&](uint32_t begin, uint32_t, uint32_t) {
+        const uint32_t      first       = uint32_t(docCount * begin / shardCount);
+        const uint32_t      end         = uint32_t(docCount * (begin + 1) / shardCount);
+        if(0 > load_shard(docs.subspan(first, end - first), first, shards[begin], flags))
+            return -1;
+        return shard_statistics(shards[begin], statistics[begin]);
+    }))
+        return -1;
+    if(0 > merge_statistics(statistics, global))
+        return -1;
+    statistics.clear();     // The term views point into the shard dictionaries, which finish_shard frees.
+    if(0 > parallel_for(shardCount, shardCount, 1, [&](uint32_t begin, uint32_t, uint32_t) { return finish_shard(shards[begin], global); }))
+        return -1;
+    return (int32_t)shardCount;
+}
+
+int32_t llai::save_statistics   (const char * path, const ShardStatistics & statistics) {
+    StatisticsFileHeader    header      = {STATISTICS_FILE_MAGIC, STATISTICS_FILE_VERSION, statistics.DocCount, (uint32_t)statistics.Terms.size(), 0};
+    vector<uint32_t>        lengths;
+    try {
+        lengths.reserve(statistics.Terms.size());
+        for(const string_view & term : statistics.Terms) {
+            lengths.push_back((uint32_t)term.size());
+            header.TermBytes += term.size();
+        }
+    }
+    catch (const bad_alloc & e) {
+        log_error("exception message:'%s'", e.what());
+        return -1;
+    }
+    if(statistics.DocFrequencies.size() != statistics.Terms.size()) {
+        log_error("Shard statistics with %u terms and %u document frequencies.", (uint32_t)statistics.Terms.size(), (uint32_t)statistics.DocFrequencies.size());
+        return -1;
+    }
+    FILE * file = 0;
+#ifdef _WIN32
+    fopen_s(&file, path, "wb");
+#else
+    file = fopen(path, "wb");
+#endif
+    if(0 == file) {
+        log_error("Failed to create statistics file '%s'.", path);
+        return -1;
+    }
+    const size_t            termCount   = statistics.Terms.size();
+    bool                    written     = 1 == fwrite(&header, sizeof(header), 1, file)
+        && (0 == termCount || (termCount == fwrite(statistics.DocFrequencies.data(), sizeof(uint32_t), termCount, file) && termCount == fwrite(lengths.data(), sizeof(uint32_t), termCount, file)));
+    for(uint32_t iTerm = 0; written && iTerm < termCount; ++iTerm)
+        written = statistics.Terms[iTerm].empty() || 1 == fwrite(statistics.Terms[iTerm].data(), statistics.Terms[iTerm].size(), 1, file);
+    written = (0 == fclose(file)) && written;
+    if(not written) {
+        log_error("Failed to write statistics file '%s'.", path);
+        return -1;
+    }
+    return 0;
+}
+int32_t llai::load_statistics   (const char * path, ShardStatistics & statistics, StringArena & arena) {
+    statistics = {};
+    std::ifstream           input       (path, std::ios::binary);
+    string                  data;
+    StatisticsFileHeader    header      = {};
+    try {
+        data.assign(std::istreambuf_iterator<char>(input), std::istreambuf_iterator<char>());
+    }
+    catch (const bad_alloc & e) {
+        log_error("exception message:'%s'", e.what());
+        return -1;
+    }
+    if(not input || data.size() < sizeof(header)) {
+        log_error("Failed to read statistics file '%s'.", path);
+        return -1;
+    }
+    memcpy(&header, data.data(), sizeof(header));
+    if(STATISTICS_FILE_MAGIC != header.Magic || STATISTICS_FILE_VERSION != header.Version
+     || data.size() != sizeof(header) + header.TermCount * 2ULL * sizeof(uint32_t) + header.TermBytes) {
+        log_error("'%s' is not a statistics file, or is truncated.", path);
+        return -1;
+    }
+    vector<uint32_t>        lengths;
+    try {
+        statistics.DocCount = header.DocCount;
+        statistics.DocFrequencies.resize(header.TermCount);
+        statistics.Terms.reserve(header.TermCount);
+        lengths.resize(header.TermCount);
+        if(header.TermCount) {
+            memcpy(statistics.DocFrequencies.data(), &data[sizeof(header)], header.TermCount * sizeof(uint32_t));
+            memcpy(lengths.data(), &data[sizeof(header) + header.TermCount * sizeof(uint32_t)], header.TermCount * sizeof(uint32_t));
+        }
+        uint64_t                offset      = sizeof(header) + header.TermCount * 2ULL * sizeof(uint32_t);
+        for(const uint32_t length : lengths) {
+            if(length > data.size() - offset) {
+                log_error("Statistics file '%s' has terms past its end.", path);
+                statistics = {};
+                return -1;
+            }
+            statistics.Terms.push_back(arena_copy(arena, string_view(data).substr(offset, length)));
+            offset += length;
+        }
+    }
+    catch (const bad_alloc & e) {
+        log_error("exception message:'%s'", e.what());
+        statistics = {};
+        return -1;
+    }
+    return (int32_t)statistics.Terms.size();
+}
+
+int32_t llai::merge_top_k       (const span<const vector<ScoredDoc>> & partial, const span<const uint32_t> & firstDocs, uint32_t k, vector<ScoredDoc> & results) {
+    results.clear();
+    if(size(partial) != size(firstDocs)) {
+        log_error("%u top-k lists for %u shards.", (uint32_t)size(partial), (uint32_t)size(firstDocs));
+        return -1;
+    }
+    try {
+        for(uint32_t iShard = 0; iShard < size(partial); ++iShard)
+            for(const ScoredDoc & scored : partial[iShard]) {
+                if(k == results.size() && scored.Score < results.front().Score)
+                    break;      // Lists are best-first, so the rest of this one can't make it either.
+                push_top_k(results, k, {firstDocs[iShard] + scored.Doc, scored.Score});
+            }
+    }
+    catch (const bad_alloc & e) {
+        log_error("exception message:'%s'", e.what());
+        return -1;
+    }
+    return sort_top_k(results);
+}
+
+static  bool    is_remote   (const llai::ShardEndpoint & shard) { return shard.UnixPath.size() || shard.Port; }
+
+int32_t llai::coordinator_stop  (ShardCoordinator & coordinator) {
+    for(vector<QueryClient> & clients : coordinator.Clients)
+        for(QueryClient & client : clients)
+            client_close(client);
+    coordinator = {};
+    return 0;
+}
+int32_t llai::coordinator_start (ShardCoordinator & coordinator, const span<const ShardEndpoint> & shards, const QueryWeighter & weigh, uint32_t lanes) {
+    coordinator_stop(coordinator);
+    try {
+        coordinator.Shards.assign(shards.begin(), shards.end());
+        coordinator.Clients.resize(size(shards));
+        coordinator.FirstDocs.resize(size(shards));
+        coordinator.Weigh = weigh;
+        coordinator.Lanes = max(1u, lanes);
+        for(uint32_t iShard = 0; iShard < size(shards); ++iShard)
+            if(is_remote(shards[iShard]))
+                coordinator.Clients[iShard].resize(coordinator.Lanes);
+    }
+    catch (const bad_alloc & e) {
+        log_error("exception message:'%s'", e.what());
+        return -1;
+    }
+    uint64_t            docCount    = 0;
+    for(uint32_t iShard = 0; iShard < size(shards); ++iShard) {
+        const ShardEndpoint &   shard       = shards[iShard];
+        uint64_t                shardDocs   = shard.Index.DocNorms.size();
+        if(is_remote(shard)) {
+            ServerStats             stats;
+            bool                    connected   = true;
+            for(QueryClient & client : coordinator.Clients[iShard])
+                connected = connected && 0 <= client_connect(client, shard.UnixPath, shard.Port);
+            if(not connected || 0 > client_stats(coordinator.Clients[iShard][0], stats)) {
+                log_error("Failed to reach shard %u.", iShard);
+                coordinator_stop(coordinator);
+                return -1;
+            }
+            shardDocs = stats.Documents;
+        }
+        else if(not weigh) {
+            log_error("Shard %u is local, which needs a query weighter.", iShard);
+            coordinator_stop(coordinator);
+            return -1;
+        }
+        coordinator.FirstDocs[iShard] = (uint32_t)docCount;
+        docCount += shardDocs;
+        if(docCount > UINT32_MAX) {
+            log_error("Too many documents: %llu.", (unsigned long long)docCount);
+            coordinator_stop(coordinator);
+            return -1;
+        }
+    }
+    coordinator.DocCount = (uint32_t)docCount;
+    log_shard_debug("Coordinating %u shards of %u documents over %u lanes each.", (uint32_t)size(shards), coordinator.DocCount, coordinator.Lanes);
+    return (int32_t)size(shards);
+}
+int32_t llai::coordinator_query (ShardCoordinator & coordinator, const span<const string_view> & queries, uint32_t k, vector<vector<ScoredDoc>> & results) {
+    const uint32_t                      shardCount  = (uint32_t)coordinator.Shards.size();
+    const uint32_t                      queryCount  = (uint32_t)size(queries);
+    vector<SparseVector>                weighted;
+    vector<vector<vector<ScoredDoc>>>   partial;    // Per query, per shard
+    try {
+        results.resize(queryCount);
+        partial.resize(queryCount, vector<vector<ScoredDoc>>(shardCount));
+        if(std::any_of(coordinator.Shards.begin(), coordinator.Shards.end(), [](const ShardEndpoint & shard) { return not is_remote(shard); }))
+            weighted.resize(queryCount);
+    }
+    catch (const bad_alloc & e) {
+        log_error("exception message:'%s'", e.what());
+        return -1;
+    }
+    if(weighted.size() && 0 > parallel_for(queryCount, 0, 64, [&](uint32_t begin, uint32_t end, uint32_t) {
+        for(uint32_t iQuery = begin; iQuery < end; ++iQuery)
+            if(0 > coordinator.Weigh(queries[iQuery], weighted[iQuery]))
+                return -1;
+        return 0;
+    }))
+        return -1;
+    const uint32_t                      lanes       = coordinator.Lanes;
+    if(0 > parallel_for(shardCount * lanes, shardCount * lanes, 1, [&](uint32_t task, uint32_t, uint32_t) {   // Scatter
+        const uint32_t          iShard      = task / lanes;
+        const uint32_t          iLane       = task % lanes;
+        const uint32_t          first       = uint32_t(uint64_t(queryCount) * iLane / lanes);
+        const uint32_t          end         = uint32_t(uint64_t(queryCount) * (iLane + 1) / lanes);
+        const ShardEndpoint &   shard       = coordinator.Shards[iShard];
+        if(is_remote(shard)) {
+            vector<vector<ScoredDoc>>   answers;
+            QueryClient &               client      = coordinator.Clients[iShard][iLane];
+            if(first < end && 0 > client_query(client, queries.subspan(first, end - first), k, answers)) {
+                log_error("Shard %u failed to answer queries %u to %u.", iShard, first, end - 1);
+                // Answers to the rest of the lane's requests may still be on their way, and would be read as those of the next batch.
+                if(0 > client_connect(client, shard.UnixPath, shard.Port))
+                    log_error("Failed to reconnect to shard %u.", iShard);
+                return -1;
+            }
+            for(uint32_t iQuery = first; iQuery < end; ++iQuery)
+                partial[iQuery][iShard] = std::move(answers[iQuery - first]);
+            return 0;
+        }
+        for(uint32_t iQuery = first; iQuery < end; ++iQuery)
+            if(0 > query_top_k(shard.Index, sparse_row(weighted[iQuery]), k, partial[iQuery][iShard])) {
+                log_error("Shard %u failed to answer '%.*s'.", iShard, (int)queries[iQuery].size(), queries[iQuery].data());
+                return -1;
+            }
+        return 0;
+    }))
+        return -1;
+    for(uint32_t iQuery = 0; iQuery < queryCount; ++iQuery)    // Gather
+        if(0 > merge_top_k(partial[iQuery], coordinator.FirstDocs, k, results[iQuery]))
+            return -1;
+    return (int32_t)queryCount;
+}
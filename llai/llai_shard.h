@@ -0,0 +1,101 @@
+#include "llai_server.h"
+#include "llai_normalize.h"
+
+#ifndef LLAI_SHARD_H
+#define LLAI_SHARD_H
+
+namespace llai
+{
+    // One shard of a corpus split into contiguous runs of documents. IDF needs the document frequencies of every shard, so load_shard
+    // only counts term frequencies under a dictionary of the shard's own, and finish_shard weights them once the global statistics
+    // are known.
+    struct IndexShard {
+        TermDictionary          Dictionary;         // Local term ids. The views point into the shard's documents, or into Arena when normalized.
+        StringArena             Arena;
+        SparseMatrix            Frequencies;        // Local term ids, emptied by finish_shard.
+        SparseMatrix            Weighted;           // Global term ids, filled by finish_shard.
+        InvertedIndex           Index;
+        uint32_t                FirstDoc    = 0;    // Global id of the shard's first document
+    };
+
+    // What a shard contributes to the document frequency exchange. Terms are in local id order, which is the order they were first seen.
+    struct ShardStatistics {
+        uint32_t                        DocCount    = 0;
+        std::vector<std::string_view>   Terms;
+        std::vector<uint32_t>           DocFrequencies;
+    };
+
+    // The merged statistics every shard weights its documents with. Merging shards in document order assigns the term ids a single
+    // load_docs over the whole corpus would, so shard weights and norms, and the scores of the merged top-k, match the unsharded ones
+    // bit for bit.
+    struct GlobalStatistics {
+        TermDictionary          Dictionary;         // Owns its terms through Arena.
+        StringArena             Arena;
+        std::vector<uint32_t>   DocFrequencies;
+        std::vector<double>     IdfScores;
+        uint32_t                DocCount    = 0;
+    };
+
+    // Counts the documents as load_docs does, with the normalized load_docs when flags are set. Every shard of a corpus takes the
+    // same flags, and so do its queries.
+    int32_t     load_shard          (const std::span<const std::string_view> & documents, uint32_t firstDoc, IndexShard & shard, uint8_t flags = NORMALIZE_NONE);
+    int32_t     shard_statistics    (const IndexShard & shard, ShardStatistics & statistics);
+    int32_t     merge_statistics    (const std::span<const ShardStatistics> & shards, GlobalStatistics & global);  // Shards in document order
+    // Moves the term frequencies to global ids, weights them with the global IDF and indexes them. Documents keep their local ids.
+    int32_t     finish_shard        (IndexShard & shard, const GlobalStatistics & global);
+    // The three steps above with the shards loaded and finished on parallel threads. The documents are split into shardCount runs of
+    // nearly equal length.
+    int32_t     build_shards
+        ( const std::span<const std::string_view> & documents
+        , uint32_t shardCount
+        , GlobalStatistics & global
+        , std::vector<IndexShard> & shards
+        , uint8_t flags = NORMALIZE_NONE
+        );
+
+    // Shards in separate processes exchange statistics through files: each writes its own and merges all of them, in document order.
+    int32_t     save_statistics     (const char * path, const ShardStatistics & statistics);
+    int32_t     load_statistics     (const char * path, ShardStatistics & statistics, StringArena & arena);    // Terms are copied into the arena.
+
+    // Merges the top-k lists of the shards, given best-first and in local document ids, into the global top-k.
+    int32_t     merge_top_k
+        ( const std::span<const std::vector<ScoredDoc>> & partial
+        , const std::span<const uint32_t> & firstDocs
+        , uint32_t k
+        , std::vector<ScoredDoc> & results
+        );
+
+    // A shard searched in this process through its index, or by a query server in another process when UnixPath or Port is set.
+    struct ShardEndpoint {
+        InvertedIndexView       Index;
+        std::string             UnixPath;
+        uint16_t                Port        = 0;
+    };
+
+    // Scatter-gather over shards listed in document order. Every shard returns its own top k, so the merged lists are exact.
+    struct ShardCoordinator {
+        std::vector<ShardEndpoint>              Shards;
+        std::vector<std::vector<QueryClient>>   Clients;        // Parallel to Shards. Lanes connections to each remote shard, none to local ones.
+        std::vector<uint32_t>                   FirstDocs;      // From the index sizes of local shards and the STATS of remote ones.
+        QueryWeighter                           Weigh;          // Weights queries for the local shards, with the global statistics.
+        uint32_t                                DocCount    = 0;
+        uint32_t                                Lanes       = 0;
+    };
+
+    // Each shard is searched over lanes connections, or threads for local shards. A server batches the requests of its open
+    // connections together, so more lanes fill its batches more.
+    int32_t     coordinator_start   (ShardCoordinator & coordinator, const std::span<const ShardEndpoint> & shards, const QueryWeighter & weigh, uint32_t lanes = 4);
+    int32_t     coordinator_stop    (ShardCoordinator & coordinator);
+    // Sends the batch of queries to every shard at once and merges the answers of each query. Every lane of a shard takes a contiguous
+    // share of the batch, which remote lanes pipeline over their connection. A remote lane that fails is reconnected before this returns,
+    // so no answer to a failed batch is read as part of the next one. A lane that can't reconnect stays closed and fails every later
+    // batch until coordinator_start is called again.
+    int32_t     coordinator_query
+        ( ShardCoordinator & coordinator
+        , const std::span<const std::string_view> & queries
+        , uint32_t k
+        , std::vector<std::vector<ScoredDoc>> & results
+        );
+} // namespace
+
+#endif // LLAI_SHARD_H
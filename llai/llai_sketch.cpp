@@ -0,0 +1,220 @@
+#include "llai_sketch.h"
+#include "llai_log.h"
+
+#include <algorithm>
+#include <bit>
+#include <cstring>
+
+using std::bad_alloc;
+using std::span, std::string_view, std::vector;
+using std::min, std::sort, std::unique, std::memcpy, std::popcount, std::rotl;
+
+#define log_sketch_debug(fmt, ...)	do {} while(0) // log_debug("|sketch|" fmt, __VA_ARGS__) //
+
+static  constexpr uint64_t  HASH_MULTIPLIER     = 0x9E3779B97F4A7C15ULL;
+
+static inline uint64_t  mix64           (uint64_t value) {
+    value ^= value >> 32;
+    value *= 0xD6E8FEB86659FD93ULL;
+    value ^= value >> 32;
+    value *= 0xD6E8FEB86659FD93ULL;
+    return value ^ (value >> 32);
+}
+
+uint64_t    llai::hash_bytes        (const string_view & bytes, uint64_t seed) {
+    uint64_t    hash    = seed ^ (bytes.size() * HASH_MULTIPLIER);
+    size_t      offset  = 0;
+    for(uint64_t word; offset + 8 <= bytes.size(); offset += 8) {
+        memcpy(&word, &bytes[offset], 8);
+        hash = (rotl(hash, 29) ^ mix64(word)) * HASH_MULTIPLIER;
+    }
+    uint64_t    tail    = 0;
+    if(offset < bytes.size())
+        memcpy(&tail, &bytes[offset], bytes.size() - offset);
+    return mix64(hash ^ tail);
+}
+
+int32_t     llai::minhash
+    ( const string_view & text
+    , const span<const TokenRange> & tokenRanges
+    , span<uint32_t> signature
+    , vector<uint64_t> & tokenHashes
+    , uint32_t shingleSize
+    ) {
+    const uint32_t  binCount    = (uint32_t)signature.size();
+    if(0 == binCount || 0 == shingleSize) {
+        log_error("Invalid MinHash parameters: %u bins, shingles of %u tokens.", binCount, shingleSize);
+        return -1;
+    }
+    std::fill(signature.begin(), signature.end(), UINT32_MAX);
+    try {
+        tokenHashes.clear();
+        for(const auto tokenRange : tokenRanges)
+            tokenHashes.push_back(hash_bytes(text.substr(tokenRange.Offset, tokenRange.Size)));
+    }
+    catch (const bad_alloc & e) {
+        log_error("exception message:'%s'", e.what());
+        return -1;
+    }
+    const uint32_t  tokenCount      = (uint32_t)tokenHashes.size();
+    const uint32_t  shingleCount    = (tokenCount > shingleSize) ? tokenCount - shingleSize + 1 : min(tokenCount, 1u);  // Short documents are one shingle.
+    for(uint32_t iShingle = 0; iShingle < shingleCount; ++iShingle) {
+        uint64_t        hash    = tokenHashes[iShingle];
+        for(uint32_t iToken = iShingle + 1; iToken < min(iShingle + shingleSize, tokenCount); ++iToken)
+            hash = mix64(hash * HASH_MULTIPLIER + tokenHashes[iToken]);
+        const uint32_t  bin     = (uint32_t)(((hash >> 32) * binCount) >> 32);
+        signature[bin] = min(signature[bin], (uint32_t)hash);
+    }
+    if(0 == shingleCount)
+        return 0;
+    // Walk left from a filled bin, so the nearest filled bin to the right of each empty one is at hand.
+    uint32_t        first       = 0;
+    while(UINT32_MAX == signature[first])
+        ++first;
+    uint32_t        borrowed    = signature[first];
+    uint32_t        distance    = 0;
+    for(uint32_t step = 1; step < binCount; ++step) {
+        const uint32_t  bin     = (first + binCount - step) % binCount;
+        if(UINT32_MAX != signature[bin]) {
+            borrowed = signature[bin];
+            distance = 0;
+        }
+        else
+            signature[bin] = (uint32_t)mix64(((uint64_t)++distance << 32) | borrowed);
+    }
+    return (int32_t)shingleCount;
+}
+double      llai::minhash_similarity(const span<const uint32_t> & signature1, const span<const uint32_t> & signature2) {
+    if(signature1.size() != signature2.size() || signature1.empty())
+        return 0;
+    uint32_t equal = 0;
+    for(uint32_t bin = 0; bin < signature1.size(); ++bin)
+        equal += signature1[bin] == signature2[bin];
+    return equal / (double)signature1.size();
+}
+int32_t     llai::minhash_bands     (const span<const uint32_t> & signature, uint32_t rowsPerBand, span<uint64_t> keys) {
+    const uint32_t  bandCount   = rowsPerBand ? (uint32_t)signature.size() / rowsPerBand : 0;
+    if(0 == bandCount || keys.size() < bandCount) {
+        log_error("Cannot split %u bins into %u keys of %u rows.", (uint32_t)signature.size(), (uint32_t)keys.size(), rowsPerBand);
+        return -1;
+    }
+    for(uint32_t band = 0; band < bandCount; ++band)
+        keys[band] = hash_bytes(string_view((const char *)&signature[band * rowsPerBand], rowsPerBand * sizeof(uint32_t)), band);
+    return (int32_t)bandCount;
+}
+
+uint64_t    llai::simhash           (const SparseRow & row) {
+    double          votes   [64]    = {};
+    for(uint32_t iTerm = 0; iTerm < row.Terms.size(); ++iTerm) {
+        const uint64_t  hash    = mix64(row.Terms[iTerm] * HASH_MULTIPLIER);
+        const double    weight  = row.Weights[iTerm];
+        for(uint32_t bit = 0; bit < 64; ++bit)
+            votes[bit] += ((hash >> bit) & 1) ? weight : -weight;
+    }
+    uint64_t        result          = 0;
+    for(uint32_t bit = 0; bit < 64; ++bit)
+        result |= uint64_t(votes[bit] > 0) << bit;
+    return result;
+}
+uint32_t    llai::simhash_distance  (uint64_t simhash1, uint64_t simhash2) { return (uint32_t)popcount(simhash1 ^ simhash2); }
+int32_t     llai::simhash_bands     (uint64_t simhash, span<uint64_t> keys) {
+    const uint32_t  bandCount   = (uint32_t)keys.size();
+    if(0 == bandCount || bandCount > 64) {
+        log_error("Cannot split a SimHash into %u blocks.", bandCount);
+        return -1;
+    }
+    for(uint32_t band = 0; band < bandCount; ++band) {
+        const uint32_t  begin   = band * 64 / bandCount;
+        const uint32_t  width   = (band + 1) * 64 / bandCount - begin;
+        keys[band] = (simhash >> begin) & ((width < 64) ? (1ULL << width) - 1 : UINT64_MAX);
+    }
+    return (int32_t)bandCount;
+}
+
+int32_t     llai::lsh_init          (LshIndex & index, uint32_t bandCount) {
+    if(0 == bandCount) {
+        log_error("%s", "An LSH index needs at least one band.");
+        return -1;
+    }
+    index = {};
+    index.BandCount = bandCount;
+    try {
+        index.Heads.resize(bandCount);
+    }
+    catch (const bad_alloc & e) {
+        log_error("exception message:'%s'", e.what());
+        return -1;
+    }
+    return 0;
+}
+int32_t     llai::lsh_insert        (LshIndex & index, const span<const uint64_t> & keys) {
+    if(keys.size() != index.BandCount) {
+        log_error("Got %u keys for an index of %u bands.", (uint32_t)keys.size(), index.BandCount);
+        return -1;
+    }
+    const uint32_t  row     = (uint32_t)(index.Next.size() / index.BandCount);
+    try {
+        for(uint32_t band = 0; band < index.BandCount; ++band) {
+            uint32_t & head = index.Heads[band].try_emplace(keys[band], 0).first->second;
+            index.Next.push_back(head);
+            head = row + 1;
+        }
+    }
+    catch (const bad_alloc & e) {
+        log_error("exception message:'%s'", e.what());
+        // Unlink the bands already linked. A key added for this row is left behind with 0, an empty chain.
+        for(uint32_t band = 0; row * index.BandCount + band < index.Next.size(); ++band)
+            index.Heads[band][keys[band]] = index.Next[row * index.BandCount + band];
+        index.Next.resize(row * index.BandCount);
+        return -1;
+    }
+    return (int32_t)row;
+}
+int32_t     llai::lsh_candidates    (const LshIndex & index, const span<const uint64_t> & keys, vector<uint32_t> & candidates) {
+    candidates.clear();
+    if(keys.size() != index.BandCount) {
+        log_error("Got %u keys for an index of %u bands.", (uint32_t)keys.size(), index.BandCount);
+        return -1;
+    }
+    try {
+        for(uint32_t band = 0; band < index.BandCount; ++band) {
+            const auto found = index.Heads[band].find(keys[band]);
+            if(found == index.Heads[band].end())
+                continue;
+            for(uint32_t next = found->second; next; next = index.Next[(next - 1) * index.BandCount + band])
+                candidates.push_back(next - 1);
+        }
+    }
+    catch (const bad_alloc & e) {
+        log_error("exception message:'%s'", e.what());
+        return -1;
+    }
+    sort(candidates.begin(), candidates.end());
+    candidates.erase(unique(candidates.begin(), candidates.end()), candidates.end());
+    log_sketch_debug("%u candidates among %u rows.", (uint32_t)candidates.size(), (uint32_t)(index.Next.size() / index.BandCount));
+    return (int32_t)candidates.size();
+}
+int32_t     llai::near_duplicates
+    ( const LshIndex & index
+    , const span<const uint64_t> & keys
+    , const SparseMatrixView & weighted
+    , const SparseRow & row
+    , double threshold
+    , vector<ScoredDoc> & results
+    , double epsilon
+    ) {
+    results.clear();
+    vector<uint32_t>    candidates;
+    if(0 > lsh_candidates(index, keys, candidates))
+        return -1;
+    const uint32_t      rowCount    = sparse_rows(weighted);
+    for(const uint32_t candidate : candidates) {
+        if(candidate >= rowCount)
+            break;
+        const double score = cosine_similarity(row, sparse_row(weighted, candidate), epsilon);
+        if(score >= threshold)
+            results.push_back({candidate, score});
+    }
+    sort(results.begin(), results.end(), [](const ScoredDoc & a, const ScoredDoc & b) { return a.Score > b.Score || (a.Score == b.Score && a.Doc < b.Doc); });
+    return (int32_t)results.size();
+}
@@ -0,0 +1,57 @@
+#include "llai_index.h"
+
+#ifndef LLAI_SKETCH_H
+#define LLAI_SKETCH_H
+
+namespace llai
+{
+    uint64_t    hash_bytes          (const std::string_view & bytes, uint64_t seed = 0);
+
+    // One-permutation MinHash of the set of shingles of a document: every run of shingleSize consecutive tokens is hashed once and
+    // lands in one of signature.size() bins, which keep their lowest hash. Empty bins borrow from the next filled one, so the chance
+    // that two signatures agree on a bin estimates the Jaccard similarity of the shingle sets. tokenHashes is scratch. Returns the
+    // number of shingles, 0 leaving every bin at UINT32_MAX.
+    int32_t     minhash
+        ( const std::string_view & text
+        , const std::span<const TokenRange> & tokenRanges
+        , std::span<uint32_t> signature
+        , std::vector<uint64_t> & tokenHashes
+        , uint32_t shingleSize = 1
+        );
+    double      minhash_similarity  (const std::span<const uint32_t> & signature1, const std::span<const uint32_t> & signature2);
+    // Hashes each band of rowsPerBand consecutive bins into one key. keys must hold signature.size() / rowsPerBand entries.
+    int32_t     minhash_bands       (const std::span<const uint32_t> & signature, uint32_t rowsPerBand, std::span<uint64_t> keys);
+
+    // Charikar's SimHash of a weighted row: bit b is set when the weights of the terms whose hash has bit b set outweigh the others.
+    // The fraction of differing bits estimates the angle between rows. Term ids are hashed, so only rows of one dictionary compare.
+    uint64_t    simhash             (const SparseRow & row);
+    uint32_t    simhash_distance    (uint64_t simhash1, uint64_t simhash2);
+    // Splits the 64 bits into keys.size() blocks. Rows within keys.size() - 1 differing bits share at least one block.
+    int32_t     simhash_bands       (uint64_t simhash, std::span<uint64_t> keys);
+
+    // Banded LSH tables. Row i of the index was added by the i-th lsh_insert. Each band maps a key to the last row inserted with it,
+    // and Next chains every row to the previous one with the same key in that band, so a row costs 4 bytes per band plus its keys.
+    struct LshIndex {
+        uint32_t                                        BandCount   = 0;
+        std::vector<std::unordered_map<uint64_t, uint32_t>> Heads;      // Per band: key -> last row + 1
+        std::vector<uint32_t>                           Next;           // Per row and band: previous row + 1 with the same key, 0 ends the chain
+    };
+
+    int32_t     lsh_init            (LshIndex & index, uint32_t bandCount);
+    int32_t     lsh_insert          (LshIndex & index, const std::span<const uint64_t> & keys);    // Returns the row added.
+    // Every row sharing at least one band key with keys, ascending and without repeats.
+    int32_t     lsh_candidates      (const LshIndex & index, const std::span<const uint64_t> & keys, std::vector<uint32_t> & candidates);
+    // Candidates checked with cosine_similarity against the rows of weighted, which must be in the order they were inserted. Keeps those
+    // scoring at least threshold, best first.
+    int32_t     near_duplicates
+        ( const LshIndex & index
+        , const std::span<const uint64_t> & keys
+        , const SparseMatrixView & weighted
+        , const SparseRow & row
+        , double threshold
+        , std::vector<ScoredDoc> & results
+        , double epsilon = 1e-6
+        );
+} // namespace
+
+#endif // LLAI_SKETCH_H
@@ -0,0 +1,230 @@
+#include "llai_sparse.h"
+#include "llai_log.h"
+#include "llai_metrics.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+using std::bad_alloc;
+using std::span, std::string_view, std::vector;
+using std::size, std::sort, std::sqrt, std::log, std::memcpy;
+
+#define log_sparse_debug(fmt, ...)	do {} while(0) // log_debug("|sparse|" fmt, __VA_ARGS__) //
+
+int32_t llai::intern_term       (TermDictionary & dictionary, const string_view & term) {
+    const auto [it, inserted] = dictionary.Ids.try_emplace(term, (TermId)dictionary.Terms.size());
+    if(inserted)
+        dictionary.Terms.push_back(term);
+    return (int32_t)it->second;
+}
+int32_t llai::intern_term       (TermDictionary & dictionary, StringArena & arena, const string_view & term) {
+    const auto it = dictionary.Ids.find(term);
+    if(it != dictionary.Ids.end())
+        return (int32_t)it->second;
+    const string_view   owned   = arena_copy(arena, term);
+    const TermId        id      = (TermId)dictionary.Terms.size();
+    dictionary.Ids.emplace(owned, id);
+    dictionary.Terms.push_back(owned);
+    return (int32_t)id;
+}
+string_view llai::arena_copy    (StringArena & arena, const string_view & text) {
+    if(text.empty())
+        return {};
+    if(text.size() > arena.BlockSize / 4) {     // Large strings get a block of their own at the front, so the last block keeps filling.
+        auto block = std::make_unique<char[]>(text.size());
+        memcpy(block.get(), text.data(), text.size());
+        const string_view copy = {block.get(), text.size()};
+        arena.Blocks.insert(arena.Blocks.begin(), std::move(block));
+        if(1 == arena.Blocks.size())
+            arena.Used = arena.BlockSize;
+        return copy;
+    }
+    if(arena.Blocks.empty() || arena.Used + text.size() > arena.BlockSize) {
+        arena.Blocks.push_back(std::make_unique<char[]>(arena.BlockSize));
+        arena.Used = 0;
+    }
+    char * copy = arena.Blocks.back().get() + arena.Used;
+    memcpy(copy, text.data(), text.size());
+    arena.Used += (uint32_t)text.size();
+    return {copy, text.size()};
+}
+int32_t llai::find_term         (const TermDictionary & dictionary, const string_view & term) {
+    const auto it = dictionary.Ids.find(term);
+    return (it == dictionary.Ids.end()) ? -1 : (int32_t)it->second;
+}
+llai::SparseRow llai::sparse_row(const SparseVector & vector) { return {vector.Terms, vector.Weights}; }
+llai::SparseRow llai::sparse_row(const SparseMatrix & matrix, uint32_t iRow) {
+    const uint32_t  offset  = matrix.Offsets[iRow];
+    const uint32_t  count   = matrix.Offsets[iRow + 1] - offset;
+    return {{matrix.Terms.data() + offset, count}, {matrix.Weights.data() + offset, count}};
+}
+uint32_t llai::sparse_rows      (const SparseMatrix & matrix) { return (uint32_t)matrix.Offsets.size() - 1; }
+llai::SparseMatrixView llai::matrix_view(const SparseMatrix & matrix) { return {matrix.Offsets, matrix.Terms, matrix.Weights}; }
+llai::SparseRow llai::sparse_row(const SparseMatrixView & matrix, uint32_t iRow) {
+    const uint32_t  offset  = matrix.Offsets[iRow];
+    return {matrix.Terms.subspan(offset, matrix.Offsets[iRow + 1] - offset), matrix.Weights.subspan(offset, matrix.Offsets[iRow + 1] - offset)};
+}
+uint32_t llai::sparse_rows      (const SparseMatrixView & matrix) { return matrix.Offsets.empty() ? 0 : (uint32_t)matrix.Offsets.size() - 1; }
+int32_t llai::append_row        (SparseMatrix & matrix, const SparseRow & row) {
+    try {
+        matrix.Terms    .insert(matrix.Terms  .end(), row.Terms  .begin(), row.Terms  .end());
+        matrix.Weights  .insert(matrix.Weights.end(), row.Weights.begin(), row.Weights.end());
+        matrix.Offsets  .push_back((uint32_t)matrix.Terms.size());
+    }
+    catch (const bad_alloc & e) {
+        log_error("exception message:'%s'", e.what());
+        matrix.Terms    .resize(matrix.Offsets.back());     // Drop a partly appended row.
+        matrix.Weights  .resize(matrix.Offsets.back());
+        return -1;
+    }
+    return (int32_t)sparse_rows(matrix) - 1;
+}
+double  llai::sparse_norm       (const SparseRow & row) {
+    double norm = 0;
+    for(const double weight : row.Weights)
+        norm += weight * weight;
+    return sqrt(norm);
+}
+
+int32_t llai::count_terms       (SparseVector & frequencies, size_t tokenCount) {
+    auto & terms = frequencies.Terms;
+    sort(terms.begin(), terms.end());
+    frequencies.Weights.clear();
+    uint32_t unique = 0;
+    for(uint32_t iTerm = 0; iTerm < terms.size(); ) {
+        const TermId        term    = terms[iTerm];
+        uint32_t            count   = 0;
+        for(; iTerm < terms.size() && terms[iTerm] == term; ++iTerm)
+            ++count;
+        terms[unique++] = term;
+        frequencies.Weights.push_back(count / (double)tokenCount);
+    }
+    terms.resize(unique);
+    return (int32_t)unique;
+}
+int32_t llai::term_frequency    (const string_view & text, const span<const TokenRange> & tokenRanges, TermDictionary & dictionary, SparseVector & frequencies) {
+    frequencies.Terms.clear();
+    try {
+        for (auto tokenRange : tokenRanges)
+            frequencies.Terms.push_back((TermId)intern_term(dictionary, text.substr(tokenRange.Offset, tokenRange.Size)));
+        count_terms(frequencies, tokenRanges.size());
+    }
+    catch (const bad_alloc & e) {
+        log_error("exception message:'%s'", e.what());
+        return -1;
+    }
+    return (int32_t)tokenRanges.size();
+}
+int32_t llai::term_frequency    (const string_view & text, const span<const TokenRange> & tokenRanges, const TermDictionary & dictionary, SparseVector & frequencies) {
+    frequencies.Terms.clear();
+    try {
+        for (auto tokenRange : tokenRanges) {
+            const int32_t term = find_term(dictionary, text.substr(tokenRange.Offset, tokenRange.Size));
+            if(term < 0)
+                log_sparse_debug("Term not found: '%.*s'.", (int)tokenRange.Size, &text[tokenRange.Offset]);
+            else
+                frequencies.Terms.push_back((TermId)term);
+        }
+        count_terms(frequencies, tokenRanges.size());
+    }
+    catch (const bad_alloc & e) {
+        log_error("exception message:'%s'", e.what());
+        return -1;
+    }
+    return (int32_t)tokenRanges.size();
+}
+int32_t llai::inverse_document_frequency(const SparseMatrix & frequencies, uint32_t termCount, vector<double> & idf_scores, vector<uint32_t> & document_occurrences) {
+    document_occurrences.assign(termCount, 0);
+    for(const TermId term : frequencies.Terms)  // Rows hold each term once, so every entry is one document occurrence.
+        ++document_occurrences[term];
+    return idf_from_document_frequencies(document_occurrences, sparse_rows(frequencies), idf_scores);
+}
+double  llai::idf_score         (uint32_t docCount, uint32_t documentFrequency) { return log((double)docCount / (1.0 + documentFrequency)); }
+int32_t llai::idf_from_document_frequencies(const span<const uint32_t> & document_frequencies, uint32_t docCount, vector<double> & idf_scores) {
+    idf_scores.resize(document_frequencies.size());
+    for(uint32_t term = 0; term < document_frequencies.size(); ++term)
+        idf_scores[term] = idf_score(docCount, document_frequencies[term]);
+    return (int32_t)idf_scores.size();
+}
+int32_t llai::weight_terms      (const SparseRow & term_freq, const span<const double> & inverse_doc_freq, SparseVector & weighted_terms) {
+    weighted_terms.Terms  .clear();
+    weighted_terms.Weights.clear();
+    for(uint32_t iTerm = 0; iTerm < term_freq.Terms.size(); ++iTerm) {
+        const TermId term = term_freq.Terms[iTerm];
+        if(term >= inverse_doc_freq.size())
+            log_sparse_debug("Term not found: %u.", term);
+        else {
+            weighted_terms.Terms  .push_back(term);
+            weighted_terms.Weights.push_back(term_freq.Weights[iTerm] * inverse_doc_freq[term]);
+        }
+    }
+    return (int32_t)weighted_terms.Terms.size();
+}
+double  llai::cosine_similarity
+    ( const SparseRow & tf_idf_1
+    , const SparseRow & tf_idf_2
+    , double epsilon
+    ) {
+    const size_t    count1  = tf_idf_1.Terms.size();
+    const size_t    count2  = tf_idf_2.Terms.size();
+    double          dot     = 0;
+    for(size_t i1 = 0, i2 = 0; i1 < count1 && i2 < count2; ) {   // Merge-join over the sorted ids.
+        const TermId term1 = tf_idf_1.Terms[i1];
+        const TermId term2 = tf_idf_2.Terms[i2];
+        if(term1 == term2)
+            dot += tf_idf_1.Weights[i1] * tf_idf_2.Weights[i2];
+        i1 += term1 <= term2;
+        i2 += term2 <= term1;
+    }
+    return dot / (sparse_norm(tf_idf_1) * sparse_norm(tf_idf_2) + epsilon);
+}
+llai::DocumentCounter   llai::document_counter  (TermDictionary & dictionary) {
+    return
+        { [](const string_view & text, vector<TokenRange> & tokenRanges) { return llai::tokenize(text, tokenRanges); }
+        , [&dictionary](const string_view & text, const span<const TokenRange> & tokenRanges, SparseVector & frequencies) { return llai::term_frequency(text, tokenRanges, dictionary, frequencies); }
+        };
+}
+int32_t llai::count_docs        (const span<const string_view> & docs, const DocumentCounter & counter, SparseMatrix & frequencies) {
+    vector<TokenRange>  tokenRanges;    // Scratch buffers are reused across documents.
+    SparseVector        row;
+    frequencies = {};
+    for(uint32_t iDoc = 0; iDoc < size(docs); ++iDoc) {
+        const auto & document = docs[iDoc];
+        tokenRanges.clear();
+        {
+            metrics_time(tokenizeTimer, METRIC_STAGE_TOKENIZE);
+            if(0 > counter.Tokenize(document, tokenRanges)) {
+                log_error("Failed to tokenize document at %u: '%.*s'.", iDoc, (int)document.size(), document.data());
+                return -1 - (int32_t)iDoc;
+            }
+        }
+        {
+            metrics_time(frequencyTimer, METRIC_STAGE_TERM_FREQUENCY);
+            if(0 > counter.Count(document, tokenRanges, row) || 0 > append_row(frequencies, sparse_row(row)))
+                return -1 - (int32_t)iDoc;
+        }
+        metrics_count(METRIC_COUNTER_DOCUMENTS, 1);
+        metrics_count(METRIC_COUNTER_TOKENS, tokenRanges.size());
+        metrics_count(METRIC_COUNTER_TERMS, row.Terms.size());
+        metrics_count(METRIC_COUNTER_BYTES, document.size());
+    }
+    return (int32_t)sparse_rows(frequencies);
+}
+int32_t llai::weight_docs       (uint32_t termCount, vector<double> & idf_scores, SparseMatrix & weighted) {
+    {
+        metrics_time(idfTimer, METRIC_STAGE_IDF);
+        vector<uint32_t>    doc_occurrences;
+        llai::inverse_document_frequency(weighted, termCount, idf_scores, doc_occurrences); // Calculate IDF
+    }
+    metrics_time(weightingTimer, METRIC_STAGE_WEIGHTING);
+    for(uint32_t iEntry = 0; iEntry < weighted.Terms.size(); ++iEntry)
+        weighted.Weights[iEntry] *= idf_scores[weighted.Terms[iEntry]];  // Weight terms: TF * IDF
+    return 0;
+}
+int32_t llai::load_docs         (const span<const string_view> & docs, TermDictionary & dictionary, vector<double> & idf_scores, SparseMatrix & weighted) {
+    const int32_t result = count_docs(docs, document_counter(dictionary), weighted);
+    if(0 > result)
+        return result;
+    return weight_docs((uint32_t)dictionary.Terms.size(), idf_scores, weighted);
+}
@@ -0,0 +1,96 @@
+#include "llai_ranking.h"
+
+#include <functional>
+#include <memory>
+
+#ifndef LLAI_SPARSE_H
+#define LLAI_SPARSE_H
+
+namespace llai
+{
+    typedef uint32_t TermId;
+
+    // Corpus-wide term dictionary. Ids are dense and assigned in first-seen order. The views point into the source text, which must outlive the dictionary.
+    struct TermDictionary {
+        std::unordered_map<std::string_view, TermId>    Ids;
+        std::vector<std::string_view>                   Terms;
+    };
+
+    // Owns copies of interned terms so a dictionary can outlive its source text. Blocks never move once allocated.
+    struct StringArena {
+        std::vector<std::unique_ptr<char[]>>    Blocks;
+        uint32_t                                BlockSize   = 1 << 16;
+        uint32_t                                Used        = 0;    // Bytes taken from the last block
+    };
+
+    // Read-only view of a sparse vector: term ids sorted ascending, with one weight per id.
+    struct SparseRow {
+        std::span<const TermId>     Terms;
+        std::span<const double>     Weights;
+    };
+
+    struct SparseVector {
+        std::vector<TermId>         Terms;
+        std::vector<double>         Weights;
+    };
+
+    // CSR block holding one sorted row per document. Row i spans [Offsets[i], Offsets[i + 1]).
+    struct SparseMatrix {
+        std::vector<uint32_t>       Offsets     = {0};
+        std::vector<TermId>         Terms;
+        std::vector<double>         Weights;
+    };
+
+    struct SparseMatrixView {
+        std::span<const uint32_t>   Offsets;
+        std::span<const TermId>     Terms;
+        std::span<const double>     Weights;
+    };
+
+    int32_t     intern_term                 (TermDictionary & dictionary, const std::string_view & term);   // Returns the id of the term, adding it if missing.
+    int32_t     intern_term                 (TermDictionary & dictionary, StringArena & arena, const std::string_view & term);  // Copies new terms into the arena.
+    int32_t     find_term                   (const TermDictionary & dictionary, const std::string_view & term); // Returns -1 if the term is not in the dictionary.
+    std::string_view    arena_copy          (StringArena & arena, const std::string_view & text);
+
+    SparseRow   sparse_row                  (const SparseVector & vector);
+    SparseRow   sparse_row                  (const SparseMatrix & matrix, uint32_t iRow);
+    uint32_t    sparse_rows                 (const SparseMatrix & matrix);
+    SparseMatrixView    matrix_view         (const SparseMatrix & matrix);
+    SparseRow   sparse_row                  (const SparseMatrixView & matrix, uint32_t iRow);
+    uint32_t    sparse_rows                 (const SparseMatrixView & matrix);
+    int32_t     append_row                  (SparseMatrix & matrix, const SparseRow & row);
+    double      sparse_norm                 (const SparseRow & row);
+
+    // Turns frequencies.Terms, holding one id per token, into sorted (id, count / tokenCount) pairs.
+    int32_t     count_terms                 (SparseVector & frequencies, size_t tokenCount);
+    // Interns every token and stores count / token count for each distinct term.
+    int32_t     term_frequency              (const std::string_view & text, const std::span<const TokenRange> & tokenRanges, TermDictionary & dictionary, SparseVector & frequencies);
+    // Lookup-only variant for queries. Unknown terms are dropped but still count towards the token total.
+    int32_t     term_frequency              (const std::string_view & text, const std::span<const TokenRange> & tokenRanges, const TermDictionary & dictionary, SparseVector & frequencies);
+    int32_t     inverse_document_frequency  (const SparseMatrix & frequencies, uint32_t termCount, std::vector<double> & idfScores, std::vector<uint32_t> & occurrences);
+    // log(docCount / (1 + document frequency)). The loaders of SparseMatrix rows all take their IDF from here, so document frequencies
+    // counted in pieces, as by shards, give the same scores as counted at once.
+    double      idf_score                   (uint32_t docCount, uint32_t documentFrequency);
+    int32_t     idf_from_document_frequencies(const std::span<const uint32_t> & documentFrequencies, uint32_t docCount, std::vector<double> & idfScores);
+    int32_t     weight_terms                (const SparseRow & term_freq, const std::span<const double> & inverse_doc_freq, SparseVector & weighted_terms);
+    double      cosine_similarity
+        ( const SparseRow & tf_idf_1
+        , const SparseRow & tf_idf_2
+        , double epsilon = 1e-6
+        );
+
+    // How load_docs splits a document into tokens and counts its terms. Count interns new terms, so documents are counted in order.
+    struct DocumentCounter {
+        std::function<int32_t(const std::string_view & text, std::vector<TokenRange> & tokenRanges)>    Tokenize;
+        std::function<int32_t(const std::string_view & text, const std::span<const TokenRange> & tokenRanges, SparseVector & frequencies)>  Count;
+    };
+
+    DocumentCounter     document_counter    (TermDictionary & dictionary);  // tokenize() and the interning term_frequency()
+    // First half of load_docs: one row of term frequencies per document. On failure returns -1 - the index of the document.
+    int32_t     count_docs                  (const std::span<const std::string_view> & documents, const DocumentCounter & counter, SparseMatrix & frequencies);
+    // Second half of load_docs: IDF over the rows of count_docs, then TF * IDF in place.
+    int32_t     weight_docs                 (uint32_t termCount, std::vector<double> & idf_scores, SparseMatrix & weighted);
+    int32_t     load_docs                   (const std::span<const std::string_view> & documents, TermDictionary & dictionary, std::vector<double> & idf_scores, SparseMatrix & weighted);
+} // namespace
+
+#endif // LLAI_SPARSE_H
@@ -0,0 +1,178 @@
+#include "llai_stream.h"
+#include "llai_log.h"
+
+#include <algorithm>
+#include <cstring>
+
+#ifdef _WIN32
+#   include <io.h>
+#else
+#   include <cerrno>
+#   include <unistd.h>
+#endif
+
+using std::bad_alloc;
+using std::string_view, std::vector;
+using std::min, std::max, std::sort, std::memchr, std::memmove;
+
+#define log_stream_debug(fmt, ...)	do {} while(0) // log_debug("|stream|" fmt, __VA_ARGS__) //
+
+// Same byte classes as tokenize(). Chunks are only cut after a separator so no token is split.
+static  inline  bool    is_token_byte   (char c) { return c >= 'A' && c <= 'z'; }
+
+static  int64_t read_stream     (int fd, char * buffer, uint32_t size) {
+#ifdef _WIN32
+    return _read(fd, buffer, size);
+#else
+    ssize_t bytes;
+    do bytes = read(fd, buffer, size);
+    while(bytes < 0 && EINTR == errno);
+    return bytes;
+#endif
+}
+
+namespace
+{
+    struct DocumentCounts {
+        vector<uint64_t>        Counts;     // Indexed by term id. Only the touched entries are non-zero.
+        vector<llai::TermId>    Touched;
+        uint64_t                TokenCount;
+    };
+} // namespace
+
+int32_t llai::load_stream
+    ( int fd
+    , DOCUMENT_FORMAT format
+    , TermDictionary & dictionary
+    , StringArena & arena
+    , vector<double> & idf_scores
+    , SparseMatrix & weighted
+    , vector<DocumentSpan> & documents
+    , uint32_t chunkSize
+    ) {
+    vector<char>            buffer;
+    vector<TokenRange>      tokenRanges;
+    SparseVector            row;
+    DocumentCounts          counts          = {};
+    uint64_t                bufferOffset    = 0;    // Stream position of buffer[0]
+    uint64_t                docStart        = 0;
+    uint64_t                docRemaining    = 0;    // Length-prefixed documents only
+    uint32_t                filled          = 0;
+    uint32_t                consumed        = 0;
+    bool                    eof             = false;
+    bool                    inDocument      = false;
+    weighted    = {};
+    documents.clear();
+    auto                    add_tokens      = [&](uint32_t begin, uint32_t end) {
+        const string_view text = {buffer.data() + begin, end - begin};
+        tokenRanges.clear();
+        if(0 > tokenize(text, tokenRanges))
+            return -1;
+        for(const auto tokenRange : tokenRanges) {
+            const TermId term = (TermId)intern_term(dictionary, arena, text.substr(tokenRange.Offset, tokenRange.Size));
+            if(term >= counts.Counts.size())
+                counts.Counts.resize(max<size_t>(term + 1, counts.Counts.size() * 2));
+            if(0 == counts.Counts[term]++)
+                counts.Touched.push_back(term);
+        }
+        counts.TokenCount += tokenRanges.size();
+        return 0;
+    };
+    auto                    end_document    = [&](uint64_t docEnd) {
+        sort(counts.Touched.begin(), counts.Touched.end());
+        row.Terms   = counts.Touched;
+        row.Weights .clear();
+        for(const TermId term : counts.Touched) {
+            row.Weights.push_back(counts.Counts[term] / (double)counts.TokenCount);
+            counts.Counts[term] = 0;
+        }
+        counts.Touched.clear();
+        counts.TokenCount = 0;
+        inDocument = false;
+        documents.push_back({docStart, docEnd - docStart});
+        return append_row(weighted, sparse_row(row));
+    };
+    try {
+        buffer.resize(max(chunkSize, 16U));
+        for(;;) {
+            if(consumed) {  // Drop the processed text and keep the unfinished tail.
+                memmove(buffer.data(), buffer.data() + consumed, filled - consumed);
+                filled          -= consumed;
+                bufferOffset    += consumed;
+                consumed        = 0;
+            }
+            if(filled == buffer.size())
+                buffer.resize(buffer.size() * 2);   // A single token spans the whole buffer.
+            const int64_t bytes = read_stream(fd, buffer.data() + filled, uint32_t(buffer.size() - filled));
+            if(bytes < 0) {
+                log_error("Failed to read the document stream at offset %llu.", (unsigned long long)(bufferOffset + filled));
+                return -1;
+            }
+            eof     = 0 == bytes;
+            filled  += (uint32_t)bytes;
+            while(consumed < filled || (eof && inDocument)) {
+                if(not inDocument) {
+                    if(DOCUMENT_FORMAT_LENGTH_PREFIXED == format) {
+                        if(filled - consumed < 8) {
+                            if(eof) {
+                                log_error("Truncated document header at offset %llu.", (unsigned long long)(bufferOffset + consumed));
+                                return -1;
+                            }
+                            break;
+                        }
+                        docRemaining = 0;
+                        for(uint32_t iByte = 0; iByte < 8; ++iByte)
+                            docRemaining |= uint64_t((uint8_t)buffer[consumed + iByte]) << (iByte * 8);
+                        consumed += 8;
+                    }
+                    docStart    = bufferOffset + consumed;
+                    inDocument  = true;
+                }
+                uint32_t    segmentEnd      = filled;
+                uint32_t    separator       = 0;
+                bool        documentEnds    = eof;
+                if(DOCUMENT_FORMAT_LINES == format) {
+                    const char * newline = (const char *)memchr(buffer.data() + consumed, '\n', filled - consumed);
+                    if(newline) {
+                        segmentEnd      = uint32_t(newline - buffer.data());
+                        separator       = 1;
+                        documentEnds    = true;
+                    }
+                }
+                else {
+                    segmentEnd      = consumed + (uint32_t)min<uint64_t>(docRemaining, filled - consumed);
+                    documentEnds    = segmentEnd - consumed == docRemaining;
+                    if(eof && not documentEnds) {
+                        log_error("Truncated document at offset %llu.", (unsigned long long)docStart);
+                        return -1;
+                    }
+                }
+                if(not documentEnds) {
+                    while(segmentEnd > consumed && is_token_byte(buffer[segmentEnd - 1]))
+                        --segmentEnd;
+                    if(segmentEnd == consumed)
+                        break;  // The rest is one unfinished token.
+                }
+                if(0 > add_tokens(consumed, segmentEnd))
+                    return -1;
+                docRemaining    -= segmentEnd - consumed;
+                consumed        = segmentEnd;
+                if(not documentEnds)
+                    break;
+                if(0 > end_document(bufferOffset + segmentEnd))
+                    return -1;
+                consumed        += separator;
+            }
+            if(eof)
+                break;
+        }
+    }
+    catch (const bad_alloc & e) {
+        log_error("exception message:'%s'", e.what());
+        return -1;
+    }
+    if(0 > weight_docs((uint32_t)dictionary.Terms.size(), idf_scores, weighted))
+        return -1;
+    log_stream_debug("Streamed %u documents, %u terms.", (uint32_t)documents.size(), (uint32_t)dictionary.Terms.size());
+    return (int32_t)documents.size();
+}
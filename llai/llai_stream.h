@@ -0,0 +1,31 @@
+#include "llai_sparse.h"
+
+#ifndef LLAI_STREAM_H
+#define LLAI_STREAM_H
+
+namespace llai
+{
+    enum DOCUMENT_FORMAT : uint8_t
+        { DOCUMENT_FORMAT_LINES             // One document per '\n'-terminated line. The last line may omit the '\n'.
+        , DOCUMENT_FORMAT_LENGTH_PREFIXED   // Each document is preceded by its size as a little-endian uint64_t.
+        };
+
+    struct DocumentSpan { uint64_t Offset, Size; };    // Position of a document's text in the stream.
+
+    // Reads documents from a file descriptor in chunks of chunkSize bytes and builds the same dictionary, IDF table and vectors as
+    // load_docs. Term bytes are copied into the arena when first seen and the raw text is dropped chunk by chunk, so memory follows the
+    // vocabulary and the vectors rather than the corpus. The buffer only grows past chunkSize to fit a single longer token.
+    // Returns the number of documents read.
+    int32_t     load_stream
+        ( int fd
+        , DOCUMENT_FORMAT format
+        , TermDictionary & dictionary
+        , StringArena & arena
+        , std::vector<double> & idf_scores
+        , SparseMatrix & weighted
+        , std::vector<DocumentSpan> & documents
+        , uint32_t chunkSize = 1 << 20
+        );
+} // namespace
+
+#endif // LLAI_STREAM_H
@@ -0,0 +1,206 @@
+#include "llai_ranking.h"
+#include "llai_cpu.h"
+#include "llai_log.h"
+
+#include <bit>
+#include <cctype>
+#include <cstring>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#   define LLAI_TOKENIZE_X86
+#   include <immintrin.h>
+#   ifdef _MSC_VER
+#       define LLAI_TARGET_AVX2
+#   else
+#       define LLAI_TARGET_AVX2    __attribute__((target("avx2")))
+#   endif
+#endif
+
+using std::bad_alloc;
+using std::string_view, std::vector;
+using std::isspace, std::countr_zero, std::memcmp;
+
+#define log_token_trace(fmt, ...)	log_trace("|token|" fmt, __VA_ARGS__) // Once per token. Compiled out unless LLAI_LOG_LEVEL is LLAI_LOG_LEVEL_TRACE.
+
+static bool is_terminator       (const string_view & text, const string_view & terminator) {
+	if(text.size() < terminator.size())
+        return false;
+    return terminator.size() && terminator == text.substr(0, terminator.size());
+}
+
+static inline bool is_skippable(char c) { return c < 'A' || c > 'z' || isspace(c); }
+
+static int32_t tokenize_scalar  (const string_view & text, vector<llai::TokenRange> & tokenRanges, const string_view & terminator) {
+    uint32_t start = 0;
+    while(start < text.size()) {
+        while(start < text.size() && is_skippable(text[start]) && not is_terminator(text.substr(start), terminator))
+            ++start;
+        uint32_t end = start;
+		while(end < text.size() && not is_skippable(text[end]) && not is_terminator(text.substr(end), terminator))
+            ++end;
+        if (start < end) {
+            try {
+                tokenRanges.push_back({start, end - start});
+				log_token_trace("Token: '%.*s' at [%u, %u]", (int)(end - start), &text[start], start, end);
+            }
+            catch (const bad_alloc & e) {
+				log_error("exception message:'%s'", e.what());
+                return -1;
+            }
+        }
+        else if(end < text.size())
+            break;  // Stopped at the terminator
+        start = end;
+    }
+	return start; // Return the position after the last token
+}
+
+namespace
+{
+    struct TokenState {
+        bool        InToken;
+        uint32_t    Start;
+    };
+} // namespace
+
+// Emits one range per 0->1 / 1->0 transition of a block classification mask. Bit i is set when byte (base + i) belongs to a token.
+static inline void emit_tokens  (uint32_t mask, uint32_t width, uint32_t base, TokenState & state, vector<llai::TokenRange> & tokenRanges) {
+    const uint32_t  widthMask   = (width < 32) ? (1u << width) - 1 : ~0u;
+    const uint32_t  shifted     = (mask << 1) | (state.InToken ? 1u : 0u);
+    const uint32_t  starts      = mask & ~shifted;
+    uint32_t        edges       = (starts | (~mask & shifted)) & widthMask;
+    while(edges) {
+        const uint32_t bit = (uint32_t)countr_zero(edges);
+        if(starts >> bit & 1)
+            state.Start = base + bit;
+        else
+            tokenRanges.push_back({state.Start, base + bit - state.Start});
+        edges &= edges - 1;
+    }
+    state.InToken = (mask >> (width - 1)) & 1;
+}
+static inline uint32_t  classify_scalar (const char * text, uint32_t count) {
+    uint32_t mask = 0;
+    for(uint32_t i = 0; i < count; ++i)
+        mask |= uint32_t(not is_skippable(text[i])) << i;
+    return mask;
+}
+
+#ifdef LLAI_TOKENIZE_X86
+static inline __m128i   classify_sse2   (const char * text) {
+    const __m128i   bytes   = _mm_loadu_si128((const __m128i*)text);
+    return _mm_and_si128(_mm_cmpgt_epi8(bytes, _mm_set1_epi8('A' - 1)), _mm_cmpgt_epi8(_mm_set1_epi8('z' + 1), bytes));   // Signed compare, as char is.
+}
+static size_t   find_terminator_sse2    (const string_view & text, const string_view & terminator) {
+    if(terminator.empty() || text.size() < terminator.size())
+        return string_view::npos;
+    const size_t    last    = text.size() - terminator.size();
+    const __m128i   first   = _mm_set1_epi8(terminator.front());
+    const __m128i   final   = _mm_set1_epi8(terminator.back());
+    size_t          pos     = 0;
+    for(; pos + 16 <= last + 1; pos += 16) {    // Candidates must match both the first and the last byte of the terminator.
+        uint32_t candidates = (uint32_t)_mm_movemask_epi8(_mm_and_si128
+            ( _mm_cmpeq_epi8(first, _mm_loadu_si128((const __m128i*)&text[pos]))
+            , _mm_cmpeq_epi8(final, _mm_loadu_si128((const __m128i*)&text[pos + terminator.size() - 1]))
+            ));
+        while(candidates) {
+            const size_t candidate = pos + countr_zero(candidates);
+            if(0 == memcmp(&text[candidate], terminator.data(), terminator.size()))
+                return candidate;
+            candidates &= candidates - 1;
+        }
+    }
+    return text.find(terminator, pos);
+}
+static int32_t  tokenize_sse2   (const string_view & text, vector<llai::TokenRange> & tokenRanges, const string_view & terminator) {
+    const size_t    found   = find_terminator_sse2(text, terminator);
+    const uint32_t  limit   = uint32_t((string_view::npos == found) ? text.size() : found);
+    TokenState      state   = {};
+    uint32_t        pos     = 0;
+    try {
+        for(; pos + 16 <= limit; pos += 16)
+            emit_tokens((uint32_t)_mm_movemask_epi8(classify_sse2(&text[pos])), 16, pos, state, tokenRanges);
+        if(pos < limit)
+            emit_tokens(classify_scalar(&text[pos], limit - pos), limit - pos, pos, state, tokenRanges);
+        if(state.InToken)
+            tokenRanges.push_back({state.Start, limit - state.Start});
+    }
+    catch (const bad_alloc & e) {
+        log_error("exception message:'%s'", e.what());
+        return -1;
+    }
+    return limit;
+}
+LLAI_TARGET_AVX2 static size_t   find_terminator_avx2    (const string_view & text, const string_view & terminator) {
+    if(terminator.empty() || text.size() < terminator.size())
+        return string_view::npos;
+    const size_t    last    = text.size() - terminator.size();
+    const __m256i   first   = _mm256_set1_epi8(terminator.front());
+    const __m256i   final   = _mm256_set1_epi8(terminator.back());
+    size_t          pos     = 0;
+    for(; pos + 32 <= last + 1; pos += 32) {
+        uint32_t candidates = (uint32_t)_mm256_movemask_epi8(_mm256_and_si256
+            ( _mm256_cmpeq_epi8(first, _mm256_loadu_si256((const __m256i*)&text[pos]))
+            , _mm256_cmpeq_epi8(final, _mm256_loadu_si256((const __m256i*)&text[pos + terminator.size() - 1]))
+            ));
+        while(candidates) {
+            const size_t candidate = pos + countr_zero(candidates);
+            if(0 == memcmp(&text[candidate], terminator.data(), terminator.size()))
+                return candidate;
+            candidates &= candidates - 1;
+        }
+    }
+    return text.find(terminator, pos);
+}
+LLAI_TARGET_AVX2 static int32_t  tokenize_avx2   (const string_view & text, vector<llai::TokenRange> & tokenRanges, const string_view & terminator) {
+    const size_t    found   = find_terminator_avx2(text, terminator);
+    const uint32_t  limit   = uint32_t((string_view::npos == found) ? text.size() : found);
+    const __m256i   lower   = _mm256_set1_epi8('A' - 1);
+    const __m256i   upper   = _mm256_set1_epi8('z' + 1);
+    TokenState      state   = {};
+    uint32_t        pos     = 0;
+    try {
+        for(; pos + 32 <= limit; pos += 32) {
+            const __m256i bytes = _mm256_loadu_si256((const __m256i*)&text[pos]);
+            emit_tokens((uint32_t)_mm256_movemask_epi8(_mm256_and_si256(_mm256_cmpgt_epi8(bytes, lower), _mm256_cmpgt_epi8(upper, bytes))), 32, pos, state, tokenRanges);
+        }
+        if(pos + 16 <= limit) {
+            emit_tokens((uint32_t)_mm_movemask_epi8(classify_sse2(&text[pos])), 16, pos, state, tokenRanges);
+            pos += 16;
+        }
+        if(pos < limit)
+            emit_tokens(classify_scalar(&text[pos], limit - pos), limit - pos, pos, state, tokenRanges);
+        if(state.InToken)
+            tokenRanges.push_back({state.Start, limit - state.Start});
+    }
+    catch (const bad_alloc & e) {
+        log_error("exception message:'%s'", e.what());
+        return -1;
+    }
+    return limit;
+}
+#endif // LLAI_TOKENIZE_X86
+
+llai::TokenizerIsa llai::tokenizer_isa  () {
+#ifdef LLAI_TOKENIZE_X86
+    return cpu_has_avx2() ? TokenizerIsa::Avx2 : TokenizerIsa::Sse2;
+#else
+    return TokenizerIsa::Scalar;
+#endif
+}
+int32_t llai::tokenize          (TokenizerIsa isa, const string_view & text, vector<TokenRange> & tokenRanges, const string_view & terminator) {
+    if(isa > tokenizer_isa()) {
+        log_error("Tokenizer implementation %u is not supported by this CPU.", (uint32_t)isa);
+        return -1;
+    }
+    switch(isa) {
+#ifdef LLAI_TOKENIZE_X86
+    case TokenizerIsa::Avx2 : return tokenize_avx2(text, tokenRanges, terminator);
+    case TokenizerIsa::Sse2 : return tokenize_sse2(text, tokenRanges, terminator);
+#endif
+    default                 : return tokenize_scalar(text, tokenRanges, terminator);
+    }
+}
+int32_t llai::tokenize          (const string_view & text, vector<TokenRange> & tokenRanges, const string_view & terminator) {
+    return tokenize(tokenizer_isa(), text, tokenRanges, terminator);
+}
@@ -0,0 +1,586 @@
+#include "llai_index.h"
+#include "llai_parallel.h"
+#include "llai_batch.h"
+#include "llai_join.h"
+#include "llai_pmr.h"
+#include "llai_quantize.h"
+#include "llai_sketch.h"
+#include "llai_normalize.h"
+#include "llai_log.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <random>
+#include <string>
+
+#ifdef _WIN32
+#   define NOMINMAX
+#   define WIN32_LEAN_AND_MEAN
+#   include <windows.h>
+#   include <psapi.h>
+#else
+#   include <sys/resource.h>
+#   include <fcntl.h>
+#   include <unistd.h>
+#   ifdef __GLIBC__
+#       include <malloc.h>
+#   endif
+#endif
+
+using std::string, std::string_view, std::vector, std::span;
+using std::size, std::min, std::max, std::sort, std::upper_bound, std::pow;
+using std::chrono::steady_clock;
+
+static  constexpr double    BYTES_PER_MB        = 1024.0 * 1024.0;
+
+struct BenchConfig {
+    vector<uint32_t>    DocCounts       = {10000, 100000};
+    uint32_t            Vocabulary      = 100000;
+    uint32_t            DocLength       = 100;      // Mean tokens per document. Lengths are uniform in [DocLength / 2, DocLength * 3 / 2].
+    double              ZipfExponent    = 1.0;
+    uint32_t            QueryCount      = 1000;
+    uint32_t            QueryLength     = 4;
+    uint32_t            TopK            = 10;
+    uint32_t            Rerank          = 4;        // The quantized queries re-rank this many times TopK candidates.
+    uint32_t            Threads         = 0;
+    uint32_t            Repeat          = 3;        // Throughput is the best of this many runs. Latencies are pooled over all of them.
+    uint32_t            Seed            = 1;
+    uint32_t            JoinMaxDocs     = 100000;   // The join is skipped on larger corpora.
+    double              JoinThreshold   = 0.5;
+    uint32_t            Duplicates      = 20;       // Per mille of documents that are near-duplicates of an earlier one
+    uint32_t            Mutations       = 100;      // Per mille of the tokens of a near-duplicate that are drawn again
+    double              Tolerance       = 0.10;     // Relative change against the baseline that counts as a regression.
+    string              Apis;                       // Comma separated names to run. Empty runs all of them.
+    string              Output;
+    string              Baseline;
+};
+
+struct BenchResult {
+    string              Name;           // "<documents>/<api>"
+    string              Metric;
+    double              Value;
+    bool                HigherIsBetter;
+};
+
+struct Corpus {
+    string              Text;
+    string              QueryText;
+    vector<string_view> Docs;
+    vector<string_view> Queries;
+};
+
+// Draws from a 64-bit Mersenne Twister without the standard distributions, whose output is implementation-defined, so a seed gives
+// the same corpus with every standard library.
+struct ZipfSampler {
+    vector<double>      Cdf;
+
+    uint32_t            operator()  (std::mt19937_64 & random) const {
+        const double uniform = (random() >> 11) * 0x1p-53 * Cdf.back();
+        return min((uint32_t)(upper_bound(Cdf.begin(), Cdf.end(), uniform) - Cdf.begin()), (uint32_t)Cdf.size() - 1);
+    }
+};
+
+static  ZipfSampler     zipf_sampler    (uint32_t vocabulary, double exponent) {
+    ZipfSampler         sampler;
+    sampler.Cdf.resize(vocabulary);
+    double              total           = 0;
+    for(uint32_t rank = 0; rank < vocabulary; ++rank)
+        sampler.Cdf[rank] = total += 1 / pow(rank + 1.0, exponent);
+    return sampler;
+}
+
+// Rank 0 is "a", 25 is "z", 26 is "aa": frequent words come out short, as in natural text.
+static  string          word_for_rank   (uint32_t rank) {
+    string              word;
+    for(++rank; rank; rank = (rank - 1) / 26)
+        word.insert(word.begin(), char('a' + (rank - 1) % 26));
+    return word;
+}
+
+static  std::mt19937_64 document_random (uint32_t seed, uint64_t stream) { return std::mt19937_64(seed * 0x9E3779B97F4A7C15ULL + stream); }
+
+// Document i draws from its own streams, so the text of any document can be regenerated on its own. A near-duplicate takes the tokens
+// of an earlier document and replaces some of them, which is what gives similarity_join something to find.
+static  int32_t         make_corpus     (const BenchConfig & config, uint32_t docCount, Corpus & corpus) {
+    const ZipfSampler   sampler         = zipf_sampler(config.Vocabulary, config.ZipfExponent);
+    vector<string>      words           (config.Vocabulary);
+    for(uint32_t rank = 0; rank < config.Vocabulary; ++rank)
+        words[rank] = word_for_rank(rank);
+    vector<uint64_t>    offsets         = {0};
+    try {
+        corpus.Text.clear();
+        for(uint32_t iDoc = 0; iDoc < docCount; ++iDoc) {
+            std::mt19937_64     random          = document_random(config.Seed, docCount + (uint64_t)iDoc);
+            const bool          duplicate       = iDoc && random() % 1000 < config.Duplicates;
+            std::mt19937_64     source          = document_random(config.Seed, duplicate ? random() % iDoc : iDoc);
+            const uint32_t      length          = config.DocLength / 2 + (uint32_t)(source() % (config.DocLength + 1));
+            for(uint32_t iToken = 0; iToken < length; ++iToken) {
+                uint32_t rank = sampler(source);
+                if(duplicate && random() % 1000 < config.Mutations)
+                    rank = sampler(random);
+                corpus.Text.append(words[rank]).append((iToken % 12 == 11) ? ". " : " ");
+            }
+            offsets.push_back(corpus.Text.size());
+        }
+        corpus.Docs.resize(docCount);
+        for(uint32_t iDoc = 0; iDoc < docCount; ++iDoc)
+            corpus.Docs[iDoc] = string_view(corpus.Text).substr(offsets[iDoc], offsets[iDoc + 1] - offsets[iDoc]);
+
+        std::mt19937_64     random          = document_random(config.Seed, 2ULL * docCount);
+        offsets = {0};
+        corpus.QueryText.clear();
+        for(uint32_t iQuery = 0; iQuery < config.QueryCount; ++iQuery) {
+            for(uint32_t iTerm = 0; iTerm < config.QueryLength; ++iTerm)
+                corpus.QueryText.append(words[sampler(random)]).append(" ");
+            offsets.push_back(corpus.QueryText.size());
+        }
+        corpus.Queries.resize(config.QueryCount);
+        for(uint32_t iQuery = 0; iQuery < config.QueryCount; ++iQuery)
+            corpus.Queries[iQuery] = string_view(corpus.QueryText).substr(offsets[iQuery], offsets[iQuery + 1] - offsets[iQuery]);
+    }
+    catch (const std::bad_alloc & e) {
+        log_error("exception message:'%s'", e.what());
+        return -1;
+    }
+    return 0;
+}
+
+static  double          seconds_since   (steady_clock::time_point start) { return std::chrono::duration<double>(steady_clock::now() - start).count(); }
+
+// Resets the high-water mark to the current resident size where the system allows it (Linux 4.0 and later). Free heap memory is
+// returned first, or a run reusing what an earlier one freed would not show up.
+static  void            reset_peak_memory   () {
+#ifndef _WIN32
+#   ifdef __GLIBC__
+    malloc_trim(0);
+#   endif
+    const int fd = open("/proc/self/clear_refs", O_WRONLY);
+    if(fd >= 0) {
+        if(write(fd, "5", 1) < 0)
+            log_debug("%s", "Failed to reset the peak resident size.");
+        close(fd);
+    }
+#endif
+}
+
+static  uint64_t        resident_memory     (bool peak) {
+#ifdef _WIN32
+    PROCESS_MEMORY_COUNTERS counters    = {};
+    GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters));
+    return peak ? counters.PeakWorkingSetSize : counters.WorkingSetSize;
+#else
+    std::ifstream       status          ("/proc/self/status");
+    const string        key             = peak ? "VmHWM:" : "VmRSS:";
+    for(string line; std::getline(status, line); )
+        if(0 == line.compare(0, key.size(), key))
+            return std::strtoull(line.c_str() + key.size(), 0, 10) * 1024;
+    rusage              usage           = {};
+    getrusage(RUSAGE_SELF, &usage);
+    return peak ? (uint64_t)usage.ru_maxrss * 1024 : 0;
+#endif
+}
+
+// Runs task config.Repeat times. task returns the seconds it spent on the measured call, or a negative value on failure. Returns the
+// fastest run, and through peakBytes how far the resident size rose above where it was before the first run.
+template<typename TTask>
+static  double          best_seconds    (const BenchConfig & config, uint64_t & peakBytes, TTask && task) {
+    reset_peak_memory();
+    const uint64_t      before          = resident_memory(false);
+    double              best            = -1;
+    for(uint32_t iRun = 0; iRun < max(1u, config.Repeat); ++iRun) {
+        const double seconds = task();
+        if(seconds < 0)
+            return -1;
+        best = (best < 0) ? seconds : min(best, seconds);
+    }
+    const uint64_t      peak            = resident_memory(true);
+    peakBytes = (peak > before) ? peak - before : 0;
+    return best;
+}
+
+static  bool            selected        (const BenchConfig & config, const char * api) {
+    if(config.Apis.empty())
+        return true;
+    const string_view   apis            = config.Apis;
+    for(size_t begin = 0; ; ) {
+        const size_t end = apis.find(',', begin);
+        if(apis.substr(begin, end - begin) == api)
+            return true;
+        if(end == string_view::npos)
+            return false;
+        begin = end + 1;
+    }
+}
+
+static  double          percentile      (const vector<double> & sorted, double percent) {
+    return sorted.empty() ? 0 : sorted[min((size_t)(percent / 100 * sorted.size()), sorted.size() - 1)];
+}
+
+static  int32_t         bench_corpus    (const BenchConfig & config, uint32_t docCount, vector<BenchResult> & results) {
+    Corpus              corpus;
+    const auto          generateStart   = steady_clock::now();
+    if(0 > make_corpus(config, docCount, corpus))
+        return -1;
+    const double        corpusMb        = corpus.Text.size() / BYTES_PER_MB;
+    printf("Corpus: %u documents, %.1f MB, generated in %.2f s.\n", docCount, corpusMb, seconds_since(generateStart));
+    const string        prefix          = std::to_string(docCount) + "/";
+    auto                add_result      = [&](const char * api, const char * metric, double value, bool higherIsBetter) {
+        results.push_back({prefix + api, metric, value, higherIsBetter});
+        printf("  %-28s %-16s %12.3f\n", results.back().Name.c_str(), metric, value);
+    };
+    uint64_t            peakBytes       = 0;
+    double              seconds         = 0;
+
+    static constexpr struct { llai::TokenizerIsa Isa; const char * Api; } tokenizers[] =
+        { {llai::TokenizerIsa::Scalar, "tokenize_scalar"}
+        , {llai::TokenizerIsa::Sse2, "tokenize_sse2"}
+        , {llai::TokenizerIsa::Avx2, "tokenize_avx2"}
+        };
+    for(const auto & tokenizer : tokenizers) {
+        if(not selected(config, tokenizer.Api) || tokenizer.Isa > llai::tokenizer_isa())
+            continue;
+        vector<llai::TokenRange>    tokenRanges;
+        if(0 > (seconds = best_seconds(config, peakBytes, [&]() {
+            const auto start = steady_clock::now();
+            for(const string_view document : corpus.Docs) {
+                tokenRanges.clear();
+                if(0 > llai::tokenize(tokenizer.Isa, document, tokenRanges))
+                    return -1.0;
+            }
+            return seconds_since(start);
+        })))
+            return -1;
+        add_result(tokenizer.Api, "mb_per_s", corpusMb / seconds, true);
+        add_result(tokenizer.Api, "peak_mb", peakBytes / BYTES_PER_MB, false);
+    }
+
+    if(selected(config, "minhash_lsh")) {   // Deduplication as documents arrive: tokenize, sign, look up and insert. Signatures are of
+                                            // word pairs, as most Zipf documents share the common words.
+        vector<llai::TokenRange>    tokenRanges;
+        vector<uint32_t>            signature       (128);
+        vector<uint64_t>            tokenHashes;
+        vector<uint64_t>            keys            (32);
+        vector<uint32_t>            candidates;
+        uint64_t                    candidateCount  = 0;
+        if(0 > (seconds = best_seconds(config, peakBytes, [&]() {
+            llai::LshIndex  lsh;
+            candidateCount = 0;
+            const auto      start   = steady_clock::now();
+            if(0 > llai::lsh_init(lsh, (uint32_t)keys.size()))
+                return -1.0;
+            for(const string_view document : corpus.Docs) {
+                tokenRanges.clear();
+                if(0 > llai::tokenize(document, tokenRanges)
+                 || 0 > llai::minhash(document, tokenRanges, signature, tokenHashes, 2)
+                 || 0 > llai::minhash_bands(signature, (uint32_t)(signature.size() / keys.size()), keys)
+                 || 0 > llai::lsh_candidates(lsh, keys, candidates)
+                 || 0 > llai::lsh_insert(lsh, keys))
+                    return -1.0;
+                candidateCount += candidates.size();
+            }
+            return seconds_since(start);
+        })))
+            return -1;
+        add_result("minhash_lsh", "docs_per_s", docCount / seconds, true);
+        add_result("minhash_lsh", "mb_per_s", corpusMb / seconds, true);
+        add_result("minhash_lsh", "peak_mb", peakBytes / BYTES_PER_MB, false);
+        add_result("minhash_lsh", "candidates_per_doc", candidateCount / (double)docCount, false);
+    }
+
+    auto                bench_load      = [&](const char * api, auto && load) {
+        if(not selected(config, api))
+            return 0;
+        if(0 > (seconds = best_seconds(config, peakBytes, load)))
+            return -1;
+        add_result(api, "docs_per_s", docCount / seconds, true);
+        add_result(api, "peak_mb", peakBytes / BYTES_PER_MB, false);
+        return 0;
+    };
+    if(0 > bench_load("load_docs", [&]() {
+        llai::TermDictionary    dictionary;
+        vector<double>          idf_scores;
+        llai::SparseMatrix      weighted;
+        llai::InvertedIndex     index;
+        const auto              start       = steady_clock::now();
+        return (0 > llai::load_docs(corpus.Docs, dictionary, idf_scores, weighted, index)) ? -1.0 : seconds_since(start);
+    }))
+        return -1;
+    if(0 > bench_load("load_docs_parallel", [&]() {
+        llai::TermDictionary    dictionary;
+        vector<double>          idf_scores;
+        llai::SparseMatrix      weighted;
+        const auto              start       = steady_clock::now();
+        return (0 > llai::load_docs(corpus.Docs, dictionary, idf_scores, weighted, config.Threads)) ? -1.0 : seconds_since(start);
+    }))
+        return -1;
+    if(0 > bench_load("load_docs_normalized", [&]() {
+        llai::TermDictionary    dictionary;
+        llai::StringArena       arena;
+        vector<double>          idf_scores;
+        llai::SparseMatrix      weighted;
+        const auto              start       = steady_clock::now();
+        return (0 > llai::load_docs(corpus.Docs, llai::NORMALIZE_DEFAULT | llai::NORMALIZE_STEM, dictionary, arena, idf_scores, weighted)) ? -1.0 : seconds_since(start);
+    }))
+        return -1;
+    if(0 > bench_load("load_docs_map", [&]() {
+        llai::TokenWeightMap            idf_scores;
+        vector<llai::TokenWeightMap>    weighted    (docCount);
+        const auto                      start       = steady_clock::now();
+        return (0 > llai::load_docs(corpus.Docs, idf_scores, weighted)) ? -1.0 : seconds_since(start);
+    }))
+        return -1;
+    if(0 > bench_load("load_docs_pmr", [&]() {
+        vector<llai::MapScratch>        scratch     (llai::thread_count(config.Threads));
+        llai::PmrWeightedCorpus         pmrCorpus;
+        const auto                      start       = steady_clock::now();
+        return (0 > llai::load_docs(corpus.Docs, pmrCorpus, scratch)) ? -1.0 : seconds_since(start);
+    }))
+        return -1;
+
+    static constexpr struct { llai::QUANTIZATION Format; const char * Api; } quantizations[] =
+        { {llai::QUANTIZATION_INT8, "query_top_k_int8"}
+        , {llai::QUANTIZATION_INT16, "query_top_k_int16"}
+        };
+    bool                queries         = selected(config, "query_top_k") || selected(config, "query_top_k_batch");
+    for(const auto & quantization : quantizations)
+        queries = queries || selected(config, quantization.Api);
+    const bool          join            = selected(config, "similarity_join") && docCount <= config.JoinMaxDocs;
+    if(not queries && not join)
+        return 0;
+    llai::TermDictionary    dictionary;
+    vector<double>          idf_scores;
+    llai::SparseMatrix      weighted;
+    llai::InvertedIndex     index;
+    llai::SparseMatrix      weightedQueries;
+    if(0 > llai::load_docs(corpus.Docs, dictionary, idf_scores, weighted, index)
+     || 0 > llai::weight_queries(corpus.Queries, dictionary, idf_scores, weightedQueries, config.Threads))
+        return -1;
+    const llai::InvertedIndexView   view    = llai::index_view(index);
+    vector<vector<llai::ScoredDoc>> exact   (config.QueryCount);
+    auto                bench_queries   = [&](const char * api, auto && query) {    // query(iQuery, results) runs one query.
+        vector<double>          latencies;
+        vector<llai::ScoredDoc> topK;
+        uint32_t                found       = 0;
+        uint32_t                expected    = 0;
+        if(0 > (seconds = best_seconds(config, peakBytes, [&]() {
+            double total = 0;
+            found = expected = 0;
+            for(uint32_t iQuery = 0; iQuery < config.QueryCount; ++iQuery) {
+                const auto start = steady_clock::now();
+                if(0 > query(iQuery, topK))
+                    return -1.0;
+                latencies.push_back(seconds_since(start) * 1e6);
+                total += latencies.back();
+                for(const llai::ScoredDoc & result : topK)
+                    found += std::any_of(exact[iQuery].begin(), exact[iQuery].end(), [&](const llai::ScoredDoc & hit) { return hit.Doc == result.Doc; });
+                expected += (uint32_t)exact[iQuery].size();
+            }
+            return total / 1e6;
+        })))
+            return -1;
+        sort(latencies.begin(), latencies.end());
+        add_result(api, "queries_per_s", config.QueryCount / seconds, true);
+        add_result(api, "p50_us", percentile(latencies, 50), false);
+        add_result(api, "p90_us", percentile(latencies, 90), false);
+        add_result(api, "p99_us", percentile(latencies, 99), false);
+        add_result(api, "max_us", latencies.empty() ? 0 : latencies.back(), false);
+        add_result(api, "peak_mb", peakBytes / BYTES_PER_MB, false);
+        if(expected)
+            add_result(api, "recall", found / (double)expected, true);   // Against the exact query_top_k
+        return 0;
+    };
+    for(uint32_t iQuery = 0; iQuery < config.QueryCount; ++iQuery)
+        if(0 > llai::query_top_k(view, llai::sparse_row(weightedQueries, iQuery), config.TopK, exact[iQuery]))
+            return -1;
+    if(selected(config, "query_top_k") && 0 > bench_queries("query_top_k", [&](uint32_t iQuery, vector<llai::ScoredDoc> & topK) {
+        return llai::query_top_k(view, llai::sparse_row(weightedQueries, iQuery), config.TopK, topK);
+    }))
+        return -1;
+    for(const auto & quantization : quantizations) {
+        if(not selected(config, quantization.Api))
+            continue;
+        llai::QuantizedMatrix   quantized;
+        if(0 > llai::quantize_matrix(weighted, quantization.Format, quantized))
+            return -1;
+        if(0 > bench_queries(quantization.Api, [&](uint32_t iQuery, vector<llai::ScoredDoc> & topK) {
+            return llai::query_top_k(quantized, llai::sparse_row(weightedQueries, iQuery), config.TopK, config.TopK * config.Rerank, topK, config.Threads);
+        }))
+            return -1;
+        add_result(quantization.Api, "weights_mb", llai::quantized_bytes(quantized) / BYTES_PER_MB, false);
+        add_result(quantization.Api, "row_bytes", llai::quantized_row_bytes(quantized), false);
+    }
+    if(selected(config, "query_top_k_batch")) {
+        vector<vector<llai::ScoredDoc>> topK;
+        if(0 > (seconds = best_seconds(config, peakBytes, [&]() {
+            const auto start = steady_clock::now();
+            return (0 > llai::query_top_k(view, weightedQueries, config.TopK, topK, config.Threads)) ? -1.0 : seconds_since(start);
+        })))
+            return -1;
+        add_result("query_top_k_batch", "queries_per_s", config.QueryCount / seconds, true);
+        add_result("query_top_k_batch", "peak_mb", peakBytes / BYTES_PER_MB, false);
+    }
+    if(join) {
+        uint64_t            pairs           = 0;
+        if(0 > (seconds = best_seconds(config, peakBytes, [&]() {
+            pairs = 0;
+            const auto start = steady_clock::now();
+            const int32_t result = llai::similarity_join(weighted, config.JoinThreshold, [&](span<const llai::SimilarPair> found) { pairs += found.size(); return 0; }, config.Threads);
+            return (0 > result) ? -1.0 : seconds_since(start);
+        })))
+            return -1;
+        add_result("similarity_join", "docs_per_s", docCount / seconds, true);
+        add_result("similarity_join", "peak_mb", peakBytes / BYTES_PER_MB, false);
+        printf("  %u documents joined into %llu pairs at %g.\n", docCount, (unsigned long long)pairs, config.JoinThreshold);
+    }
+    return 0;
+}
+
+static  int32_t         write_results   (const BenchConfig & config, const vector<BenchResult> & results) {
+    std::ofstream       output          (config.Output);
+    if(not output) {
+        log_error("Failed to open '%s' for writing.", config.Output.c_str());
+        return -1;
+    }
+    char                line            [512];
+    snprintf(line, size(line), "{\"config\": {\"vocabulary\": %u, \"doc_length\": %u, \"zipf\": %g, \"duplicates\": %u, \"mutations\": %u, \"join_threshold\": %g, \"queries\": %u, \"query_length\": %u, \"k\": %u, \"rerank\": %u, \"threads\": %u, \"repeat\": %u, \"seed\": %u},\n"
+        , config.Vocabulary, config.DocLength, config.ZipfExponent, config.Duplicates, config.Mutations, config.JoinThreshold, config.QueryCount, config.QueryLength, config.TopK, config.Rerank, llai::thread_count(config.Threads), config.Repeat, config.Seed
+        );
+    output << line << "\"results\": [\n";
+    for(uint32_t iResult = 0; iResult < results.size(); ++iResult) {   // One result per line, which is all read_baseline relies on.
+        const BenchResult & result = results[iResult];
+        snprintf(line, size(line), "  {\"name\": \"%s\", \"metric\": \"%s\", \"value\": %.17g, \"higher_is_better\": %s}%s\n"
+            , result.Name.c_str(), result.Metric.c_str(), result.Value, result.HigherIsBetter ? "true" : "false", (iResult + 1 < results.size()) ? "," : ""
+            );
+        output << line;
+    }
+    output << "]}\n";
+    return output ? 0 : -1;
+}
+
+// Reads results written by write_results.
+static  int32_t         read_baseline   (const string & path, vector<BenchResult> & baseline) {
+    std::ifstream       input           (path);
+    if(not input) {
+        log_error("Failed to open baseline '%s'.", path.c_str());
+        return -1;
+    }
+    auto                field           = [](const string & line, const char * key) -> string_view {
+        const size_t begin = line.find(key);
+        if(begin == string::npos)
+            return {};
+        const size_t valueBegin = begin + strlen(key);
+        const size_t valueEnd   = line.find_first_of("\",}", valueBegin);
+        return string_view(line).substr(valueBegin, (valueEnd == string::npos ? line.size() : valueEnd) - valueBegin);
+    };
+    for(string line; std::getline(input, line); ) {
+        const string_view name = field(line, "\"name\": \"");
+        const string_view metric = field(line, "\"metric\": \"");
+        const string_view value = field(line, "\"value\": ");
+        if(name.empty() || metric.empty() || value.empty())
+            continue;
+        baseline.push_back({string(name), string(metric), std::strtod(string(value).c_str(), 0), line.find("\"higher_is_better\": true") != string::npos});
+    }
+    return (int32_t)baseline.size();
+}
+
+// Returns the number of results that got worse than the baseline by more than the tolerance.
+static  int32_t         compare_results (const BenchConfig & config, const vector<BenchResult> & results, const vector<BenchResult> & baseline) {
+    int32_t             regressions     = 0;
+    printf("Against baseline '%s' (tolerance %.0f%%):\n", config.Baseline.c_str(), config.Tolerance * 100);
+    for(const BenchResult & result : results) {
+        const auto found = std::find_if(baseline.begin(), baseline.end(), [&](const BenchResult & base) { return base.Name == result.Name && base.Metric == result.Metric; });
+        if(found == baseline.end() || 0 == found->Value)
+            continue;
+        const double    change      = result.Value / found->Value - 1;
+        const bool      regressed   = result.HigherIsBetter ? (change < -config.Tolerance) : (change > config.Tolerance);
+        regressions += regressed;
+        printf("  %-28s %-16s %12.3f -> %12.3f %+7.1f%%%s\n", result.Name.c_str(), result.Metric.c_str(), found->Value, result.Value, change * 100, regressed ? "  REGRESSION" : "");
+    }
+    printf("%i regression(s).\n", regressions);
+    return regressions;
+}
+
+static  void            print_usage     () {
+    printf("Usage: llai_bench [--docs N,N...] [--vocabulary N] [--doc-length N] [--zipf S] [--duplicates PERMILLE] [--mutations PERMILLE] [--queries N] [--query-length N] [--k N] [--rerank N]\n"
+           "                  [--threads N] [--repeat N] [--seed N] [--join-max-docs N] [--join-threshold T] [--apis NAME,NAME...] [--output FILE]\n"
+           "                  [--baseline FILE] [--tolerance FRACTION]\n"
+           "APIs: tokenize_scalar, tokenize_sse2, tokenize_avx2, minhash_lsh, load_docs, load_docs_parallel, load_docs_normalized,\n"
+           "      load_docs_map, load_docs_pmr, query_top_k, query_top_k_int8, query_top_k_int16, query_top_k_batch, similarity_join.\n"
+           "Exits with 1 when a result regressed against the baseline.\n"
+           );
+}
+// Returns 1 when the usage was asked for and printed, and the benchmarks should not run.
+static  int32_t         parse_args      (int argc, char ** argv, BenchConfig & config) {
+    for(int iArg = 1; iArg < argc; ++iArg) {
+        const string_view   arg         = argv[iArg];
+        if(arg == "--help") {
+            print_usage();
+            return 1;
+        }
+        if(iArg + 1 >= argc) {
+            log_error("Option '%s' needs a value.", argv[iArg]);
+            print_usage();
+            return -1;
+        }
+        const char *        value       = argv[++iArg];
+        const uint32_t      number      = (uint32_t)std::strtoul(value, 0, 10);
+        if(arg == "--docs") {
+            config.DocCounts.clear();
+            for(const char * next = value; ; ) {
+                char * end = 0;
+                config.DocCounts.push_back((uint32_t)std::strtoul(next, &end, 10));
+                if(*end != ',')
+                    break;
+                next = end + 1;
+            }
+        }
+        else if(arg == "--vocabulary"    ) config.Vocabulary     = max(1u, number);
+        else if(arg == "--doc-length"    ) config.DocLength      = max(1u, number);
+        else if(arg == "--zipf"          ) config.ZipfExponent   = std::strtod(value, 0);
+        else if(arg == "--queries"       ) config.QueryCount     = number;
+        else if(arg == "--query-length"  ) config.QueryLength    = max(1u, number);
+        else if(arg == "--k"             ) config.TopK           = number;
+        else if(arg == "--rerank"        ) config.Rerank         = max(1u, number);
+        else if(arg == "--threads"       ) config.Threads        = number;
+        else if(arg == "--repeat"        ) config.Repeat         = max(1u, number);
+        else if(arg == "--seed"          ) config.Seed           = number;
+        else if(arg == "--join-max-docs" ) config.JoinMaxDocs    = number;
+        else if(arg == "--join-threshold") config.JoinThreshold  = std::strtod(value, 0);
+        else if(arg == "--duplicates"    ) config.Duplicates     = min(1000u, number);
+        else if(arg == "--mutations"     ) config.Mutations      = min(1000u, number);
+        else if(arg == "--apis"          ) config.Apis           = value;
+        else if(arg == "--output"        ) config.Output         = value;
+        else if(arg == "--baseline"      ) config.Baseline       = value;
+        else if(arg == "--tolerance"     ) config.Tolerance      = std::strtod(value, 0);
+        else {
+            log_error("Unknown option '%s'.", argv[iArg - 1]);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+int main(int argc, char ** argv) {
+    BenchConfig             config;
+    const int32_t           parsed      = parse_args(argc, argv, config);
+    if(parsed)
+        return (parsed > 0) ? 0 : -1;
+    vector<BenchResult>     results;
+    for(const uint32_t docCount : config.DocCounts)
+        if(0 > bench_corpus(config, docCount, results)) {
+            log_error("Benchmark failed on %u documents.", docCount);
+            return -1;
+        }
+    if(config.Output.size() && 0 > write_results(config, results))
+        return -1;
+    if(config.Baseline.empty())
+        return 0;
+    vector<BenchResult>     baseline;
+    if(0 > read_baseline(config.Baseline, baseline))
+        return -1;
+    return compare_results(config, results, baseline) ? 1 : 0;
+}
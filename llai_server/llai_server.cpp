@@ -0,0 +1,295 @@
+#include "llai_server.h"
+#include "llai_mapped.h"
+#include "llai_normalize.h"
+#include "llai_shard.h"
+#include "llai_log.h"
+
+#include <atomic>
+#include <chrono>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <string>
+#include <thread>
+
+using std::string, std::string_view, std::vector;
+using std::max;
+
+struct ServeConfig {
+    string              Mode;
+    string              DocsPath;           // One document per line, loaded and indexed at startup
+    string              IndexPath;          // Or an index written by save_index, mapped in place
+    string              QueriesPath;        // One query per line, for the load generator and the coordinator
+    string              OutputPath;
+    vector<string>      StatisticsPaths;    // Statistics files of every shard, in document order
+    vector<string>      Shards;             // Ports or Unix socket paths of the shard servers, in document order
+    bool                Normalize           = false;
+    uint32_t            ReportSeconds       = 10;
+    llai::ServerConfig  Server;
+    llai::LoadConfig    Load;
+};
+
+static  std::atomic<bool>   stopRequested   = false;
+
+static  void            request_stop    (int) { stopRequested = true; }
+
+static  int32_t         read_lines      (const string & path, string & text, vector<string_view> & lines) {
+    std::ifstream       input           (path, std::ios::binary);
+    if(not input) {
+        log_error("Failed to open '%s'.", path.c_str());
+        return -1;
+    }
+    text.assign(std::istreambuf_iterator<char>(input), std::istreambuf_iterator<char>());
+    lines.clear();
+    for(size_t begin = 0; begin < text.size(); ) {
+        size_t end = text.find('\n', begin);
+        if(string::npos == end)
+            end = text.size();
+        if(end > begin)
+            lines.push_back(string_view(text).substr(begin, end - begin - (text[end - 1] == '\r')));
+        begin = end + 1;
+    }
+    return (int32_t)lines.size();
+}
+
+static  vector<string>  split_list      (const string_view & list) {
+    vector<string>      items;
+    for(size_t begin = 0; begin <= list.size(); ) {
+        const size_t        end         = std::min(list.find(',', begin), list.size());
+        if(end > begin)
+            items.emplace_back(list.substr(begin, end - begin));
+        begin = end + 1;
+    }
+    return items;
+}
+
+static  void            print_stats     (const char * prefix, const llai::ServerStats & stats) {
+    printf("%s%llu requests, %.1f%% from the cache, %.2f misses per batch, %llu connections, p50 %.1f us, p99 %.1f us, max %.1f us.\n"
+        , prefix, (unsigned long long)stats.Requests, stats.Requests ? stats.CacheHits * 100.0 / stats.Requests : 0.0
+        , stats.Batches ? (stats.Requests - stats.CacheHits) / (double)stats.Batches : 0.0, (unsigned long long)stats.Connections, stats.P50Us, stats.P99Us, stats.MaxUs);
+}
+
+static  uint8_t         normalization   (const ServeConfig & config) { return config.Normalize ? uint8_t(llai::NORMALIZE_DEFAULT | llai::NORMALIZE_STEM) : uint8_t(llai::NORMALIZE_NONE); }
+
+static  int32_t         serve           (const ServeConfig & config) {
+    string                  text;
+    vector<string_view>     docs;
+    llai::TermDictionary    dictionary;
+    llai::StringArena       arena;
+    vector<double>          idf_scores;
+    llai::SparseMatrix      weighted;
+    llai::InvertedIndex     index;
+    llai::MappedIndex       mapped;
+    llai::QueryWeighter     weigh;
+    llai::InvertedIndexView view;
+    const auto              start       = std::chrono::steady_clock::now();
+    if(config.IndexPath.size()) {
+        if(0 > llai::open_index(config.IndexPath.c_str(), mapped))
+            return -1;
+        weigh   = llai::query_weighter(mapped, normalization(config));
+        view    = mapped.Index;
+    }
+    else {
+        if(0 > read_lines(config.DocsPath, text, docs))
+            return -1;
+        if(0 > (config.Normalize ? llai::load_docs(docs, normalization(config), dictionary, arena, idf_scores, weighted) : llai::load_docs(docs, dictionary, idf_scores, weighted))
+         || 0 > llai::build_index(weighted, (uint32_t)dictionary.Terms.size(), index))
+            return -1;
+        weigh   = llai::query_weighter(dictionary, idf_scores, normalization(config));
+        view    = llai::index_view(index);
+    }
+    printf("Index ready in %.2f s: %u documents.\n", std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count(), (uint32_t)view.DocNorms.size());
+    llai::QueryServer       server;
+    if(0 > llai::server_start(server, config.Server, view, weigh))
+        return -1;
+    if(config.Server.UnixPath.size())
+        printf("Listening on '%s'.\n", config.Server.UnixPath.c_str());
+    else
+        printf("Listening on 127.0.0.1:%u.\n", server.Port);
+    fflush(stdout);
+    std::signal(SIGINT, request_stop);
+    std::signal(SIGTERM, request_stop);
+    for(uint32_t elapsed = 0; not stopRequested.load(); ) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        if(config.ReportSeconds && 0 == ++elapsed % (config.ReportSeconds * 10)) {
+            llai::ServerStats       stats;
+            llai::server_stats(server, stats);
+            print_stats("", stats);
+            fflush(stdout);
+        }
+    }
+    llai::ServerStats       stats;
+    llai::server_stats(server, stats);
+    llai::server_stop(server);
+    print_stats("Stopped after ", stats);
+    if(config.IndexPath.size())
+        llai::close_index(mapped);
+    return 0;
+}
+
+static  int32_t         load            (const ServeConfig & config) {
+    string                  text;
+    vector<string_view>     queries;
+    if(0 > read_lines(config.QueriesPath, text, queries))
+        return -1;
+    llai::LoadReport        report;
+    const int32_t           result      = llai::run_load(config.Load, queries, report);
+    printf("%llu requests in %.2f s over %u connections: %.0f per second, p50 %.1f us, p99 %.1f us, max %.1f us, %llu errors.\n"
+        , (unsigned long long)report.Requests, report.Seconds, config.Load.Connections, report.Seconds ? report.Requests / report.Seconds : 0.0
+        , report.P50Us, report.P99Us, report.MaxUs, (unsigned long long)report.Errors);
+    llai::QueryClient       client;
+    llai::ServerStats       stats;
+    if(0 > llai::client_connect(client, config.Load.UnixPath, config.Load.Port) || 0 > llai::client_stats(client, stats))
+        return -1;
+    llai::client_close(client);
+    print_stats("Server: ", stats);
+    return result;
+}
+
+static  int32_t         write_statistics(const ServeConfig & config) {
+    string                  text;
+    vector<string_view>     docs;
+    llai::IndexShard        shard;
+    llai::ShardStatistics   statistics;
+    if(0 > read_lines(config.DocsPath, text, docs) || 0 > llai::load_shard(docs, 0, shard, normalization(config)) || 0 > llai::shard_statistics(shard, statistics)
+     || 0 > llai::save_statistics(config.OutputPath.c_str(), statistics))
+        return -1;
+    printf("%u documents, %u terms.\n", statistics.DocCount, (uint32_t)statistics.Terms.size());
+    return 0;
+}
+
+static  int32_t         write_shard     (const ServeConfig & config) {
+    string                          text;
+    vector<string_view>             docs;
+    llai::IndexShard                shard;
+    vector<llai::ShardStatistics>   statistics  (config.StatisticsPaths.size());
+    llai::StringArena               arena;
+    llai::GlobalStatistics          global;
+    if(0 > read_lines(config.DocsPath, text, docs) || 0 > llai::load_shard(docs, 0, shard, normalization(config)))
+        return -1;
+    for(uint32_t iShard = 0; iShard < statistics.size(); ++iShard)
+        if(0 > llai::load_statistics(config.StatisticsPaths[iShard].c_str(), statistics[iShard], arena))
+            return -1;
+    if(0 > llai::merge_statistics(statistics, global) || 0 > llai::finish_shard(shard, global)
+     || 0 > llai::save_index(config.OutputPath.c_str(), global.Dictionary, global.IdfScores, shard.Weighted, shard.Index))
+        return -1;
+    printf("%u of %u documents, %u terms.\n", (uint32_t)docs.size(), global.DocCount, (uint32_t)global.IdfScores.size());
+    return 0;
+}
+
+static  int32_t         gather          (const ServeConfig & config) {
+    static  constexpr uint32_t      BATCH_SIZE  = 1024;
+    string                          text;
+    vector<string_view>             queries;
+    vector<llai::ShardEndpoint>     endpoints;
+    for(const string & shard : config.Shards) {
+        char *              end         = 0;
+        const unsigned long port        = std::strtoul(shard.c_str(), &end, 10);
+        if(*end || 0 == port || port > UINT16_MAX)
+            endpoints.push_back({{}, shard, 0});
+        else
+            endpoints.push_back({{}, "", (uint16_t)port});
+    }
+    llai::ShardCoordinator          coordinator;
+    if(0 > read_lines(config.QueriesPath, text, queries) || 0 > llai::coordinator_start(coordinator, endpoints, {}, config.Load.Connections))
+        return -1;
+    vector<vector<llai::ScoredDoc>> results;
+    char                            number      [64];
+    const auto                      start       = std::chrono::steady_clock::now();
+    for(uint32_t begin = 0; begin < queries.size(); begin += BATCH_SIZE) {
+        const uint32_t                  count       = std::min(BATCH_SIZE, (uint32_t)queries.size() - begin);
+        if(0 > llai::coordinator_query(coordinator, std::span(queries).subspan(begin, count), config.Load.K, results)) {
+            llai::coordinator_stop(coordinator);
+            return -1;
+        }
+        for(const vector<llai::ScoredDoc> & answer : results) {     // Same format as the answers of the server
+            printf("%u", (uint32_t)answer.size());
+            for(const llai::ScoredDoc & result : answer) {
+                snprintf(number, sizeof(number), " %u %.17g", result.Doc, result.Score);
+                fputs(number, stdout);
+            }
+            fputc('\n', stdout);
+        }
+    }
+    const double                    seconds     = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    fprintf(stderr, "%u queries over %u shards of %u documents and %u connections each in %.2f s: %.0f per second.\n"
+        , (uint32_t)queries.size(), (uint32_t)endpoints.size(), coordinator.DocCount, coordinator.Lanes, seconds, seconds ? queries.size() / seconds : 0.0);
+    llai::coordinator_stop(coordinator);
+    return 0;
+}
+
+static  int32_t         parse_args      (int argc, char ** argv, ServeConfig & config) {
+    if(argc > 1)
+        config.Mode = argv[1];
+    for(int iArg = 2; iArg < argc; ++iArg) {
+        const string_view   arg         = argv[iArg];
+        if(arg == "--normalize") {
+            config.Normalize = true;
+            continue;
+        }
+        if(arg == "--help" || iArg + 1 >= argc) {
+            config.Mode.clear();
+            break;
+        }
+        const char *        value       = argv[++iArg];
+        const uint32_t      number      = (uint32_t)std::strtoul(value, 0, 10);
+        if     (arg == "--docs"          ) config.DocsPath               = value;
+        else if(arg == "--index"         ) config.IndexPath              = value;
+        else if(arg == "--queries"       ) config.QueriesPath            = value;
+        else if(arg == "--output"        ) config.OutputPath             = value;
+        else if(arg == "--statistics"    ) config.StatisticsPaths        = split_list(value);
+        else if(arg == "--shards"        ) config.Shards                 = split_list(value);
+        else if(arg == "--unix"          ) config.Server.UnixPath        = config.Load.UnixPath = value;
+        else if(arg == "--port"          ) config.Server.Port            = config.Load.Port = (uint16_t)number;
+        else if(arg == "--workers"       ) config.Server.Workers         = number;
+        else if(arg == "--batch"         ) config.Server.MaxBatch        = max(1u, number);
+        else if(arg == "--window-us"     ) config.Server.BatchWindowUs   = number;
+        else if(arg == "--cache"         ) config.Server.CacheEntries    = number;
+        else if(arg == "--report-s"      ) config.ReportSeconds          = number;
+        else if(arg == "--connections"   ) config.Load.Connections       = max(1u, number);
+        else if(arg == "--requests"      ) config.Load.Requests          = number;
+        else if(arg == "--k"             ) config.Load.K                 = max(1u, number);
+        else {
+            log_error("Unknown option '%s'.", argv[iArg - 1]);
+            return -1;
+        }
+    }
+    const bool          serving     = config.Mode == "serve" && (config.DocsPath.size() || config.IndexPath.size());
+    const bool          loading     = config.Mode == "load" && config.QueriesPath.size() && (config.Load.UnixPath.size() || config.Load.Port);
+    const bool          counting    = config.Mode == "stats" && config.DocsPath.size() && config.OutputPath.size();
+    const bool          sharding    = config.Mode == "index" && config.DocsPath.size() && config.StatisticsPaths.size() && config.OutputPath.size();
+    const bool          gathering   = config.Mode == "gather" && config.QueriesPath.size() && config.Shards.size();
+    if(not serving && not loading && not counting && not sharding && not gathering) {
+        printf("Usage: llai_server serve (--docs FILE | --index FILE) [--normalize] (--unix PATH | --port N) [--workers N] [--batch N] [--window-us N]\n"
+               "                         [--cache ENTRIES] [--report-s N]\n"
+               "       llai_server load --queries FILE (--unix PATH | --port N) [--connections N] [--requests N] [--k N]\n"
+               "       llai_server stats --docs FILE --output FILE [--normalize]\n"
+               "       llai_server index --docs FILE --statistics FILE,FILE... --output FILE [--normalize]\n"
+               "       llai_server gather --shards PORT|PATH,PORT|PATH... --queries FILE [--k N] [--connections N]\n"
+               "serve answers queries until interrupted. load replays the queries, one per line, against a running server and prints\n"
+               "the latencies seen by the clients and the statistics of the server.\n"
+               "A corpus split into shard files is indexed in two steps: stats writes the document frequencies of one shard, and index\n"
+               "merges the statistics of every shard, listed in document order, and saves the index of one shard for serve --index.\n"
+               "--normalize folds case and accents and stems terms. Every shard of a corpus, and serve --index over its shards, must\n"
+               "be given the same flag.\n"
+               "gather sends the queries to shard servers listed in document order and prints the merged answers, one line per query.\n"
+               "Each shard gets --connections pipelined connections, so that its server can batch their requests together.\n"
+               );
+        return -1;
+    }
+    return 0;
+}
+
+int main(int argc, char ** argv) {
+    ServeConfig             config;
+    if(0 > parse_args(argc, argv, config))
+        return -1;
+    if("stats" == config.Mode)
+        return write_statistics(config);
+    if("index" == config.Mode)
+        return write_shard(config);
+    if("gather" == config.Mode)
+        return gather(config);
+    return ("serve" == config.Mode) ? serve(config) : load(config);
+}
@@ -1,6 +1,38 @@
-#include "llai_ranking.h"
+#include "llai_index.h"
+#include "llai_parallel.h"
+#include "llai_incremental.h"
+#include "llai_mapped.h"
+#include "llai_stream.h"
+#include "llai_batch.h"
+#include "llai_join.h"
+#include "llai_pmr.h"
+#include "llai_quantize.h"
+#include "llai_sketch.h"
+#include "llai_normalize.h"
+#include "llai_server.h"
+#include "llai_shard.h"
+#include "llai_metrics.h"
 #include "llai_log.h"
 
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <random>
+#include <string>
+#include <thread>
+#include <unordered_set>
+
+#ifdef _WIN32
+#   include <io.h>
+#   include <fcntl.h>
+#   include <share.h>
+#else
+#   include <fcntl.h>
+#   include <unistd.h>
+#endif
+
 using std::string_view, std::vector, std::unordered_map, std::size, std::span;
 
 static int32_t  test_query  (const llai::TokenWeightMap & idf_scores, const span<const llai::TokenWeightMap> weighted, const string_view queryToMatch) {
@@ -34,6 +66,1153 @@ static int32_t  test_query  (const llai::TokenWeightMap & idf_scores, const span
     return bestMatch; // Return the index of the best matching document
 }
 
+static int32_t  test_query  (const llai::TermDictionary & dictionary, const span<const double> idf_scores, const llai::SparseMatrix & weighted, const string_view queryToMatch) {
+    vector<llai::TokenRange>    query_token_ranges;
+    llai::SparseVector          query_term_frequencies;
+    llai::SparseVector          query_weighted;
+    llai::tokenize(queryToMatch, query_token_ranges);
+    llai::term_frequency(queryToMatch, query_token_ranges, dictionary, query_term_frequencies);
+    llai::weight_terms(llai::sparse_row(query_term_frequencies), idf_scores, query_weighted); // Weight terms: TF * IDF
+    int32_t                     bestMatch       = -1;
+    double                      bestSimilarity  = 0;
+    for(uint32_t iDoc = 0; iDoc < llai::sparse_rows(weighted); ++iDoc) {     // Cosine similarity between weighted vectors
+        const double similarity = llai::cosine_similarity(llai::sparse_row(query_weighted), llai::sparse_row(weighted, iDoc));
+        if(bestSimilarity < similarity) {
+            bestSimilarity = similarity;
+            bestMatch      = iDoc;
+		}
+    }
+    return bestMatch; // Return the index of the best matching document
+}
+
+// The sparse path must rank like the TokenWeightMap path. Sums run in a different order, so near-ties may swap.
+static int32_t  test_sparse (span<const string_view> docs, span<const string_view> queries) {
+    llai::TokenWeightMap            map_idf_scores;
+    vector<llai::TokenWeightMap>    map_weighted;           
+    map_weighted.resize(size(docs));
+	llai::load_docs(docs, map_idf_scores, map_weighted);
+    llai::TermDictionary            dictionary;
+    vector<double>                  idf_scores;
+    llai::SparseMatrix              weighted;
+	llai::load_docs(docs, dictionary, idf_scores, weighted);
+    for(const auto & queryToMatch : queries) {
+        const int32_t               mapMatch        = test_query(map_idf_scores, map_weighted, queryToMatch);
+        const int32_t               sparseMatch     = test_query(dictionary, idf_scores, weighted, queryToMatch);
+        if(mapMatch == sparseMatch)
+            continue;
+        llai::TokenWeightMap        query_weighted;
+        {
+            vector<llai::TokenRange>    query_token_ranges;
+            llai::TokenWeightMap        query_term_frequencies;   
+            llai::TokenWeightLimits     query_freq_limits;        
+            llai::tokenize(queryToMatch, query_token_ranges);
+            llai::term_frequency(queryToMatch, query_token_ranges, query_term_frequencies, query_freq_limits);
+            llai::weight_terms(query_term_frequencies, map_idf_scores, query_weighted);
+        }
+        const double                mapSimilarity   = (mapMatch    < 0) ? 0 : llai::cosine_similarity(query_weighted, map_weighted[mapMatch]);
+        const double                sparseSimilarity= (sparseMatch < 0) ? 0 : llai::cosine_similarity(query_weighted, map_weighted[sparseMatch]);
+        if(fabs(mapSimilarity - sparseSimilarity) > 1e-12) {
+            log_error("Sparse match %i differs from map match %i for query: '%.*s'.", sparseMatch, mapMatch, (int)queryToMatch.size(), queryToMatch.data());
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// query_top_k must return the same documents, in the same order, as scoring every document.
+static int32_t  test_index  (span<const string_view> docs, span<const string_view> queries, uint32_t k) {
+    llai::TermDictionary            dictionary;
+    vector<double>                  idf_scores;
+    llai::SparseMatrix              weighted;
+    llai::InvertedIndex             index;
+	llai::load_docs(docs, dictionary, idf_scores, weighted, index);
+    vector<llai::TokenRange>        query_token_ranges;
+    llai::SparseVector              query_term_frequencies;
+    llai::SparseVector              query_weighted;
+    vector<llai::ScoredDoc>         expected;
+    vector<llai::ScoredDoc>         results;
+    for(const auto & queryToMatch : queries) {
+        query_token_ranges.clear();
+        llai::tokenize(queryToMatch, query_token_ranges);
+        llai::term_frequency(queryToMatch, query_token_ranges, dictionary, query_term_frequencies);
+        llai::weight_terms(llai::sparse_row(query_term_frequencies), idf_scores, query_weighted);
+        expected.clear();
+        for(uint32_t iDoc = 0; iDoc < llai::sparse_rows(weighted); ++iDoc) {
+            const double similarity = llai::cosine_similarity(llai::sparse_row(query_weighted), llai::sparse_row(weighted, iDoc));
+            if(similarity > 0)
+                llai::push_top_k(expected, k, {iDoc, similarity});
+        }
+        llai::sort_top_k(expected);
+        llai::query_top_k(index, llai::sparse_row(query_weighted), k, results);
+        bool matches = expected.size() == results.size();
+        for(uint32_t iResult = 0; matches && iResult < results.size(); ++iResult)
+            matches = fabs(expected[iResult].Score - results[iResult].Score) <= 1e-12;
+        if(not matches) {
+            log_error("Top-%u results differ from the exhaustive ranking for query: '%.*s'.", k, (int)queryToMatch.size(), queryToMatch.data());
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// Every tokenizer implementation the CPU supports must produce the same ranges and stop position as the scalar one.
+static int32_t  test_tokenize   (span<const string_view> texts) {
+    const string_view               terminators[]   = {"", ".", "s", "phone", "\n\n"};
+    std::mt19937                    random          (12345);
+    vector<std::string>             generated;
+    for(uint32_t iText = 0; iText < 256; ++iText) {     // Random bytes, including high and control characters, over every tail length.
+        std::string & text = generated.emplace_back(iText, ' ');
+        for(auto & c : text)
+            c = (char)(random() % 4 ? 'a' + random() % 26 : random() % 256);
+    }
+    vector<llai::TokenRange>        expected;
+    vector<llai::TokenRange>        results;
+    auto                            check           = [&](const string_view & text) {
+        for(const auto & terminator : terminators) {
+            expected.clear();
+            const int32_t expectedEnd = llai::tokenize(llai::TokenizerIsa::Scalar, text, expected, terminator);
+            for(uint8_t isa = 1; isa <= (uint8_t)llai::tokenizer_isa(); ++isa) {
+                results.clear();
+                const int32_t end = llai::tokenize((llai::TokenizerIsa)isa, text, results, terminator);
+                bool matches = end == expectedEnd && results.size() == expected.size();
+                for(uint32_t iToken = 0; matches && iToken < results.size(); ++iToken)
+                    matches = results[iToken].Offset == expected[iToken].Offset && results[iToken].Size == expected[iToken].Size;
+                if(not matches) {
+                    log_error("Tokenizer %u differs from scalar with terminator '%.*s' for text: '%.*s'.", isa, (int)terminator.size(), terminator.data(), (int)text.size(), text.data());
+                    return -1;
+                }
+            }
+        }
+        return 0;
+    };
+    for(const auto & text : texts)
+        if(0 > check(text))
+            return -1;
+    for(const auto & text : generated)
+        if(0 > check(text))
+            return -1;
+    return 0;
+}
+
+// Documents made of 1 to maxParts sample documents picked at random. The same seed always gives the same documents.
+static vector<std::string>  random_documents(span<const string_view> docs, uint32_t count, uint32_t maxParts, uint32_t seed) {
+    std::mt19937                    random          (seed);
+    vector<std::string>             texts           (count);
+    for(auto & text : texts)
+        for(uint32_t iPart = 0, parts = 1 + random() % maxParts; iPart < parts; ++iPart)
+            text.append(docs[random() % size(docs)]).append(" ");
+    return texts;
+}
+
+struct TestCorpus {
+    vector<std::string>             Texts;
+    vector<string_view>             Views;
+    llai::TermDictionary            Dictionary;
+    vector<double>                  IdfScores;
+    llai::SparseMatrix              Weighted;
+};
+
+// random_documents loaded with load_docs, for tests that need more documents than the samples.
+static int32_t  build_corpus    (span<const string_view> docs, uint32_t count, uint32_t maxParts, uint32_t seed, TestCorpus & corpus) {
+    corpus.Texts    = random_documents(docs, count, maxParts, seed);
+    corpus.Views.assign(corpus.Texts.begin(), corpus.Texts.end());
+    return llai::load_docs(corpus.Views, corpus.Dictionary, corpus.IdfScores, corpus.Weighted);
+}
+
+// The parallel load_docs must match the serial one bit for bit. Builds a larger corpus out of the sample sentences so every thread gets work.
+static int32_t  test_parallel   (span<const string_view> docs) {
+    TestCorpus                      corpus;
+    if(0 > build_corpus(docs, 5000, 4, 777, corpus))
+        return -1;
+    const vector<string_view>     & views           = corpus.Views;
+    const llai::TermDictionary    & dictionary      = corpus.Dictionary;
+    const vector<double>          & idf_scores      = corpus.IdfScores;
+    const llai::SparseMatrix      & weighted        = corpus.Weighted;
+    for(const uint32_t threadCount : {1u, 3u, 8u, 0u}) {
+        llai::TermDictionary            parallelDictionary;
+        vector<double>                  parallelIdf;
+        llai::SparseMatrix              parallelWeighted;
+        if(0 > llai::load_docs(views, parallelDictionary, parallelIdf, parallelWeighted, threadCount)
+            || parallelDictionary.Terms != dictionary.Terms
+            || parallelIdf.size() != idf_scores.size()              || memcmp(parallelIdf.data(), idf_scores.data(), idf_scores.size() * sizeof(double))
+            || parallelWeighted.Offsets != weighted.Offsets         || parallelWeighted.Terms != weighted.Terms
+            || memcmp(parallelWeighted.Weights.data(), weighted.Weights.data(), weighted.Weights.size() * sizeof(double))
+            ) {
+            log_error("Parallel load_docs with %u threads differs from the serial one.", threadCount);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// Rankings from the incremental index must match a static index rebuilt from the live documents, before and after removals.
+static int32_t  test_incremental(span<const string_view> docs, span<const string_view> queries, uint32_t k) {
+    llai::IncrementalIndex          incremental;
+    llai::add_document(incremental, docs[0]);
+    llai::add_documents(incremental, docs.subspan(1));
+    vector<std::pair<uint32_t, uint32_t>>   liveDocs;   // Text index, incremental document id
+    for(uint32_t iDoc = 0; iDoc < size(docs); ++iDoc)
+        liveDocs.push_back({iDoc, iDoc});
+    auto                            check       = [&]() {
+        vector<string_view>             liveTexts;
+        for(const auto & [iText, iDoc] : liveDocs)
+            liveTexts.push_back(docs[iText]);
+        llai::TermDictionary            dictionary;
+        vector<double>                  idf_scores;
+        llai::SparseMatrix              weighted;
+        llai::InvertedIndex             index;
+        llai::load_docs(liveTexts, dictionary, idf_scores, weighted, index);
+        vector<llai::TokenRange>        query_token_ranges;
+        llai::SparseVector              query_term_frequencies;
+        llai::SparseVector              query_weighted;
+        vector<llai::ScoredDoc>         expected;
+        vector<llai::ScoredDoc>         results;
+        for(const auto & queryToMatch : queries) {
+            query_token_ranges.clear();
+            llai::tokenize(queryToMatch, query_token_ranges);
+            llai::term_frequency(queryToMatch, query_token_ranges, dictionary, query_term_frequencies);
+            llai::weight_terms(llai::sparse_row(query_term_frequencies), idf_scores, query_weighted);
+            llai::query_top_k(index, llai::sparse_row(query_weighted), k, expected);
+            llai::query_top_k(incremental, queryToMatch, k, results);
+            bool matches = expected.size() == results.size();
+            for(uint32_t iResult = 0; matches && iResult < results.size(); ++iResult)
+                matches = liveDocs[expected[iResult].Doc].second == results[iResult].Doc && fabs(expected[iResult].Score - results[iResult].Score) <= 1e-12;
+            if(not matches) {
+                log_error("Incremental top-%u results differ from a rebuilt index for query: '%.*s'.", k, (int)queryToMatch.size(), queryToMatch.data());
+                return -1;
+            }
+        }
+        return 0;
+    };
+    if(0 > check())
+        return -1;
+    for(uint32_t iDoc = 0; iDoc < size(docs); iDoc += 3) {
+        llai::remove_document(incremental, iDoc);
+        liveDocs.erase(std::find(liveDocs.begin(), liveDocs.end(), std::pair{iDoc, iDoc}));
+    }
+    if(0 > check() || 0 > llai::compact_index(incremental) || 0 > check())
+        return -1;
+    // Built on another thread while queries run, then swapped in after more documents come and go.
+    llai::IndexCompaction           compaction;
+    for(uint32_t iDoc = 1; iDoc < size(docs); iDoc += 5)
+        if(iDoc % 3) {
+            llai::remove_document(incremental, iDoc);
+            liveDocs.erase(std::find(liveDocs.begin(), liveDocs.end(), std::pair{iDoc, iDoc}));
+        }
+    if(0 > llai::snapshot_compaction(incremental, compaction))
+        return -1;
+    int32_t                         built       = -1;
+    std::thread                     builder     ([&compaction, &built]() { built = llai::build_compaction(compaction); });
+    const int32_t                   checked     = check();
+    builder.join();
+    if(0 > checked || 0 > built)
+        return -1;
+    llai::remove_document(incremental, 2);
+    liveDocs.erase(std::find(liveDocs.begin(), liveDocs.end(), std::pair{2U, 2U}));
+    liveDocs.push_back({0, (uint32_t)llai::add_document(incremental, docs[0])});
+    if(0 > llai::apply_compaction(incremental, compaction) || 0 > check() || 0 > llai::compact_index(incremental) || incremental.RemovedPostings || 0 > check())
+        return -1;
+    liveDocs.push_back({1, (uint32_t)llai::add_document(incremental, docs[1])});
+    return check();
+}
+
+// A saved and mapped index must answer like the in-memory one, and a damaged file must fail verification or the structural checks.
+static int32_t  test_mapped     (span<const string_view> docs, span<const string_view> queries, uint32_t k) {
+    llai::TermDictionary            dictionary;
+    vector<double>                  idf_scores;
+    llai::SparseMatrix              weighted;
+    llai::InvertedIndex             index;
+	llai::load_docs(docs, dictionary, idf_scores, weighted, index);
+    const std::string               path        = (std::filesystem::temp_directory_path() / "llai_test.index").string();
+    llai::MappedIndex               mapped;
+    if(0 > llai::save_index(path.c_str(), dictionary, idf_scores, weighted, index) || 0 > llai::open_index(path.c_str(), mapped)) {
+        log_error("Failed to save or open '%s'.", path.c_str());
+        return -1;
+    }
+    int32_t                         result      = 0;
+    for(uint32_t term = 0; 0 == result && term < dictionary.Terms.size(); ++term)
+        if(llai::find_term(mapped, dictionary.Terms[term]) != (int32_t)term || llai::mapped_term(mapped, term) != dictionary.Terms[term])
+            result = -1;
+    for(uint32_t iDoc = 0; 0 == result && iDoc < llai::sparse_rows(weighted); ++iDoc) {
+        const llai::SparseRow row = llai::sparse_row(weighted, iDoc), mappedRow = llai::sparse_row(mapped.Documents, iDoc);
+        if(not std::equal(row.Terms.begin(), row.Terms.end(), mappedRow.Terms.begin(), mappedRow.Terms.end()) || not std::equal(row.Weights.begin(), row.Weights.end(), mappedRow.Weights.begin(), mappedRow.Weights.end()))
+            result = -1;
+    }
+    vector<llai::TokenRange>        query_token_ranges;
+    llai::SparseVector              query_term_frequencies;
+    llai::SparseVector              query_weighted;
+    vector<llai::ScoredDoc>         expected;
+    vector<llai::ScoredDoc>         results;
+    for(uint32_t iQuery = 0; 0 == result && iQuery < size(queries); ++iQuery) {
+        const auto & queryToMatch = queries[iQuery];
+        query_token_ranges.clear();
+        llai::tokenize(queryToMatch, query_token_ranges);
+        llai::term_frequency(queryToMatch, query_token_ranges, dictionary, query_term_frequencies);
+        llai::weight_terms(llai::sparse_row(query_term_frequencies), idf_scores, query_weighted);
+        llai::query_top_k(index, llai::sparse_row(query_weighted), k, expected);
+        llai::query_top_k(mapped, queryToMatch, k, results);
+        bool matches = expected.size() == results.size();
+        for(uint32_t iResult = 0; matches && iResult < results.size(); ++iResult)
+            matches = expected[iResult].Doc == results[iResult].Doc && expected[iResult].Score == results[iResult].Score;
+        if(not matches)
+            result = -1;
+    }
+    if(0 == result) {   // Saving over a mapped file must not change what the mapping reads.
+        llai::TermDictionary            otherDictionary;
+        vector<double>                  otherIdf;
+        llai::SparseMatrix              otherWeighted;
+        llai::InvertedIndex             otherIndex;
+        llai::load_docs(docs.subspan(size(docs) / 2), otherDictionary, otherIdf, otherWeighted, otherIndex);
+        if(0 > llai::save_index(path.c_str(), otherDictionary, otherIdf, otherWeighted, otherIndex) || std::filesystem::exists(path + ".tmp"))
+            result = -1;
+        for(uint32_t term = 0; 0 == result && term < mapped.Header->TermCount; ++term)     // The queries above interned terms of their own.
+            if(llai::mapped_term(mapped, term) != dictionary.Terms[term])
+                result = -1;
+        llai::close_index(mapped);
+        if(0 == result && (0 > llai::open_index(path.c_str(), mapped) || mapped.Header->DocCount != llai::sparse_rows(otherWeighted)))
+            result = -1;
+    }
+    llai::close_index(mapped);
+    if(0 == result) {   // Swap two sections of the same size in the header: the checksum covers the header too.
+        llai::IndexFileHeader   header  = {};
+        std::fstream file(path, std::ios::in | std::ios::out | std::ios::binary);
+        file.read((char *)&header, sizeof(header));
+        std::swap(header.Sections[llai::INDEX_SECTION_DOC_WEIGHTS], header.Sections[llai::INDEX_SECTION_POSTING_WEIGHTS]);
+        file.seekp(0);
+        file.write((const char *)&header, sizeof(header));
+        file.close();
+        if(0 == llai::open_index(path.c_str(), mapped)) {
+            llai::close_index(mapped);
+            result = -1;
+        }
+        std::swap(header.Sections[llai::INDEX_SECTION_DOC_WEIGHTS], header.Sections[llai::INDEX_SECTION_POSTING_WEIGHTS]);
+        file.open(path, std::ios::in | std::ios::out | std::ios::binary);
+        file.write((const char *)&header, sizeof(header));
+        file.close();
+        if(0 == result && 0 > llai::open_index(path.c_str(), mapped))
+            result = -1;
+        llai::close_index(mapped);
+    }
+    if(0 == result) {   // Flip one byte of the payload.
+        std::fstream file(path, std::ios::in | std::ios::out | std::ios::binary);
+        file.seekg(-1, std::ios::end);
+        const char last = (char)file.get();
+        file.seekp(-1, std::ios::end);
+        file.put(last ^ 1);
+        file.close();
+        if(0 == llai::open_index(path.c_str(), mapped)) {
+            llai::close_index(mapped);
+            result = -1;
+        }
+    }
+    if(0 == result) {   // A full term table would make find_term loop forever, even on an open that skips the checksum.
+        llai::IndexFileHeader   header  = {};
+        std::fstream file(path, std::ios::in | std::ios::out | std::ios::binary);
+        file.read((char *)&header, sizeof(header));
+        const llai::IndexSection & hash = header.Sections[llai::INDEX_SECTION_TERM_HASH];
+        file.seekp(hash.Offset);
+        file.write(std::string(hash.Size, '\0').data(), hash.Size);
+        file.close();
+        if(0 == llai::open_index(path.c_str(), mapped, false)) {
+            llai::close_index(mapped);
+            result = -1;
+        }
+    }
+    std::filesystem::remove(path);
+    if(0 > result)
+        log_error("Mapped index '%s' does not match the in-memory index.", path.c_str());
+    return result;
+}
+
+// The batched product must return exactly what query_top_k returns for each query on its own. The corpus spans several document
+// blocks, and the longer generated queries go through the product instead of MaxScore.
+static int32_t  test_batch      (span<const string_view> docs, span<const string_view> sampleQueries, uint32_t k) {
+    TestCorpus                      corpus;
+    llai::InvertedIndex             index;
+    if(0 > build_corpus(docs, 3000, 3, 778, corpus) || 0 > llai::build_index(corpus.Weighted, (uint32_t)corpus.Dictionary.Terms.size(), index))
+        return -1;
+    const llai::TermDictionary    & dictionary      = corpus.Dictionary;
+    const vector<double>          & idf_scores      = corpus.IdfScores;
+    const vector<std::string>       generated       = random_documents(docs, 200, 6, 7780);
+    vector<string_view>             queries         (sampleQueries.begin(), sampleQueries.end());
+    queries.insert(queries.end(), generated.begin(), generated.end());
+    llai::SparseMatrix              weightedQueries;
+    if(0 > llai::weight_queries(queries, dictionary, idf_scores, weightedQueries, 1))
+        return -1;
+    vector<vector<llai::ScoredDoc>> expected    (size(queries));
+    for(uint32_t iQuery = 0; iQuery < size(queries); ++iQuery)
+        llai::query_top_k(index, llai::sparse_row(weightedQueries, iQuery), k, expected[iQuery]);
+    for(const uint32_t threadCount : {1u, 3u, 0u}) {
+        vector<vector<llai::ScoredDoc>> results;
+        if(0 > llai::query_top_k(llai::index_view(index), queries, dictionary, idf_scores, k, results, threadCount))
+            return -1;
+        bool                            matches     = results.size() == expected.size();
+        for(uint32_t iQuery = 0; matches && iQuery < results.size(); ++iQuery) {
+            matches = results[iQuery].size() == expected[iQuery].size();
+            for(uint32_t iResult = 0; matches && iResult < results[iQuery].size(); ++iResult)
+                matches = results[iQuery][iResult].Doc == expected[iQuery][iResult].Doc && results[iQuery][iResult].Score == expected[iQuery][iResult].Score;
+        }
+        if(not matches) {
+            log_error("Batched top-%u on %u threads differs from query_top_k.", k, threadCount);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// The similarity join must find the same pairs, with the same scores, as comparing every pair of documents.
+static int32_t  test_join       (span<const string_view> docs) {
+    TestCorpus                      corpus;
+    if(0 > build_corpus(docs, 1500, 3, 779, corpus))
+        return -1;
+    const vector<string_view>     & views           = corpus.Views;
+    const llai::SparseMatrix      & weighted        = corpus.Weighted;
+    auto                            by_docs         = [](const llai::SimilarPair & a, const llai::SimilarPair & b) { return a.DocA < b.DocA || (a.DocA == b.DocA && a.DocB < b.DocB); };
+    for(const double threshold : {0.2, 0.5, 0.9}) {
+        vector<llai::SimilarPair>       expected;
+        for(uint32_t iDocA = 0; iDocA < size(views); ++iDocA)
+            for(uint32_t iDocB = iDocA + 1; iDocB < size(views); ++iDocB) {
+                const double similarity = llai::cosine_similarity(llai::sparse_row(weighted, iDocA), llai::sparse_row(weighted, iDocB));
+                if(similarity >= threshold)
+                    expected.push_back({iDocA, iDocB, similarity});
+            }
+        for(const uint32_t threadCount : {1u, 3u}) {
+            vector<llai::SimilarPair>       pairs;
+            if(0 > llai::similarity_join(weighted, threshold, [&pairs](span<const llai::SimilarPair> found) { pairs.insert(pairs.end(), found.begin(), found.end()); return 0; }, threadCount, 100))
+                return -1;
+            sort(pairs.begin(), pairs.end(), by_docs);
+            bool                            matches     = pairs.size() == expected.size();
+            for(uint32_t iPair = 0; matches && iPair < pairs.size(); ++iPair)
+                matches = pairs[iPair].DocA == expected[iPair].DocA && pairs[iPair].DocB == expected[iPair].DocB && pairs[iPair].Score == expected[iPair].Score;
+            if(not matches) {
+                log_error("Similarity join at %f on %u threads found %u pairs, expected %u.", threshold, threadCount, (uint32_t)pairs.size(), (uint32_t)expected.size());
+                return -1;
+            }
+        }
+    }
+    return 0;
+}
+
+// The arena-backed maps must hold the same values as the TokenWeightMap path, and reloading with warmed-up scratch must not allocate.
+static int32_t  test_pmr        (span<const string_view> docs) {
+    const vector<std::string>       texts           = random_documents(docs, 2000, 3, 780);
+    const vector<string_view>       views           (texts.begin(), texts.end());
+    llai::TokenWeightMap            idf_scores;
+    vector<llai::TokenWeightMap>    weighted        (size(views));
+    llai::load_docs(views, idf_scores, weighted);
+    auto                            same_values     = [](const auto & a, const auto & b) {
+        if(a.size() != b.size())
+            return false;
+        for(const auto & [term, value] : a) {
+            const auto found = b.find(term);
+            if(found == b.end() || found->second != value)
+                return false;
+        }
+        return true;
+    };
+    vector<llai::TokenWeightMap>    reloaded        (weighted);     // Loading into filled maps replaces what they held.
+    llai::TokenWeightMap            reloadedIdf;
+    reloaded[0]["zzqx"] = 1;
+    llai::load_docs(views, reloadedIdf, reloaded);
+    if(not same_values(reloaded[0], weighted[0]) || not same_values(reloaded.back(), weighted.back())) {
+        log_error("%s", "load_docs kept weights from before.");
+        return -1;
+    }
+    for(const uint32_t threadCount : {1u, 3u}) {
+        vector<llai::MapScratch>        scratch         (threadCount);
+        for(uint32_t iLoad = 0; iLoad < 2; ++iLoad) {
+            uint64_t                        allocations     = 0;
+            for(const auto & local : scratch)
+                allocations += local.Counter.Allocations;
+            llai::PmrWeightedCorpus         pmrCorpus;
+            if(0 > llai::load_docs(views, pmrCorpus, scratch))
+                return -1;
+            bool                            matches         = same_values(idf_scores, pmrCorpus.IdfScores);
+            for(uint32_t iDoc = 0; matches && iDoc < size(views); ++iDoc)
+                matches = same_values(weighted[iDoc], pmrCorpus.Documents[iDoc])
+                    && fabs(llai::cosine_similarity(weighted[0], weighted[iDoc]) - llai::cosine_similarity(pmrCorpus.Documents[0], pmrCorpus.Documents[iDoc])) < 1e-12;    // Maps may iterate in other orders.
+            if(not matches) {
+                log_error("Arena-backed maps loaded on %u threads differ from load_docs.", threadCount);
+                return -1;
+            }
+            for(const auto & local : scratch)
+                allocations -= local.Counter.Allocations;
+            if(1 == threadCount && iLoad && allocations) {  // Threads may claim different documents on each load.
+                log_error("Reloading the corpus allocated %llu scratch blocks.", (unsigned long long)(0 - allocations));
+                return -1;
+            }
+        }
+    }
+    return 0;
+}
+
+static int32_t  test_metrics    (span<const string_view> docs) {
+#if LLAI_METRICS
+    uint64_t                        tokenCount      = 0;
+    uint64_t                        byteCount       = 0;
+    vector<llai::TokenRange>        tokenRanges;
+    for(const string_view document : docs) {
+        tokenRanges.clear();
+        llai::tokenize(document, tokenRanges);
+        tokenCount  += tokenRanges.size();
+        byteCount   += document.size();
+    }
+    auto                            check_load      = [&](const char * path, uint32_t tokenizeCalls, auto && load) {
+        llai::metrics_reset();
+        if(0 > load())
+            return -1;
+        llai::MetricsSnapshot           snapshot;
+        llai::metrics_snapshot(snapshot);
+        if(snapshot.Counters[llai::METRIC_COUNTER_DOCUMENTS] != size(docs) || snapshot.Counters[llai::METRIC_COUNTER_TOKENS] != tokenCount
+         || snapshot.Counters[llai::METRIC_COUNTER_BYTES] != byteCount || 0 == snapshot.Counters[llai::METRIC_COUNTER_TERMS]) {
+            log_error("The %s load counted %llu documents, %llu tokens and %llu bytes, expected %u, %llu and %llu.", path
+                , (unsigned long long)snapshot.Counters[llai::METRIC_COUNTER_DOCUMENTS], (unsigned long long)snapshot.Counters[llai::METRIC_COUNTER_TOKENS]
+                , (unsigned long long)snapshot.Counters[llai::METRIC_COUNTER_BYTES], (uint32_t)size(docs), (unsigned long long)tokenCount, (unsigned long long)byteCount
+                );
+            return -1;
+        }
+        if(snapshot.Stages[llai::METRIC_STAGE_TOKENIZE].Calls != tokenizeCalls) {
+            log_error("The %s load timed %llu tokenize calls, expected %u.", path, (unsigned long long)snapshot.Stages[llai::METRIC_STAGE_TOKENIZE].Calls, tokenizeCalls);
+            return -1;
+        }
+        for(uint32_t iStage = 0; iStage < llai::METRIC_STAGE_QUERY; ++iStage) {
+            const llai::StageMetrics &  stage       = snapshot.Stages[iStage];
+            uint64_t                    histogram   = 0;
+            for(const uint64_t bucket : stage.Histogram)
+                histogram += bucket;
+            if(0 == stage.Calls || histogram != stage.Calls || llai::metrics_percentile(stage, 50) > llai::metrics_percentile(stage, 99)) {
+                log_error("The %s load recorded %llu calls of stage %u and %llu in its histogram.", path, (unsigned long long)stage.Calls, iStage, (unsigned long long)histogram);
+                return -1;
+            }
+        }
+        return 0;
+    };
+    llai::TermDictionary            dictionary;
+    vector<double>                  idf_scores;
+    llai::SparseMatrix              weighted;
+    llai::InvertedIndex             index;
+    if(0 > check_load("sparse", (uint32_t)size(docs), [&]() { return llai::load_docs(docs, dictionary, idf_scores, weighted, index); }))
+        return -1;
+    llai::TermDictionary            parallelDictionary;
+    if(0 > check_load("parallel", (uint32_t)size(docs), [&]() { return llai::load_docs(docs, parallelDictionary, idf_scores, weighted, 3); }))
+        return -1;
+    llai::TokenWeightMap            idf_map;
+    vector<llai::TokenWeightMap>    weighted_maps   (size(docs));
+    if(0 > check_load("map", (uint32_t)size(docs), [&]() { return llai::load_docs(docs, idf_map, weighted_maps); }))
+        return -1;
+
+    llai::metrics_reset();
+    vector<llai::ScoredDoc>         results;
+    for(uint32_t iDoc = 0; iDoc < 3; ++iDoc)
+        llai::query_top_k(index, llai::sparse_row(weighted, iDoc), 5, results);
+    llai::MetricsSnapshot           snapshot;
+    llai::metrics_snapshot(snapshot);
+    if(3 != snapshot.Counters[llai::METRIC_COUNTER_QUERIES] || 3 != snapshot.Stages[llai::METRIC_STAGE_QUERY].Calls || snapshot.Counters[llai::METRIC_COUNTER_DOCUMENTS]) {
+        log_error("Recorded %llu queries in %llu calls, expected 3.", (unsigned long long)snapshot.Counters[llai::METRIC_COUNTER_QUERIES], (unsigned long long)snapshot.Stages[llai::METRIC_STAGE_QUERY].Calls);
+        return -1;
+    }
+    llai::metrics_dump(snapshot, stdout);
+    FILE                            * dump          = std::tmpfile();   // Stages the queries didn't touch have no percentiles.
+    std::string                     dumped          (4096, '\0');
+    if(0 == dump || 0 > llai::metrics_dump(snapshot, dump))
+        return -1;
+    std::rewind(dump);
+    dumped.resize(std::fread(dumped.data(), 1, dumped.size(), dump));
+    std::fclose(dump);
+    if(string_view::npos != dumped.find("< 0 ns") || string_view::npos == dumped.find("tokenize         calls 0, p50 n/a")) {
+        log_error("Stages without calls are dumped with percentiles:\n%s", dumped.c_str());
+        return -1;
+    }
+    {
+        metrics_time(idfTimer, llai::METRIC_STAGE_IDF);
+    }
+    llai::metrics_snapshot(snapshot);
+    if(1 != snapshot.Stages[llai::METRIC_STAGE_IDF].Calls) {
+        log_error("Timed %llu idf calls, expected 1.", (unsigned long long)snapshot.Stages[llai::METRIC_STAGE_IDF].Calls);
+        return -1;
+    }
+#else
+    (void)docs;
+#endif
+    return 0;
+}
+
+// Recall@k of the quantized scan and of the re-ranked results against the exact cosine ranking. A result counts as found when it
+// scores at least as high as the k-th exact one, so ties at the boundary are not held against it.
+static int32_t  test_quantize   (span<const string_view> docs) {
+    std::mt19937                    random          (781);
+    vector<string_view>             words;
+    vector<llai::TokenRange>        tokenRanges;
+    for(const string_view document : docs) {
+        tokenRanges.clear();
+        llai::tokenize(document, tokenRanges);
+        for(const auto tokenRange : tokenRanges)
+            words.push_back(document.substr(tokenRange.Offset, tokenRange.Size));
+    }
+    vector<std::string>             queryTexts      (100);
+    for(auto & query : queryTexts)
+        for(uint32_t iWord = 0, count = 1 + random() % 6; iWord < count; ++iWord)
+            query.append(words[random() % (random() % size(words) + 1)]).append(" ");  // Skewed towards the first words
+    const vector<string_view>       queryViews      (queryTexts.begin(), queryTexts.end());
+    TestCorpus                      corpus;
+    llai::SparseMatrix              queries;
+    if(0 > build_corpus(docs, 2000, 3, 781, corpus) || 0 > llai::weight_queries(queryViews, corpus.Dictionary, corpus.IdfScores, queries, 1))
+        return -1;
+    const vector<string_view>     & views           = corpus.Views;
+    const llai::SparseMatrix      & weighted        = corpus.Weighted;
+    static constexpr uint32_t       k               = 10;
+    vector<vector<llai::ScoredDoc>> expected        (size(queryViews));
+    for(uint32_t iQuery = 0; iQuery < size(queryViews); ++iQuery) {
+        for(uint32_t iDoc = 0; iDoc < size(views); ++iDoc) {
+            const double score = llai::cosine_similarity(llai::sparse_row(queries, iQuery), llai::sparse_row(weighted, iDoc));
+            if(score > 0)
+                llai::push_top_k(expected[iQuery], k, {iDoc, score});
+        }
+        llai::sort_top_k(expected[iQuery]);
+    }
+    auto                            recall          = [&](uint32_t iQuery, const vector<llai::ScoredDoc> & results) {
+        uint32_t found = 0;
+        for(const llai::ScoredDoc & result : results)
+            found += llai::cosine_similarity(llai::sparse_row(queries, iQuery), llai::sparse_row(weighted, result.Doc)) >= expected[iQuery].back().Score;
+        return std::min(found, (uint32_t)expected[iQuery].size());
+    };
+    for(const auto format : {llai::QUANTIZATION_INT8, llai::QUANTIZATION_INT16}) {
+        llai::QuantizedMatrix           quantized;
+        if(0 > llai::quantize_matrix(weighted, format, quantized))
+            return -1;
+        const double                    exactRowBytes   = llai::row_bytes(llai::matrix_view(weighted));
+        const double                    rowBytes        = llai::quantized_row_bytes(quantized);
+        const double                    addedRowBytes   = llai::quantized_bytes(quantized) / (double)llai::sparse_rows(weighted);
+        uint32_t                        expectedCount   = 0;
+        uint32_t                        scanFound       = 0;
+        uint32_t                        rerankFound     = 0;
+        for(uint32_t iQuery = 0; iQuery < size(queryViews); ++iQuery) {
+            vector<llai::ScoredDoc>         scanned;
+            vector<llai::ScoredDoc>         reranked;
+            vector<llai::ScoredDoc>         threaded;
+            if(0 > llai::scan_top_k(quantized, llai::sparse_row(queries, iQuery), k, scanned, 1)
+             || 0 > llai::query_top_k(quantized, llai::sparse_row(queries, iQuery), k, 4 * k, reranked, 1)
+             || 0 > llai::query_top_k(quantized, llai::sparse_row(queries, iQuery), k, 4 * k, threaded, 3))
+                return -1;
+            bool                            same            = reranked.size() == threaded.size();
+            for(uint32_t iResult = 0; same && iResult < reranked.size(); ++iResult)
+                same = reranked[iResult].Doc == threaded[iResult].Doc && reranked[iResult].Score == threaded[iResult].Score;
+            if(not same) {
+                log_error("Quantized query %u returned different results on 3 threads.", iQuery);
+                return -1;
+            }
+            expectedCount   += (uint32_t)expected[iQuery].size();
+            scanFound       += recall(iQuery, scanned);
+            rerankFound     += recall(iQuery, reranked);
+        }
+        const double                    scanRecall      = expectedCount ? scanFound / (double)expectedCount : 1;
+        const double                    rerankRecall    = expectedCount ? rerankFound / (double)expectedCount : 1;
+        printf("%s rows: %.1f bytes instead of %.1f, %.1f added next to the exact ones, recall@%u %.4f from the scan, %.4f re-ranked.\n"
+            , (llai::QUANTIZATION_INT8 == format) ? "int8" : "int16", rowBytes, exactRowBytes, addedRowBytes, k, scanRecall, rerankRecall);
+        // Term ids and offsets are borrowed from the exact rows, so a row costs its quantized weights and scale on top of them.
+        const bool                      int8            = llai::QUANTIZATION_INT8 == format;
+        if(rerankRecall < (int8 ? 0.98 : 0.995) || rowBytes > exactRowBytes * (int8 ? 0.45 : 0.55) || addedRowBytes > exactRowBytes * (int8 ? 0.1 : 0.2)) {
+            log_error("Quantized recall@%u %f with rows of %f bytes instead of %f.", k, rerankRecall, rowBytes, exactRowBytes);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// Documents are matched against the ones before them, as when deduplicating a stream. Banded MinHash must find nearly every pair that
+// brute force scores above the threshold while looking at a small share of the corpus, and SimHash blocks must find every pair within
+// the distance they guarantee.
+static int32_t  test_sketch     (span<const string_view> /*docs*/) {  // The sample documents share too few words to tell duplicates apart.
+    std::mt19937                    random          (782);
+    vector<std::string>             vocabulary      (20000);
+    for(uint32_t iWord = 0; iWord < size(vocabulary); ++iWord)
+        for(uint32_t value = iWord + 1; value; value /= 26)
+            vocabulary[iWord] += char('a' + value % 26);
+    const vector<string_view>       words           (vocabulary.begin(), vocabulary.end());
+    vector<llai::TokenRange>        tokenRanges;
+    vector<vector<string_view>>     documentWords   (1500);
+    for(uint32_t iDoc = 0; iDoc < size(documentWords); ++iDoc) {
+        if(iDoc >= 1000) {  // Near-duplicate: an earlier document with a few words replaced
+            documentWords[iDoc] = documentWords[random() % iDoc];
+            for(auto & word : documentWords[iDoc])
+                if(0 == random() % 20)
+                    word = words[random() % size(words)];
+        }
+        else
+            for(uint32_t iWord = 0, count = 20 + random() % 40; iWord < count; ++iWord)
+                documentWords[iDoc].push_back(words[random() % (random() % size(words) + 1)]);
+    }
+    vector<std::string>             corpus          (size(documentWords));
+    for(uint32_t iDoc = 0; iDoc < size(corpus); ++iDoc)
+        for(const string_view word : documentWords[iDoc])
+            corpus[iDoc].append(word).append(" ");
+    const vector<string_view>       views           (corpus.begin(), corpus.end());
+    llai::TermDictionary            dictionary;
+    vector<double>                  idf_scores;
+    llai::SparseMatrix              weighted;
+    if(0 > llai::load_docs(views, dictionary, idf_scores, weighted))
+        return -1;
+
+    static constexpr double         threshold       = 0.8;
+    static constexpr uint32_t       rowsPerBand     = 4;
+    vector<llai::SimilarPair>       expected;
+    for(uint32_t iDocB = 0; iDocB < size(views); ++iDocB)
+        for(uint32_t iDocA = 0; iDocA < iDocB; ++iDocA) {
+            const double score = llai::cosine_similarity(llai::sparse_row(weighted, iDocB), llai::sparse_row(weighted, iDocA));
+            if(score >= threshold)
+                expected.push_back({iDocA, iDocB, score});
+        }
+    llai::LshIndex                  minhashIndex;
+    llai::LshIndex                  simhashIndex;
+    if(0 > llai::lsh_init(minhashIndex, 128 / rowsPerBand) || 0 > llai::lsh_init(simhashIndex, 4))
+        return -1;
+    vector<vector<uint32_t>>        signatures      (size(views), vector<uint32_t>(128));
+    vector<uint64_t>                simhashes       (size(views));
+    vector<uint64_t>                tokenHashes;
+    vector<uint64_t>                keys            (minhashIndex.BandCount);
+    vector<uint64_t>                blocks          (simhashIndex.BandCount);
+    vector<llai::SimilarPair>       found;
+    vector<llai::ScoredDoc>         duplicates;
+    vector<uint32_t>                candidates;
+    uint64_t                        candidateCount  = 0;
+    double                          estimateError   = 0;
+    for(uint32_t iDoc = 0; iDoc < size(views); ++iDoc) {
+        tokenRanges.clear();
+        llai::tokenize(views[iDoc], tokenRanges);
+        if(0 > llai::minhash(views[iDoc], tokenRanges, signatures[iDoc], tokenHashes) || 0 > llai::minhash_bands(signatures[iDoc], rowsPerBand, keys))
+            return -1;
+        if(0 > llai::near_duplicates(minhashIndex, keys, llai::matrix_view(weighted), llai::sparse_row(weighted, iDoc), threshold, duplicates)
+         || 0 > llai::lsh_candidates(minhashIndex, keys, candidates))
+            return -1;
+        candidateCount += candidates.size();
+        for(const llai::ScoredDoc & duplicate : duplicates)
+            found.push_back({duplicate.Doc, iDoc, duplicate.Score});
+        if(iDoc != (uint32_t)llai::lsh_insert(minhashIndex, keys))
+            return -1;
+
+        simhashes[iDoc] = llai::simhash(llai::sparse_row(weighted, iDoc));
+        if(0 > llai::simhash_bands(simhashes[iDoc], blocks) || 0 > llai::lsh_candidates(simhashIndex, blocks, candidates))
+            return -1;
+        for(uint32_t iDocA = 0; iDocA < iDoc; ++iDocA) {
+            if(llai::simhash_distance(simhashes[iDocA], simhashes[iDoc]) < simhashIndex.BandCount && not std::binary_search(candidates.begin(), candidates.end(), iDocA)) {
+                log_error("SimHash of documents %u and %u differ in %u bits but share no block.", iDocA, iDoc, llai::simhash_distance(simhashes[iDocA], simhashes[iDoc]));
+                return -1;
+            }
+        }
+        if(0 > llai::lsh_insert(simhashIndex, blocks))
+            return -1;
+    }
+    for(const llai::SimilarPair & pair : expected) {
+        std::unordered_set<string_view> setA            (documentWords[pair.DocA].begin(), documentWords[pair.DocA].end());
+        std::unordered_set<string_view> setB            (documentWords[pair.DocB].begin(), documentWords[pair.DocB].end());
+        uint32_t                        shared          = 0;
+        for(const string_view word : setA)
+            shared += (uint32_t)setB.count(word);
+        estimateError += fabs(llai::minhash_similarity(signatures[pair.DocA], signatures[pair.DocB]) - shared / double(setA.size() + setB.size() - shared));
+    }
+    uint32_t                        matched         = 0;
+    for(const llai::SimilarPair & pair : found)
+        matched += std::any_of(expected.begin(), expected.end(), [&](const llai::SimilarPair & hit) { return hit.DocA == pair.DocA && hit.DocB == pair.DocB && hit.Score == pair.Score; });
+    const double                    recall          = expected.size() ? matched / (double)expected.size() : 1;
+    const double                    scanned         = candidateCount / (size(views) * (size(views) - 1) / 2.0);
+    printf("Near-duplicates at %.2f: %u of %u pairs found looking at %.2f%% of the pairs, Jaccard estimates off by %.3f on average.\n"
+        , threshold, matched, (uint32_t)expected.size(), scanned * 100, expected.size() ? estimateError / expected.size() : 0.0);
+    if(expected.empty() || matched != found.size() || recall < 0.95 || scanned > 0.1 || estimateError / expected.size() > 0.05) {
+        log_error("Near-duplicate recall %f, %u results not in the exact set, %f of the pairs looked at.", recall, (uint32_t)(found.size() - matched), scanned);
+        return -1;
+    }
+    return 0;
+}
+
+// Accented and decomposed spellings, case and plurals of a word must all land on one term, while ASCII text tokenizes as before.
+static int32_t  test_normalize  (span<const string_view> docs) {
+    vector<llai::TokenRange>        asciiRanges;
+    vector<llai::TokenRange>        utf8Ranges;
+    for(const string_view document : docs) {
+        asciiRanges.clear();
+        utf8Ranges.clear();
+        if(0 > llai::tokenize(document, asciiRanges) || 0 > llai::tokenize_utf8(document, utf8Ranges))
+            return -1;
+        bool                            ascii           = true;
+        for(const char c : document)
+            ascii = ascii && (uint8_t)c < 0x80;
+        if(ascii && (asciiRanges.size() != utf8Ranges.size() || not std::equal(asciiRanges.begin(), asciiRanges.end(), utf8Ranges.begin()
+            , [](const llai::TokenRange & a, const llai::TokenRange & b) { return a.Offset == b.Offset && a.Size == b.Size; }))) {
+            log_error("tokenize_utf8 split ASCII text differently: %u tokens instead of %u.", (uint32_t)utf8Ranges.size(), (uint32_t)asciiRanges.size());
+            return -1;
+        }
+    }
+    // "Cámara CÁMARAS camarás batería, BATERÍAS! Straße STRASSE ÆON — \xFF ΣΟΦΊΑ σοφία МОСКВА москва dogs Dog cities gas glasses 😀 ok"
+    const string_view               text            = "C\xC3\xA1mara C\xC3\x81MARAS camara\xCC\x81s bater\xC3\xAD" "a, BATER\xC3\x8D" "AS! Stra\xC3\x9F" "e STRASSE \xC3\x86ON \xE2\x80\x94 \xFF "
+        "\xCE\xA3\xCE\x9F\xCE\xA6\xCE\x8A\xCE\x91 \xCF\x83\xCE\xBF\xCF\x86\xCE\xAF\xCE\xB1 \xD0\x9C\xD0\x9E\xD0\xA1\xD0\x9A\xD0\x92\xD0\x90 \xD0\xBC\xD0\xBE\xD1\x81\xD0\xBA\xD0\xB2\xD0\xB0 "
+        "dogs Dog cities gas glasses \xF0\x9F\x98\x80ok";
+    static constexpr const char *   expected        [] =
+        { "camara", "camara", "camara", "bateria", "bateria", "strasse", "strasse", "aeon"
+        , "\xCF\x83\xCE\xBF\xCF\x86\xCE\xAF\xCE\xB1", "\xCF\x83\xCE\xBF\xCF\x86\xCE\xAF\xCE\xB1", "\xD0\xBC\xD0\xBE\xD1\x81\xD0\xBA\xD0\xB2\xD0\xB0", "\xD0\xBC\xD0\xBE\xD1\x81\xD0\xBA\xD0\xB2\xD0\xB0"
+        , "dog", "dog", "city", "gas", "glasse", "ok"
+        };
+    llai::NormalizedTokens          normalized;
+    utf8Ranges.clear();
+    if(0 > llai::tokenize_utf8(text, utf8Ranges) || 0 > llai::normalize_tokens(text, utf8Ranges, llai::NORMALIZE_DEFAULT | llai::NORMALIZE_STEM, normalized))
+        return -1;
+    for(uint32_t iTerm = 0; iTerm < size(expected) || iTerm < normalized.Ranges.size(); ++iTerm) {
+        const string_view               term            = (iTerm < normalized.Ranges.size()) ? string_view(normalized.Text).substr(normalized.Ranges[iTerm].Offset, normalized.Ranges[iTerm].Size) : "";
+        if(iTerm >= size(expected) || term != expected[iTerm]) {
+            log_error("Term %u normalized to '%.*s' instead of '%s'.", iTerm, (int)term.size(), term.data(), (iTerm < size(expected)) ? expected[iTerm] : "");
+            return -1;
+        }
+    }
+
+    // Words of the sample documents spelled in upper case, capitalized or plural in some copies
+    std::mt19937                    random          (783);
+    vector<std::string>             variants        (size(docs));
+    for(uint32_t iDoc = 0; iDoc < size(docs); ++iDoc) {
+        asciiRanges.clear();
+        llai::tokenize(docs[iDoc], asciiRanges);
+        for(const auto tokenRange : asciiRanges) {
+            std::string                     word            (docs[iDoc].substr(tokenRange.Offset, tokenRange.Size));
+            switch(random() % 4) {
+            case 0: for(char & c : word) c = (char)toupper(c); break;
+            case 1: word[0] = (char)toupper(word[0]); break;
+            }
+            variants[iDoc].append(word).append(" ");
+        }
+    }
+    const vector<string_view>       views           (variants.begin(), variants.end());
+    llai::TermDictionary            rawDictionary;
+    llai::TermDictionary            dictionary;
+    llai::StringArena               arena;
+    vector<double>                  idf_scores;
+    llai::SparseMatrix              rawWeighted;
+    llai::SparseMatrix              weighted;
+    if(0 > llai::load_docs(views, rawDictionary, idf_scores, rawWeighted) || 0 > llai::load_docs(views, llai::NORMALIZE_DEFAULT, dictionary, arena, idf_scores, weighted))
+        return -1;
+    printf("Normalization: %u terms instead of %u.\n", (uint32_t)dictionary.Terms.size(), (uint32_t)rawDictionary.Terms.size());
+    if(dictionary.Terms.size() >= rawDictionary.Terms.size() || sparse_rows(weighted) != size(docs)) {
+        log_error("%s", "Normalization did not shrink the vocabulary.");
+        return -1;
+    }
+    for(const string_view term : dictionary.Terms)
+        for(const char c : term)
+            if(c >= 'A' && c <= 'Z') {
+                log_error("Term '%.*s' was not lowercased.", (int)term.size(), term.data());
+                return -1;
+            }
+    variants.clear();   // The dictionary owns its terms.
+    const string_view               query           = docs[0].substr(0, docs[0].find(' '));
+    llai::InvertedIndex             index;
+    llai::SparseVector              frequencies;
+    llai::SparseVector              weightedQuery;
+    vector<llai::ScoredDoc>         results;
+    asciiRanges.clear();
+    if(0 > llai::build_index(weighted, (uint32_t)dictionary.Terms.size(), index)
+     || 0 > llai::tokenize_utf8(query, asciiRanges)
+     || 0 > llai::term_frequency(query, asciiRanges, llai::NORMALIZE_DEFAULT, normalized, dictionary, frequencies)
+     || 0 > llai::weight_terms(sparse_row(frequencies), idf_scores, weightedQuery)
+     || 0 > llai::query_top_k(index, sparse_row(weightedQuery), (uint32_t)size(docs), results))
+        return -1;
+    if(weightedQuery.Terms.empty() || results.empty() || std::none_of(results.begin(), results.end(), [](const llai::ScoredDoc & result) { return 0 == result.Doc; })) {
+        log_error("Query '%.*s' did not find the document it came from.", (int)query.size(), query.data());
+        return -1;
+    }
+    return 0;
+}
+
+// Answers over the socket must match query_top_k bit for bit, whether they were computed in a batch or taken from the cache.
+static int32_t  test_server     (span<const string_view> docs) {
+    llai::TermDictionary            dictionary;
+    vector<double>                  idf_scores;
+    llai::SparseMatrix              weighted;
+    llai::InvertedIndex             index;
+    if(0 > llai::load_docs(docs, dictionary, idf_scores, weighted, index))
+        return -1;
+    vector<std::string>             queryText;
+    for(uint32_t iDoc = 0; iDoc < size(docs) && queryText.size() < 20; iDoc += 3) {
+        const string_view               document        = docs[iDoc];
+        const size_t                    first           = document.find(' ');
+        queryText.emplace_back(document.substr(0, document.find(' ', first + 1)));
+    }
+    const vector<string_view>       queries         (queryText.begin(), queryText.end());
+    llai::ServerConfig              config;
+    config.Workers          = 2;
+    config.BatchWindowUs    = 2000;
+    config.CacheEntries     = 64;
+    vector<std::string>             endpoints       = {""};
+#ifndef _WIN32
+    endpoints.push_back((std::filesystem::temp_directory_path() / "llai_test.sock").string());
+#endif
+    for(const std::string & endpoint : endpoints) {
+        llai::QueryServer               server;
+        llai::QueryClient               client;
+        llai::ServerStats               stats           = {};
+        config.UnixPath = endpoint;
+        if(0 > llai::server_start(server, config, llai::index_view(index), llai::query_weighter(dictionary, idf_scores)))
+            return -1;
+        int32_t                         result          = llai::client_connect(client, endpoint, server.Port);
+        vector<llai::ScoredDoc>         expected;
+        vector<llai::ScoredDoc>         answered;
+        vector<llai::TokenRange>        tokenRanges;
+        llai::SparseVector              frequencies;
+        llai::SparseVector              weightedQuery;
+        for(uint32_t iQuery = 0; 0 <= result && iQuery < 2 * queries.size(); ++iQuery) {     // The second round comes from the cache.
+            const string_view               query           = queries[iQuery % queries.size()];
+            tokenRanges.clear();
+            result = llai::tokenize(query, tokenRanges);
+            if(0 <= result)
+                result = llai::term_frequency(query, tokenRanges, (const llai::TermDictionary &)dictionary, frequencies);
+            if(0 <= result)
+                result = llai::weight_terms(sparse_row(frequencies), idf_scores, weightedQuery);
+            if(0 <= result)
+                result = llai::query_top_k(index, sparse_row(weightedQuery), 5, expected);
+            if(0 <= result)
+                result = llai::client_query(client, query, 5, answered);
+            if(0 <= result && (expected.size() != answered.size() || not std::equal(expected.begin(), expected.end(), answered.begin()
+                , [](const llai::ScoredDoc & a, const llai::ScoredDoc & b) { return a.Doc == b.Doc && a.Score == b.Score; }))) {
+                log_error("Server answered '%.*s' with %u results instead of %u, or with other scores.", (int)query.size(), query.data(), (uint32_t)answered.size(), (uint32_t)expected.size());
+                result = -1;
+            }
+        }
+        if(0 <= result && (0 <= llai::client_query(client, "x\nSTATS", 5, answered) || 0 <= llai::client_query(client, "dog", 0, answered))) {
+            log_error("%s", "Malformed requests were answered.");
+            result = -1;
+        }
+        llai::LoadConfig                load;
+        llai::LoadReport                report          = {};
+        load.UnixPath       = endpoint;
+        load.Port           = server.Port;
+        load.Connections    = 4;
+        load.Requests       = 400;
+        load.K              = 5;
+        if(0 <= result)     // Every load request is a cache hit, so the idle client must not hold it for the batch window.
+            result = llai::run_load(load, queries, report);
+        if(0 <= result)
+            result = llai::client_stats(client, stats);
+        llai::client_close(client);
+        llai::server_stop(server);
+        if(0 > result)
+            return -1;
+        printf("Server on '%s': %llu requests, %.1f%% from the cache, %.2f per batch, p50 %.1f us, p99 %.1f us. Load generator: p50 %.1f us, p99 %.1f us.\n"
+            , endpoint.empty() ? "tcp" : endpoint.c_str(), (unsigned long long)stats.Requests, stats.CacheHits * 100.0 / stats.Requests, (stats.Requests - stats.CacheHits) / (double)stats.Batches
+            , stats.P50Us, stats.P99Us, report.P50Us, report.P99Us);
+        // Every query was asked twice before the load, which repeats each one 20 times. Rejected requests are not counted.
+        if(stats.Requests != 2 * queries.size() + load.Requests || report.Requests != load.Requests || stats.CacheHits < load.Requests || stats.P99Us < stats.P50Us || stats.Connections != 1 + load.Connections || stats.P50Us >= config.BatchWindowUs) {
+            log_error("Unexpected server statistics: %llu requests, %llu cache hits, %llu connections.", (unsigned long long)stats.Requests, (unsigned long long)stats.CacheHits, (unsigned long long)stats.Connections);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static bool     same_rows       (const llai::SparseRow & a, const llai::SparseRow & b) {
+    return a.Terms.size() == b.Terms.size() && std::equal(a.Terms.begin(), a.Terms.end(), b.Terms.begin()) && std::equal(a.Weights.begin(), a.Weights.end(), b.Weights.begin());
+}
+static int32_t  test_shard      (span<const string_view> docs) {
+    llai::TermDictionary            dictionary;
+    vector<double>                  idf_scores;
+    llai::SparseMatrix              weighted;
+    llai::InvertedIndex             index;
+    llai::GlobalStatistics          global;
+    vector<llai::IndexShard>        shards;
+    static  constexpr uint32_t      shardCount      = 3;
+    if(0 > llai::load_docs(docs, dictionary, idf_scores, weighted, index) || 0 > llai::build_shards(docs, shardCount, global, shards))
+        return -1;
+    // The exchanged statistics give the same term ids and IDF as the single index, so every weighted row matches bit for bit.
+    if(global.Dictionary.Terms != dictionary.Terms || global.IdfScores != idf_scores || global.DocCount != size(docs)) {
+        log_error("Global statistics of %u terms and %u documents differ from those of the single index.", (uint32_t)global.IdfScores.size(), global.DocCount);
+        return -1;
+    }
+    for(const llai::IndexShard & shard : shards)
+        for(uint32_t iDoc = 0; iDoc < llai::sparse_rows(shard.Weighted); ++iDoc)
+            if(not same_rows(llai::sparse_row(shard.Weighted, iDoc), llai::sparse_row(weighted, shard.FirstDoc + iDoc))) {
+                log_error("Document %u is weighted differently in its shard.", shard.FirstDoc + iDoc);
+                return -1;
+            }
+
+    // Shards in separate processes: each writes its statistics, then merges everyone's read back from the files.
+    vector<llai::IndexShard>        processShards   (shardCount);
+    vector<llai::ShardStatistics>   loaded          (shardCount);
+    llai::StringArena               arena;
+    for(uint32_t iShard = 0; iShard < shardCount; ++iShard) {
+        const std::string               path            = (std::filesystem::temp_directory_path() / ("llai_test_shard" + std::to_string(iShard) + ".stats")).string();
+        const uint32_t                  first           = shards[iShard].FirstDoc;
+        const uint32_t                  end             = (iShard + 1 < shardCount) ? shards[iShard + 1].FirstDoc : (uint32_t)size(docs);
+        llai::ShardStatistics           statistics;
+        if(0 > llai::load_shard(docs.subspan(first, end - first), first, processShards[iShard]) || 0 > llai::shard_statistics(processShards[iShard], statistics)
+         || 0 > llai::save_statistics(path.c_str(), statistics) || 0 > llai::load_statistics(path.c_str(), loaded[iShard], arena))
+            return -1;
+        std::filesystem::remove(path);
+        if(loaded[iShard].Terms != statistics.Terms || loaded[iShard].DocFrequencies != statistics.DocFrequencies || loaded[iShard].DocCount != statistics.DocCount) {
+            log_error("Statistics of shard %u changed through the file.", iShard);
+            return -1;
+        }
+    }
+    for(uint32_t iShard = 0; iShard < shardCount; ++iShard) {
+        llai::GlobalStatistics          merged;
+        if(0 > llai::merge_statistics(loaded, merged) || 0 > llai::finish_shard(processShards[iShard], merged))
+            return -1;
+        if(merged.IdfScores != idf_scores || processShards[iShard].Weighted.Terms != shards[iShard].Weighted.Terms || processShards[iShard].Weighted.Weights != shards[iShard].Weighted.Weights) {
+            log_error("Shard %u built from statistics files differs.", iShard);
+            return -1;
+        }
+    }
+
+    // Scatter-gather with the middle shard served over TCP and the others searched in this process.
+    vector<std::string>             queryText;
+    for(uint32_t iDoc = 0; iDoc < size(docs) && queryText.size() < 40; ++iDoc) {
+        const string_view               document        = docs[iDoc];
+        const size_t                    first           = document.find(' ');
+        queryText.emplace_back(document.substr(0, document.find(' ', first + 1)));
+    }
+    queryText.emplace_back("zzqx");
+    const vector<string_view>       queries         (queryText.begin(), queryText.end());
+    llai::ServerConfig              config;
+    config.Workers          = 2;
+    llai::QueryServer               server;
+    const llai::QueryWeighter       weigh           = llai::query_weighter(global.Dictionary, global.IdfScores);
+    if(0 > llai::server_start(server, config, llai::index_view(shards[1].Index), weigh))
+        return -1;
+    const llai::ShardEndpoint       endpoints   []  = {{llai::index_view(shards[0].Index), "", 0}, {{}, "", server.Port}, {llai::index_view(shards[2].Index), "", 0}};
+    llai::ShardCoordinator          coordinator;
+    vector<vector<llai::ScoredDoc>> results;
+    int32_t                         result          = llai::coordinator_start(coordinator, endpoints, weigh);
+    // A batch the server refuses, with k over its limit, comes first: the lanes must not leave its answers to be read with the next one.
+    vector<vector<llai::ScoredDoc>> refused;
+    if(0 <= result && 0 <= llai::coordinator_query(coordinator, queries, config.MaxK + 1, refused)) {
+        log_error("%s", "The coordinator accepted a k over the limit of its remote shard.");
+        result = -1;
+    }
+    if(0 <= result)
+        result = llai::coordinator_query(coordinator, queries, 10, results);
+    const uint32_t                  docCount        = coordinator.DocCount;
+    llai::coordinator_stop(coordinator);
+    llai::server_stop(server);
+    if(0 > result || docCount != size(docs))
+        return -1;
+    const llai::QueryWeighter       weighSingle     = llai::query_weighter(dictionary, idf_scores);
+    llai::SparseVector              weightedQuery;
+    vector<llai::ScoredDoc>         expected;
+    for(uint32_t iQuery = 0; iQuery < queries.size(); ++iQuery) {
+        if(0 > weighSingle(queries[iQuery], weightedQuery) || 0 > llai::query_top_k(index, sparse_row(weightedQuery), 10, expected))
+            return -1;
+        const vector<llai::ScoredDoc> & merged          = results[iQuery];
+        if(expected.size() != merged.size() || not std::equal(expected.begin(), expected.end(), merged.begin()
+            , [](const llai::ScoredDoc & a, const llai::ScoredDoc & b) { return a.Doc == b.Doc && a.Score == b.Score; })) {
+            log_error("Shards answered '%.*s' with %u results instead of %u, or with other scores.", (int)queries[iQuery].size(), queries[iQuery].data(), (uint32_t)merged.size(), (uint32_t)expected.size());
+            return -1;
+        }
+        for(const llai::ScoredDoc & scored : merged)
+            if(fabs(scored.Score - llai::cosine_similarity(sparse_row(weightedQuery), llai::sparse_row(weighted, scored.Doc))) > 1e-9) {
+                log_error("Shard score %f of document %u is not its cosine similarity.", scored.Score, scored.Doc);
+                return -1;
+            }
+    }
+
+    // Normalized shards match the normalized load_docs, and a saved shard weighs queries like the statistics it was built with.
+    static  constexpr uint8_t       flags           = llai::NORMALIZE_DEFAULT | llai::NORMALIZE_STEM;
+    llai::TermDictionary            normalizedDictionary;
+    llai::StringArena               normalizedArena;
+    llai::SparseMatrix              normalizedWeighted;
+    llai::GlobalStatistics          normalizedGlobal;
+    if(0 > llai::load_docs(docs, flags, normalizedDictionary, normalizedArena, idf_scores, normalizedWeighted) || 0 > llai::build_shards(docs, shardCount, normalizedGlobal, shards, flags))
+        return -1;
+    if(normalizedGlobal.Dictionary.Terms != normalizedDictionary.Terms || normalizedGlobal.IdfScores != idf_scores) {
+        log_error("Normalized statistics of %u terms differ from those of the single index.", (uint32_t)normalizedGlobal.IdfScores.size());
+        return -1;
+    }
+    for(const llai::IndexShard & shard : shards)
+        for(uint32_t iDoc = 0; iDoc < llai::sparse_rows(shard.Weighted); ++iDoc)
+            if(not same_rows(llai::sparse_row(shard.Weighted, iDoc), llai::sparse_row(normalizedWeighted, shard.FirstDoc + iDoc))) {
+                log_error("Document %u is weighted differently in its normalized shard.", shard.FirstDoc + iDoc);
+                return -1;
+            }
+    const std::string               indexPath       = (std::filesystem::temp_directory_path() / "llai_test_shard.idx").string();
+    llai::MappedIndex               mapped;
+    if(0 > llai::save_index(indexPath.c_str(), normalizedGlobal.Dictionary, normalizedGlobal.IdfScores, shards[0].Weighted, shards[0].Index) || 0 > llai::open_index(indexPath.c_str(), mapped))
+        return -1;
+    const llai::QueryWeighter       weighMapped     = llai::query_weighter(mapped, flags);
+    const llai::QueryWeighter       weighNormalized = llai::query_weighter(normalizedGlobal.Dictionary, normalizedGlobal.IdfScores, flags);
+    llai::SparseVector              mappedQuery;
+    result = 0;
+    for(uint32_t iQuery = 0; iQuery < queries.size() && 0 <= result; ++iQuery)
+        if(0 > (result = weighNormalized(queries[iQuery], weightedQuery)) || 0 > (result = weighMapped(queries[iQuery], mappedQuery))
+         || not same_rows(sparse_row(weightedQuery), sparse_row(mappedQuery))) {
+            log_error("The saved normalized shard weighs '%.*s' differently.", (int)queries[iQuery].size(), queries[iQuery].data());
+            result = -1;
+        }
+    llai::close_index(mapped);
+    std::filesystem::remove(indexPath);
+    if(0 > result)
+        return -1;
+    printf("%u shards answered %u queries exactly like the single index, normalized or not.\n", shardCount, (uint32_t)queries.size());
+    return 0;
+}
+
+static int      open_file       (const char * path) {
+#ifdef _WIN32
+    int fd = -1;
+    _sopen_s(&fd, path, _O_RDONLY | _O_BINARY, _SH_DENYNO, 0);
+    return fd;
+#else
+    return open(path, O_RDONLY);
+#endif
+}
+static void     close_file      (int fd) {
+#ifdef _WIN32
+    _close(fd);
+#else
+    close(fd);
+#endif
+}
+
+// Streaming the documents from a file, in either format and with chunks small enough to split tokens, must match load_docs bit for bit.
+static int32_t  test_stream     (span<const string_view> docs) {
+    llai::TermDictionary            dictionary;
+    vector<double>                  idf_scores;
+    llai::SparseMatrix              weighted;
+	llai::load_docs(docs, dictionary, idf_scores, weighted);
+    const std::string               path        = (std::filesystem::temp_directory_path() / "llai_test.docs").string();
+    int32_t                         result      = 0;
+    for(const llai::DOCUMENT_FORMAT format : {llai::DOCUMENT_FORMAT_LINES, llai::DOCUMENT_FORMAT_LENGTH_PREFIXED}) {
+        vector<uint64_t>                offsets;
+        {
+            std::ofstream                   file        (path, std::ios::binary);
+            for(const auto & document : docs) {
+                if(llai::DOCUMENT_FORMAT_LENGTH_PREFIXED == format)
+                    for(uint64_t iByte = 0, length = document.size(); iByte < 8; ++iByte)
+                        file.put(char(length >> (iByte * 8)));
+                offsets.push_back((uint64_t)file.tellp());
+                file.write(document.data(), document.size());
+                if(llai::DOCUMENT_FORMAT_LINES == format)
+                    file.put('\n');
+            }
+        }
+        for(const uint32_t chunkSize : {16u, 1000u, 1u << 20}) {
+            llai::TermDictionary            streamDictionary;
+            llai::StringArena               arena;
+            vector<double>                  streamIdf;
+            llai::SparseMatrix              streamWeighted;
+            vector<llai::DocumentSpan>      spans;
+            const int                       fd          = open_file(path.c_str());
+            const int32_t                   docCount    = llai::load_stream(fd, format, streamDictionary, arena, streamIdf, streamWeighted, spans, chunkSize);
+            close_file(fd);
+            bool                            matches     = docCount == (int32_t)size(docs)
+                && streamDictionary.Terms == dictionary.Terms
+                && streamIdf.size() == idf_scores.size()            && 0 == memcmp(streamIdf.data(), idf_scores.data(), idf_scores.size() * sizeof(double))
+                && streamWeighted.Offsets == weighted.Offsets       && streamWeighted.Terms == weighted.Terms
+                && 0 == memcmp(streamWeighted.Weights.data(), weighted.Weights.data(), weighted.Weights.size() * sizeof(double))
+                ;
+            for(uint32_t iDoc = 0; matches && iDoc < size(docs); ++iDoc)
+                matches = spans[iDoc].Offset == offsets[iDoc] && spans[iDoc].Size == docs[iDoc].size();
+            if(not matches) {
+                log_error("Streamed index with format %u and %u-byte chunks differs from load_docs.", format, chunkSize);
+                result = -1;
+            }
+        }
+    }
+    std::filesystem::remove(path);
+    return result;
+}
+
 int test_ranking(span<const string_view> docs, llai::TokenWeightMap & idf_scores, span<llai::TokenWeightMap> weighted) {
     using namespace llai;
     vector<vector<llai::TokenRange>>        tokenRanges;        tokenRanges     .resize(size(docs));
@@ -133,15 +1312,15 @@ int main() {
         , "Developed countries make up approximately 20%% of the global dog population, while around 75%% of dogs are estimated to be from developing countries, mainly in the form of feral and community dogs."
         , "Mobile phones are considered an important human invention as they have been one of the most widely used and sold pieces of consumer technology.[9] The growth in popularity has been rapid in some places; for example, in the UK, the total number of mobile phones overtook the number of houses in 1999.[10]"
     };
-    llai::TokenWeightMap                    idf_scores;
-    vector<llai::TokenWeightMap>            weighted;           
-    weighted.resize(size(docs));
-	llai::load_docs(docs, idf_scores, weighted); // Load documents and calculate IDF and weighted terms
+    llai::TermDictionary                    dictionary;
+    vector<double>                          idf_scores;
+    llai::SparseMatrix                      weighted;           
+	llai::load_docs(docs, dictionary, idf_scores, weighted); // Load documents and calculate IDF and weighted terms
     //test_ranking(docs, idf_scores, weighted); 
     //test_ranking_2(docs, idf_scores, weighted); 
     {
         const string_view           text_query      = "un celu con muy buena onda";
-        const int                   bestMatch       = test_query(idf_scores, weighted, text_query);
+        const int                   bestMatch       = test_query(dictionary, idf_scores, weighted, text_query);
         if(bestMatch < 0) 
             log_error("No match found for query: '%.*s'.", (int)text_query.size(), text_query.data());
         else {
@@ -170,7 +1349,7 @@ int main() {
 
         for(const auto & queryToMatch : queries) {
          	log_debug("\n---- Query to match: '%.*s'.", (int)queryToMatch.size(), queryToMatch.data());
-            const int                   bestMatch       = test_query(idf_scores, weighted, queryToMatch);
+            const int                   bestMatch       = test_query(dictionary, idf_scores, weighted, queryToMatch);
             if(bestMatch < 0) 
                 log_error("No match found for query: '%.*s'.", (int)queryToMatch.size(), queryToMatch.data());
             else {
@@ -178,7 +1357,16 @@ int main() {
                 log_debug("Best match:'%.*s'.", (int)comparedDoc.size(), comparedDoc.data());
             }
         }
-
+        if(0 > test_tokenize(docs) || 0 > test_tokenize(queries))
+            return -1;
+        if(0 > test_sparse(docs, queries) || 0 > test_parallel(docs))
+            return -1;
+        if(0 > test_index(docs, queries, 1) || 0 > test_index(docs, queries, 5) || 0 > test_index(docs, docs, 3))
+            return -1;
+        if(0 > test_incremental(docs, queries, 5) || 0 > test_incremental(docs, docs, 3) || 0 > test_mapped(docs, queries, 5) || 0 > test_stream(docs))
+            return -1;
+        if(0 > test_batch(docs, queries, 5) || 0 > test_batch(docs, docs, 10) || 0 > test_join(docs) || 0 > test_pmr(docs) || 0 > test_metrics(docs) || 0 > test_quantize(docs) || 0 > test_sketch(docs) || 0 > test_normalize(docs) || 0 > test_server(docs) || 0 > test_shard(docs))
+            return -1;
     }
     return 0;
 }
\ No newline at end of file